@@ -0,0 +1,719 @@
+// Microbenchmarks of utils::event_loop on the backend selected at compile
+// time. See SConstruct for building one binary per backend.
+//
+// Usage: event_loop-<backend> [--json] [--scale N] [--max-timers N] [--filter TEXT]
+//
+// --json prints one JSON object with every result, to be compared across
+// revisions; --filter only runs benchmarks whose name contains TEXT.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <utils/event_loop.hpp>
+#include <utils/rate_limiter.hpp>
+#include <utils/shm_channel.hpp>
+
+#if defined(UTILS_EVENT_LOOP_BACKEND_LIBEV)
+static const char backend[] = "libev";
+#elif defined(UTILS_EVENT_LOOP_BACKEND_EPOLL)
+static const char backend[] = "epoll";
+#elif defined(UTILS_EVENT_LOOP_BACKEND_SIMULATED)
+static const char backend[] = "simulated";
+#endif
+
+typedef std::chrono::steady_clock bench_clock;
+
+//{{{ Reporting
+
+struct result
+{
+    std::string name;
+    long ops;
+    double seconds;
+    // Latency percentiles in nanoseconds, or negative if not measured.
+    double p50;
+    double p99;
+};
+
+static std::vector<result> results;
+static bool is_json = false;
+static const char* filter = nullptr;
+
+static bool selected(const std::string& name)
+{
+    return !filter || name.find(filter) != std::string::npos;
+}
+
+static void report(const std::string& name, long ops, double seconds, double p50 = -1, double p99 = -1)
+{
+    results.push_back(result {name, ops, seconds, p50, p99});
+    if (is_json)
+        return;
+
+    printf("%-8s %-32s %10ld ops %8.3f s %12.0f ops/s %9.1f ns/op",
+           backend, name.c_str(), ops, seconds, ops / seconds, seconds * 1e9 / ops);
+    if (p50 >= 0)
+        printf("  p50 %8.0f ns  p99 %8.0f ns", p50, p99);
+    printf("\n");
+    fflush(stdout);
+}
+
+static void print_json()
+{
+    printf("{\n  \"backend\": \"%s\",\n  \"results\": [\n", backend);
+    for (std::size_t i = 0; i < results.size(); ++ i)
+    {
+        auto& r = results[i];
+        printf("    {\"name\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"ns_per_op\": %.2f",
+               r.name.c_str(), r.ops, r.seconds, r.ops / r.seconds, r.seconds * 1e9 / r.ops);
+        if (r.p50 >= 0)
+            printf(", \"p50_ns\": %.1f, \"p99_ns\": %.1f", r.p50, r.p99);
+        printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+template <typename F>
+static void measure(const std::string& name, long ops, F&& f)
+{
+    if (!selected(name))
+        return;
+    auto start = bench_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    report(name, ops, elapsed.count());
+}
+
+// Report the distribution of per-operation samples in nanoseconds.
+static void report_samples(const std::string& name, std::vector<double>& samples, double seconds)
+{
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double p) { return samples[static_cast<std::size_t>(p * (samples.size() - 1))]; };
+    report(name, static_cast<long>(samples.size()), seconds, at(0.5), at(0.99));
+}
+
+static void make_pipe(int fds[2])
+{
+    if (pipe(fds) < 0)
+    {
+        perror("pipe");
+        exit(1);
+    }
+}
+
+//}}}
+
+//{{{ Registration
+
+// Register and immediately cancel one event, *ops* times. The registry slot
+// is recycled every time, so this is the steady-state cost of a short-lived
+// event of each type.
+template <typename R>
+static void bench_register_cancel(const std::string& type, long ops, R&& reg)
+{
+    utils::event_loop loop;
+    measure("register_cancel/" + type, ops, [&]
+    {
+        for (long i = 0; i < ops; ++ i)
+            loop.cancel(reg(loop));
+    });
+}
+
+static void bench_registration(long ops)
+{
+    using namespace std::chrono;
+    int fds[2];
+    make_pipe(fds);
+    int fd = fds[0];
+
+    bench_register_cancel("io", ops, [fd](utils::event_loop& loop)
+    {
+        return loop.listen(fd, [](int) {});
+    });
+    bench_register_cancel("io_mask", ops, [fd](utils::event_loop& loop)
+    {
+        return loop.listen(fd, utils::io_read_write, [](int, int) {});
+    });
+    bench_register_cancel("signal", ops / 10, [](utils::event_loop& loop)
+    {
+        return loop.signal(SIGUSR2, [](int) {});
+    });
+    bench_register_cancel("delay", ops, [](utils::event_loop& loop)
+    {
+        return loop.delay(seconds(10), []{});
+    });
+    bench_register_cancel("delay_imm", ops, [](utils::event_loop& loop)
+    {
+        return loop.delay([]{});
+    });
+    bench_register_cancel("repeat", ops, [](utils::event_loop& loop)
+    {
+        return loop.repeat(seconds(10), []{});
+    });
+    bench_register_cancel("repeat_imm", ops, [](utils::event_loop& loop)
+    {
+        return loop.repeat([]{});
+    });
+    bench_register_cancel("delay_wheel", ops, [](utils::event_loop& loop)
+    {
+        loop.enable_timer_wheel(milliseconds(1));
+        return loop.delay(seconds(10), []{});
+    });
+
+    // A functor too large to be stored inline goes to the callback pool.
+    char payload[96] = {0};
+    bench_register_cancel("delay_large_callback", ops, [&payload](utils::event_loop& loop)
+    {
+        return loop.delay(seconds(10), [payload]{ (void) payload; });
+    });
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Destroying a unique_event cancels its event. The events are all live at
+// once, so this includes removing timers from a large queue.
+static void bench_unique_event(long ops)
+{
+    std::string name = "unique_event_destroy";
+    if (!selected(name))
+        return;
+
+    utils::event_loop loop;
+    std::vector<utils::unique_event> events;
+    events.reserve(ops);
+    for (long i = 0; i < ops; ++ i)
+        events.emplace_back(loop, loop.delay(std::chrono::seconds(10 + i % 100), []{}));
+
+    auto start = bench_clock::now();
+    events.clear();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    report(name, ops, elapsed.count());
+}
+
+// A connection-like set of events (two fds and three timers), torn down one
+// by one or as a group.
+static void bench_group_cancel(long ops)
+{
+    using namespace std::chrono;
+    int fds[2];
+    make_pipe(fds);
+
+    for (bool is_grouped : {false, true})
+    {
+        utils::event_loop loop;
+        utils::event_handle handles[5];
+        measure(is_grouped ? "teardown/group" : "teardown/each", ops, [&]
+        {
+            for (long i = 0; i < ops; ++ i)
+            {
+                auto group = is_grouped ? loop.create_group() : 0;
+                handles[0] = loop.with_group(group).listen(fds[0], [](int) {});
+                handles[1] = loop.with_group(group).listen(fds[1], utils::io_write, [](int, int) {});
+                handles[2] = loop.with_group(group).delay(seconds(30), []{});
+                handles[3] = loop.with_group(group).delay(seconds(60), []{});
+                handles[4] = loop.with_group(group).repeat(seconds(5), []{});
+                if (is_grouped)
+                    loop.cancel_group(group);
+                else
+                    for (auto handle : handles)
+                        loop.cancel(handle);
+            }
+        });
+    }
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+//}}}
+
+//{{{ Dispatch
+
+// Immediate callbacks: pure dispatch overhead.
+static void bench_imm(long ops)
+{
+    utils::event_loop loop;
+    long count = 0;
+    loop.repeat([&](utils::event_loop& loop, utils::event_handle handle)
+    {
+        if (++ count == ops)
+            loop.cancel(handle);
+    });
+    measure("imm_dispatch", ops, [&]{ loop.run(); });
+}
+
+// The same with a raw function pointer and context.
+static void bench_imm_raw(long ops)
+{
+    struct counter
+    {
+        long count;
+        long ops;
+    } ctx = {0, ops};
+
+    utils::event_loop loop;
+    loop.repeat([](void* ctx, utils::event_loop& loop, utils::event_handle handle)
+    {
+        auto c = static_cast<counter*>(ctx);
+        if (++ c->count == c->ops)
+            loop.cancel(handle);
+    }, &ctx);
+    measure("imm_dispatch_raw", ops, [&]{ loop.run(); });
+}
+
+// Fire *live* timers which have all expired: the cost of popping the timer
+// queue and dispatching with that many timers in it.
+static void bench_timer_fire(long live)
+{
+    std::string name = "timer_fire/" + std::to_string(live);
+    if (!selected(name))
+        return;
+
+    utils::event_loop loop;
+    std::mt19937 rng (1);
+    std::uniform_int_distribution<int> dist (0, 1000);
+    for (long i = 0; i < live; ++ i)
+        loop.delay(std::chrono::microseconds(dist(rng)), []{});
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+    measure(name, live, [&]{ loop.run(); });
+}
+
+// Many short timers with random deadlines: timer queue insertion and expiry,
+// including waiting for the deadlines.
+static void bench_timers(long ops)
+{
+    utils::event_loop loop;
+    std::mt19937 rng (1);
+    std::uniform_int_distribution<int> dist (0, 20);
+    measure("timers_random", ops, [&]
+    {
+        for (long i = 0; i < ops; ++ i)
+            loop.delay(std::chrono::milliseconds(dist(rng)), []{});
+        loop.run();
+    });
+}
+
+// Every socket pair echoes a byte to itself, so all fds are ready at once on
+// every iteration: stresses the readiness batch and fd dispatch.
+static void bench_io(long ops, int pairs)
+{
+    std::string name = "io_ready/" + std::to_string(pairs);
+    if (!selected(name))
+        return;
+
+    utils::event_loop loop;
+    std::vector<int> fds (2 * pairs);
+    long count = 0;
+
+    for (int i = 0; i < pairs; ++ i)
+    {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[2 * i]) < 0)
+        {
+            perror("socketpair");
+            exit(1);
+        }
+        int writer = fds[2 * i + 1];
+        loop.listen(fds[2 * i], [&, writer](int fd, utils::event_loop& loop, utils::event_handle handle)
+        {
+            char c;
+            if (read(fd, &c, 1) != 1)
+                return;
+            if (++ count >= ops)
+                loop.stop();
+            else if (write(writer, &c, 1) != 1)
+                loop.cancel(handle);
+        });
+        if (write(writer, "x", 1) != 1)
+            exit(1);
+    }
+
+    measure(name, ops, [&]{ loop.run(); });
+
+    for (int fd : fds)
+        close(fd);
+}
+
+// A byte bounces between two pipes watched by the same loop. Every round
+// trip is one write and one wakeup per direction.
+static void bench_ping_pong(long ops)
+{
+    std::string name = "pipe_ping_pong";
+    if (!selected(name))
+        return;
+
+    utils::event_loop loop;
+    int ping[2], pong[2];
+    make_pipe(ping);
+    make_pipe(pong);
+
+    std::vector<double> samples;
+    samples.reserve(ops);
+    auto trip_start = bench_clock::now();
+
+    auto start = trip_start;
+    if (write(ping[1], "x", 1) != 1)
+        exit(1);
+
+    loop.listen(ping[0], [&](int fd)
+    {
+        char c;
+        if (read(fd, &c, 1) == 1 && write(pong[1], &c, 1) != 1)
+            exit(1);
+    });
+    loop.listen(pong[0], [&](int fd, utils::event_loop& loop, utils::event_handle)
+    {
+        char c;
+        if (read(fd, &c, 1) != 1)
+            return;
+        auto now = bench_clock::now();
+        samples.push_back(std::chrono::duration<double, std::nano>(now - trip_start).count());
+        trip_start = now;
+        if (static_cast<long>(samples.size()) == ops)
+            loop.stop();
+        else if (write(ping[1], &c, 1) != 1)
+            exit(1);
+    });
+
+    loop.run();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    report_samples(name, samples, elapsed.count());
+
+    for (int fd : {ping[0], ping[1], pong[0], pong[1]})
+        close(fd);
+}
+
+// The same, with each pipe watched by a loop on its own thread: includes
+// waking up a sleeping thread on every hop.
+static void bench_ping_pong_threads(long ops)
+{
+    std::string name = "pipe_ping_pong_threads";
+    if (!selected(name))
+        return;
+
+    int ping[2], pong[2];
+    make_pipe(ping);
+    make_pipe(pong);
+
+    std::thread echo ([&]
+    {
+        utils::event_loop loop;
+        long count = 0;
+        loop.listen(ping[0], [&](int fd, utils::event_loop& loop, utils::event_handle)
+        {
+            char c;
+            if (read(fd, &c, 1) == 1 && write(pong[1], &c, 1) != 1)
+                exit(1);
+            if (++ count == ops)
+                loop.stop();
+        });
+        loop.run();
+    });
+
+    utils::event_loop loop;
+    std::vector<double> samples;
+    samples.reserve(ops);
+    auto start = bench_clock::now();
+    auto trip_start = start;
+    if (write(ping[1], "x", 1) != 1)
+        exit(1);
+
+    loop.listen(pong[0], [&](int fd, utils::event_loop& loop, utils::event_handle)
+    {
+        char c;
+        if (read(fd, &c, 1) != 1)
+            return;
+        auto now = bench_clock::now();
+        samples.push_back(std::chrono::duration<double, std::nano>(now - trip_start).count());
+        trip_start = now;
+        if (static_cast<long>(samples.size()) == ops)
+            loop.stop();
+        else if (write(ping[1], &c, 1) != 1)
+            exit(1);
+    });
+
+    loop.run();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    echo.join();
+    report_samples(name, samples, elapsed.count());
+
+    for (int fd : {ping[0], ping[1], pong[0], pong[1]})
+        close(fd);
+}
+
+// Callbacks posted from another thread.
+static void bench_post(long ops)
+{
+    utils::event_loop loop;
+    long count = 0;
+
+    // Keep the loop alive until all posts have been received.
+    auto keep_alive = loop.repeat(std::chrono::hours(24), []{});
+
+    measure("post", ops, [&]
+    {
+        std::thread producer ([&]
+        {
+            for (long i = 0; i < ops; ++ i)
+            {
+                loop.post([&, keep_alive](utils::event_loop& loop)
+                {
+                    if (++ count == ops)
+                        loop.cancel(keep_alive);
+                });
+            }
+        });
+        loop.run();
+        producer.join();
+    });
+}
+
+//}}}
+
+//{{{ Forwarding
+
+// Stream a file of *ops* 64 KiB chunks into a socket drained by the same
+// loop, once through a user-space buffer and once with forward().
+static void bench_forward(long ops)
+{
+    const std::size_t chunk = 65536;
+    char path[] = "/tmp/bench_forward_XXXXXX";
+    int file = mkstemp(path);
+    if (file < 0 || ftruncate(file, static_cast<off_t>(ops * chunk)) < 0)
+    {
+        perror("mkstemp");
+        exit(1);
+    }
+    unlink(path);
+
+    std::vector<char> buffer (chunk);
+    for (int use_forward = 0; use_forward < 2; ++ use_forward)
+    {
+        utils::event_loop loop;
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0)
+            exit(1);
+        lseek(file, 0, SEEK_SET);
+
+        std::size_t received = 0;
+        loop.listen(fds[1], [&](int fd, utils::event_loop& loop, utils::event_handle handle)
+        {
+            ssize_t n;
+            while ((n = read(fd, buffer.data(), chunk)) > 0)
+                received += n;
+            if (received == ops * chunk)
+                loop.cancel(handle);
+        });
+
+        measure(use_forward ? "forward/sendfile" : "forward/copy", ops, [&]
+        {
+            if (use_forward)
+            {
+                loop.forward(file, fds[0], [](std::uint64_t, int) {});
+            }
+            else
+            {
+                std::vector<char> staging (chunk);
+                std::size_t pending = 0, offset = 0;
+                loop.listen(fds[0], utils::io_write, [&](int fd, int, utils::event_loop& loop, utils::event_handle handle)
+                {
+                    if (offset == pending)
+                    {
+                        ssize_t n = read(file, staging.data(), chunk);
+                        if (n <= 0)
+                            return loop.cancel(handle);
+                        pending = n;
+                        offset = 0;
+                    }
+                    ssize_t n = write(fd, staging.data() + offset, pending - offset);
+                    if (n > 0)
+                        offset += n;
+                });
+            }
+            loop.run();
+        });
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+    close(file);
+}
+
+//}}}
+
+//{{{ Channels
+
+// Send *ops* 64-byte messages from a thread to the loop, through a pipe with
+// one write per message, and through a shm_channel.
+static void bench_channel(long ops)
+{
+    const std::size_t size = 64;
+    char message[size] = {};
+
+    if (selected("channel/pipe"))
+    {
+        utils::event_loop loop;
+        int fds[2];
+        make_pipe(fds);
+        long received = 0;
+        loop.listen(fds[0], [&](int fd, utils::event_loop& loop, utils::event_handle handle)
+        {
+            char buffer[size * 64];
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n > 0)
+                received += n / size;
+            if (received == ops)
+                loop.cancel(handle);
+        });
+        measure("channel/pipe", ops, [&]
+        {
+            std::thread producer ([&]
+            {
+                for (long i = 0; i < ops; ++ i)
+                    if (write(fds[1], message, size) != static_cast<ssize_t>(size))
+                        exit(1);
+            });
+            loop.run();
+            producer.join();
+        });
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    if (selected("channel/shm"))
+    {
+        utils::event_loop loop;
+        utils::shm_channel channel (1 << 20);
+        long received = 0;
+        channel.listen(loop, [&](const char*, std::size_t)
+        {
+            if (++ received == ops)
+                channel.stop_listening();
+        });
+        measure("channel/shm", ops, [&]
+        {
+            std::thread producer ([&]
+            {
+                for (long i = 0; i < ops; ++ i)
+                    while (!channel.try_send(message, size))
+                        std::this_thread::yield();
+            });
+            loop.run();
+            producer.join();
+        });
+    }
+}
+
+//}}}
+
+//{{{ Pacing
+
+// Let *ops* operations through at 10 million per second: by scheduling a delay
+// for each one in turn, through rate_limiter queues, and the cost of
+// try_acquire() alone.
+static void bench_pacing(long ops)
+{
+    const double rate = 1e7;
+
+    if (selected("pacing/delay_chain"))
+    {
+        utils::event_loop loop;
+        long done = 0;
+        std::function<void()> next = [&]
+        {
+            if (++ done < ops)
+                loop.delay(std::chrono::duration<double>(1 / rate), next);
+        };
+        measure("pacing/delay_chain", ops, [&]
+        {
+            next();
+            loop.run();
+        });
+    }
+
+    if (selected("pacing/acquire_async"))
+    {
+        utils::event_loop loop;
+        utils::rate_limiter limiter (loop, rate, 1);
+        long done = 0;
+        measure("pacing/acquire_async", ops, [&]
+        {
+            for (long i = 0; i < ops; ++ i)
+                limiter.acquire_async(1, [&] { ++ done; });
+            loop.run();
+        });
+    }
+
+    if (selected("pacing/try_acquire"))
+    {
+        utils::event_loop loop;
+        utils::rate_limiter limiter (loop, 1e12, 1e12);
+        long granted = 0;
+        measure("pacing/try_acquire", ops, [&]
+        {
+            for (long i = 0; i < ops; ++ i)
+                granted += limiter.try_acquire();
+        });
+        if (granted != ops)
+            exit(1);
+    }
+}
+
+//}}}
+
+int main(int argc, char* argv[])
+{
+    long scale = 1;
+    long max_timers = 1000000;
+
+    for (int i = 1; i < argc; ++ i)
+    {
+        if (!strcmp(argv[i], "--json"))
+            is_json = true;
+        else if (!strcmp(argv[i], "--scale") && i + 1 < argc)
+            scale = atol(argv[++ i]);
+        else if (!strcmp(argv[i], "--max-timers") && i + 1 < argc)
+            max_timers = atol(argv[++ i]);
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++ i];
+        else
+        {
+            fprintf(stderr, "usage: %s [--json] [--scale N] [--max-timers N] [--filter TEXT]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // Signals watched by the epoll backend are blocked, but libev's are not.
+    signal(SIGUSR2, SIG_IGN);
+
+    bench_registration(1000000 * scale);
+    bench_unique_event(1000000 * scale);
+    bench_group_cancel(100000 * scale);
+    bench_imm(1000000 * scale);
+    bench_imm_raw(1000000 * scale);
+    for (long live = 1000; live <= max_timers; live *= 10)
+        bench_timer_fire(live);
+    bench_timers(100000 * scale);
+    bench_io(1000000 * scale, 1000);
+    bench_ping_pong(100000 * scale);
+    bench_ping_pong_threads(100000 * scale);
+    bench_post(1000000 * scale);
+    bench_forward(4096 * scale);
+    bench_channel(1000000 * scale);
+    bench_pacing(100000 * scale);
+
+    if (is_json)
+        print_json();
+    return 0;
+}
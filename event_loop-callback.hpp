@@ -0,0 +1,277 @@
+
+#ifndef EVENT_LOOP_CALLBACK_HPP_H6T2VX0Q8LR
+#define EVENT_LOOP_CALLBACK_HPP_H6T2VX0Q8LR
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include <type_traits>
+
+namespace utils {
+
+namespace xx_impl
+{
+    // A pool of small memory blocks owned by an event loop, used to store
+    // callbacks too large to fit inline. Freed blocks are kept in one free
+    // list per size class and carved out of large arenas, so steady-state
+    // registrations never reach malloc. Not thread-safe.
+    class callback_pool
+    {
+    public:
+        static constexpr std::size_t granularity = 16;
+        static constexpr std::size_t size_classes = 4;
+        static constexpr std::size_t arena_size = 16384;
+
+        callback_pool() noexcept : _bump(nullptr), _bump_end(nullptr)
+        {
+            for (auto& head : _free)
+                head = nullptr;
+        }
+
+        callback_pool(const callback_pool&) = delete;
+        callback_pool& operator=(const callback_pool&) = delete;
+
+        void* allocate(std::size_t size)
+        {
+            auto cls = size_class(size);
+            if (cls >= size_classes)
+                return ::operator new(size);
+
+            auto head = _free[cls];
+            if (head)
+            {
+                _free[cls] = head->next;
+                return head;
+            }
+            return carve(class_size(cls));
+        }
+
+        void deallocate(void* ptr, std::size_t size) noexcept
+        {
+            auto cls = size_class(size);
+            if (cls >= size_classes)
+            {
+                ::operator delete(ptr);
+                return;
+            }
+
+            auto block = static_cast<free_block*>(ptr);
+            block->next = _free[cls];
+            _free[cls] = block;
+        }
+
+    private:
+        struct free_block
+        {
+            free_block* next;
+        };
+
+        free_block* _free[size_classes];
+        unsigned char* _bump;
+        unsigned char* _bump_end;
+        std::vector<std::unique_ptr<unsigned char[]>> _arenas;
+
+        // Classes are 64, 128, 256 and 512 bytes.
+        static std::size_t size_class(std::size_t size) noexcept
+        {
+            std::size_t cls = 0;
+            while (cls < size_classes && size > class_size(cls))
+                ++ cls;
+            return cls;
+        }
+
+        static constexpr std::size_t class_size(std::size_t cls) noexcept
+        {
+            return granularity << (cls + 2);
+        }
+
+        void* carve(std::size_t size)
+        {
+            if (static_cast<std::size_t>(_bump_end - _bump) < size)
+            {
+                _arenas.emplace_back(new unsigned char[arena_size]);
+                _bump = _arenas.back().get();
+                _bump_end = _bump + arena_size;
+            }
+            auto result = _bump;
+            _bump += size;
+            return result;
+        }
+    };
+
+    template <typename Signature, std::size_t Capacity = 48>
+    class inline_function;
+
+    // A move-only type-erased callable with inline storage of *Capacity*
+    // bytes. Callables which are larger, over-aligned or may throw on move
+    // are stored in a block of the callback_pool given at construction.
+    // Calling goes through a single indirect call. A raw function pointer
+    // with a context pointer is stored without a vtable (which is then null)
+    // and called directly.
+    template <typename R, typename... A, std::size_t Capacity>
+    class inline_function<R(A...), Capacity>
+    {
+        typedef typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type storage_type;
+
+    public:
+        typedef R (*raw_type)(void* ctx, A... args);
+
+    private:
+        struct raw
+        {
+            raw_type function;
+            void* ctx;
+        };
+
+        struct vtable
+        {
+            R (*invoke)(void* storage, A... args);
+            void (*move)(void* dest, void* src);
+            void (*destroy)(void* storage);
+        };
+
+        template <typename F>
+        struct inline_ops
+        {
+            static F& get(void* storage) noexcept { return *static_cast<F*>(storage); }
+            static R invoke(void* storage, A... args) { return get(storage)(std::forward<A>(args)...); }
+            static void move(void* dest, void* src) noexcept
+            {
+                new(dest) F(std::move(get(src)));
+                get(src).~F();
+            }
+            static void destroy(void* storage) noexcept { get(storage).~F(); }
+            static const vtable table;
+        };
+
+        struct pooled
+        {
+            void* object;
+            callback_pool* pool;
+        };
+
+        template <typename F>
+        struct pooled_ops
+        {
+            static pooled& get(void* storage) noexcept { return *static_cast<pooled*>(storage); }
+            static R invoke(void* storage, A... args)
+            {
+                return (*static_cast<F*>(get(storage).object))(std::forward<A>(args)...);
+            }
+            static void move(void* dest, void* src) noexcept { new(dest) pooled(get(src)); }
+            static void destroy(void* storage) noexcept
+            {
+                auto& p = get(storage);
+                static_cast<F*>(p.object)->~F();
+                p.pool->deallocate(p.object, sizeof(F));
+            }
+            static const vtable table;
+        };
+
+    public:
+        template <typename F>
+        struct fits_inline
+        {
+            enum { value = sizeof(F) <= Capacity
+                        && alignof(F) <= alignof(storage_type)
+                        && std::is_nothrow_move_constructible<F>::value };
+        };
+
+        template <typename F, typename = typename std::enable_if<
+            !std::is_same<typename std::decay<F>::type, inline_function>::value
+        >::type>
+        inline_function(F&& f, callback_pool& pool)
+        {
+            typedef typename std::decay<F>::type FT;
+            construct<FT>(std::forward<F>(f), pool, std::integral_constant<bool, fits_inline<FT>::value>());
+        }
+
+        inline_function(raw_type function, void* ctx) noexcept
+            : _vtable(nullptr)
+        {
+            new(&_storage) raw {function, ctx};
+        }
+
+        inline_function(inline_function&& other) noexcept
+            : _vtable(other._vtable)
+        {
+            if (_vtable)
+                _vtable->move(&_storage, &other._storage);
+            else
+                new(&_storage) raw(*reinterpret_cast<raw*>(&other._storage));
+            other._vtable = nullptr;
+        }
+
+        inline_function(const inline_function&) = delete;
+        inline_function& operator=(const inline_function&) = delete;
+        inline_function& operator=(inline_function&&) = delete;
+
+        ~inline_function()
+        {
+            if (_vtable)
+                _vtable->destroy(&_storage);
+        }
+
+        R operator()(A... args) const
+        {
+            if (!_vtable)
+            {
+                auto& r = *reinterpret_cast<raw*>(&_storage);
+                return r.function(r.ctx, std::forward<A>(args)...);
+            }
+            return _vtable->invoke(&_storage, std::forward<A>(args)...);
+        }
+
+    private:
+        mutable storage_type _storage;
+        const vtable* _vtable;
+
+        template <typename FT, typename F>
+        void construct(F&& f, callback_pool&, std::true_type)
+        {
+            new(&_storage) FT(std::forward<F>(f));
+            _vtable = &inline_ops<FT>::table;
+        }
+
+        template <typename FT, typename F>
+        void construct(F&& f, callback_pool& pool, std::false_type)
+        {
+            static_assert(alignof(FT) <= alignof(std::max_align_t),
+                          "Over-aligned event_loop callbacks are not supported");
+            auto object = pool.allocate(sizeof(FT));
+            try
+            {
+                new(object) FT(std::forward<F>(f));
+            }
+            catch (...)
+            {
+                pool.deallocate(object, sizeof(FT));
+                throw;
+            }
+            new(&_storage) pooled {object, &pool};
+            _vtable = &pooled_ops<FT>::table;
+        }
+    };
+
+    template <typename R, typename... A, std::size_t Capacity>
+    template <typename F>
+    const typename inline_function<R(A...), Capacity>::vtable
+        inline_function<R(A...), Capacity>::inline_ops<F>::table = {
+            &inline_ops<F>::invoke, &inline_ops<F>::move, &inline_ops<F>::destroy
+        };
+
+    template <typename R, typename... A, std::size_t Capacity>
+    template <typename F>
+    const typename inline_function<R(A...), Capacity>::vtable
+        inline_function<R(A...), Capacity>::pooled_ops<F>::table = {
+            &pooled_ops<F>::invoke, &pooled_ops<F>::move, &pooled_ops<F>::destroy
+        };
+}
+
+}
+
+#endif
+
@@ -0,0 +1,172 @@
+#include <memory>
+#include "event_loop-common.hpp"
+
+namespace utils {
+
+//{{{ Structors of xx_impl::event_entry_base
+
+namespace xx_impl
+{
+#define PERFORM_ON_FUNCS_I9X9CQ21RH(MACRO) \
+    switch (type) \
+    { \
+        case event_type::io: \
+        case event_type::signal: \
+            MACRO(io_); \
+            break; \
+        \
+        case event_type::io_simple: \
+        case event_type::signal_simple: \
+            MACRO(io_simple_); \
+            break; \
+        \
+        case event_type::io_mask: \
+            MACRO(io_mask_); \
+            break; \
+        \
+        case event_type::io_mask_simple: \
+            MACRO(io_mask_simple_); \
+            break; \
+        \
+        case event_type::delay: \
+        case event_type::delay_imm: \
+        case event_type::delay_wheel: \
+        case event_type::idle: \
+            MACRO(delay_); \
+            break; \
+        \
+        case event_type::repeat: \
+        case event_type::repeat_imm: \
+        case event_type::repeat_wheel: \
+        case event_type::at: \
+        case event_type::periodic: \
+            MACRO(repeat_); \
+            break; \
+        \
+        case event_type::delay_simple: \
+        case event_type::delay_imm_simple: \
+        case event_type::delay_wheel_simple: \
+        case event_type::repeat_simple: \
+        case event_type::repeat_imm_simple: \
+        case event_type::repeat_wheel_simple: \
+        case event_type::at_simple: \
+        case event_type::periodic_simple: \
+            MACRO(timer_simple_); \
+            break; \
+        \
+        case event_type::async: \
+            MACRO(async_); \
+            break; \
+        \
+        case event_type::async_simple: \
+            MACRO(async_simple_); \
+            break; \
+        \
+        case event_type::idle_simple: \
+            MACRO(idle_simple_); \
+            break; \
+        \
+        case event_type::path: \
+            MACRO(path_); \
+            break; \
+        \
+        case event_type::path_simple: \
+            MACRO(path_simple_); \
+            break; \
+        \
+        default: \
+            break; \
+    }
+
+#define DESTROY_FUNC_OREMUDH6SC(Prefix) \
+    Prefix##callback.~Prefix##func()
+
+    void event_entry_base::destroy_callback() noexcept
+    {
+        PERFORM_ON_FUNCS_I9X9CQ21RH(DESTROY_FUNC_OREMUDH6SC)
+        type = event_type::none;
+    }
+
+#undef DESTROY_FUNC_OREMUDH6SC
+#undef PERFORM_ON_FUNCS_I9X9CQ21RH
+}
+
+//}}}
+
+//{{{ Cross-thread posts
+
+namespace xx_impl
+{
+    static void delete_nodes(post_queue::node* n) noexcept
+    {
+        while (n)
+        {
+            auto next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+
+    post_queue::~post_queue()
+    {
+        delete_nodes(_head.exchange(nullptr, std::memory_order_acquire));
+        delete_nodes(_backlog);
+    }
+
+    bool post_queue::push(post_func&& callback)
+    {
+        auto n = new node(std::move(callback));
+        auto head = _head.load(std::memory_order_relaxed);
+        do
+            n->next = head;
+        while (!_head.compare_exchange_weak(head, n, std::memory_order_release,
+                                                     std::memory_order_relaxed));
+        return !head;
+    }
+
+    void post_queue::run(event_loop& loop)
+    {
+        auto n = _head.exchange(nullptr, std::memory_order_acquire);
+
+        // Reverse the stack so the callbacks run in the order they were posted.
+        node* batch = nullptr;
+        while (n)
+        {
+            auto next = n->next;
+            n->next = batch;
+            batch = n;
+            n = next;
+        }
+
+        // Whatever a throwing callback left behind was posted earlier.
+        if (_backlog)
+        {
+            auto tail = _backlog;
+            while (tail->next)
+                tail = tail->next;
+            tail->next = batch;
+            batch = _backlog;
+            _backlog = nullptr;
+        }
+
+        while (batch)
+        {
+            std::unique_ptr<node> current (batch);
+            batch = batch->next;
+            try
+            {
+                current->callback(loop);
+            }
+            catch (...)
+            {
+                _backlog = batch;
+                throw;
+            }
+        }
+    }
+}
+
+//}}}
+
+}
+
@@ -0,0 +1,731 @@
+
+#ifndef EVENT_LOOP_COMMON_HPP_N4D7JW2KX0E
+#define EVENT_LOOP_COMMON_HPP_N4D7JW2KX0E
+
+// Building blocks shared by all event_loop backends. Every backend defines its
+// own event_entry (deriving from xx_impl::event_entry_base and adding the
+// backend's watchers), and instantiates the containers below with it.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+#include <sys/types.h>
+#include "traits.hpp"
+#include "event_loop-callback.hpp"
+
+namespace utils {
+
+class event_loop;
+struct path_event;
+
+typedef std::uint64_t event_handle;
+typedef std::uint64_t event_group;
+
+namespace xx_impl
+{
+    enum class event_type
+    {
+        none,
+        io,
+        io_simple,
+        io_mask,
+        io_mask_simple,
+        signal,
+        signal_simple,
+        delay,
+        delay_simple,
+        delay_imm,
+        delay_imm_simple,
+        repeat,
+        repeat_simple,
+        repeat_imm,
+        repeat_imm_simple,
+        delay_wheel,
+        delay_wheel_simple,
+        repeat_wheel,
+        repeat_wheel_simple,
+        at,
+        at_simple,
+        periodic,
+        periodic_simple,
+        async,
+        async_simple,
+        idle,
+        idle_simple,
+        path,
+        path_simple
+    };
+
+    typedef inline_function<void(int, event_loop&, event_handle)> io_func;
+    typedef inline_function<void(int, int, event_loop&, event_handle)> io_mask_func;
+    typedef inline_function<void(bool& keep, event_loop&, event_handle)> delay_func;
+    typedef inline_function<void(event_loop&, event_handle)> repeat_func;
+    typedef inline_function<void(ssize_t, event_loop&, event_handle)> async_func;
+
+    typedef inline_function<void(int)> io_simple_func;
+    typedef inline_function<void(int, int)> io_mask_simple_func;
+    typedef inline_function<void()> timer_simple_func;
+    typedef inline_function<void(ssize_t)> async_simple_func;
+    typedef inline_function<bool()> idle_simple_func;
+    typedef inline_function<void(const path_event&, event_loop&, event_handle)> path_func;
+    typedef inline_function<void(const path_event&)> path_simple_func;
+
+    // Posted callbacks are created on other threads, so they cannot use the
+    // loop's callback pool.
+    typedef std::function<void(event_loop&)> post_func;
+    typedef std::function<void()> post_simple_func;
+
+    // A forward outlives the individual events driving it, so its callback
+    // is kept in the shared state of the forward instead.
+    typedef std::function<void(std::uint64_t, int, event_loop&)> forward_func;
+    typedef std::function<void(std::uint64_t, int)> forward_simple_func;
+
+    static constexpr std::uint32_t npos = ~std::uint32_t(0);
+
+    // Defined in event_loop-coro.hpp, which needs C++20. The backends only
+    // declare the members returning them.
+    class sleep_awaiter;
+    class io_awaiter;
+    class signal_awaiter;
+    struct loop_access;
+
+    // Round *deadline* up to a multiple of the largest power of two seconds
+    // (e.g. 1/64 s, or 2 s) which does not exceed *slack*, as the kernel does
+    // for timer slack. The grids of different slacks are nested, so timers
+    // whose tolerance windows overlap tend to get the same deadline, and the
+    // loop wakes up once for all of them.
+    inline double apply_slack(double deadline, double slack) noexcept
+    {
+        if (slack <= 0)
+            return deadline;
+        int exponent;
+        std::frexp(slack, &exponent);
+        auto grain = std::ldexp(1.0, exponent - 1);
+        return std::ceil(deadline / grain) * grain;
+    }
+
+    // Accounting of timer expirations. An expiration of a timer with slack
+    // which is not the first one of its wakeup is counted as coalesced, i.e.
+    // as a wakeup saved.
+    struct timer_stats
+    {
+        std::uint64_t wakeups;
+        std::uint64_t coalesced;
+
+        timer_stats() noexcept : wakeups(0), coalesced(0) {}
+
+        void expired(bool is_first, double slack) noexcept
+        {
+            if (is_first)
+                ++ wakeups;
+            else if (slack > 0)
+                ++ coalesced;
+        }
+    };
+
+    // Idle work is called repeatedly until it finishes or has run for
+    // *budget* seconds, whichever is first.
+    struct idle_budget
+    {
+        double budget;
+    };
+
+    struct wheel_timer
+    {
+        std::uint64_t expires;
+        std::uint64_t interval;
+        std::uint32_t slot;
+    };
+
+    struct event_entry_base
+    {
+        union
+        {
+            io_func io_callback;
+            io_mask_func io_mask_callback;
+            io_mask_simple_func io_mask_simple_callback;
+            delay_func delay_callback;
+            repeat_func repeat_callback;
+            io_simple_func io_simple_callback;
+            timer_simple_func timer_simple_callback;
+            async_func async_callback;
+            async_simple_func async_simple_callback;
+            idle_simple_func idle_simple_callback;
+            path_func path_callback;
+            path_simple_func path_simple_callback;
+        };
+
+        event_type type;
+        bool is_calling;
+        bool is_ready;
+        signed char priority;
+        std::uint32_t index;
+        std::uint32_t generation;
+        std::uint32_t prev;
+        std::uint32_t next;
+        std::uint32_t group;
+        std::uint32_t group_prev;
+        std::uint32_t group_next;
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+        std::uint16_t stat_slot;
+#endif
+
+        event_handle handle() const noexcept
+        {
+            return static_cast<event_handle>(generation) << 32 | index;
+        }
+
+        void destroy_callback() noexcept;
+
+        event_entry_base() noexcept
+            : type(event_type::none),
+              is_calling(false),
+              is_ready(false),
+              priority(0),
+              index(0),
+              generation(0),
+              prev(npos),
+              next(npos),
+              group(npos),
+              group_prev(npos),
+              group_next(npos)
+        {}
+
+        ~event_entry_base() { destroy_callback(); }
+
+        event_entry_base(const event_entry_base&) = delete;
+        event_entry_base& operator=(const event_entry_base&) = delete;
+    };
+
+    inline bool is_imm(const event_entry_base& entry) noexcept
+    {
+        auto type = entry.type;
+        return type == event_type::delay_imm
+            || type == event_type::repeat_imm
+            || type == event_type::delay_imm_simple
+            || type == event_type::repeat_imm_simple;
+    }
+
+    inline bool is_wheel(const event_entry_base& entry) noexcept
+    {
+        auto type = entry.type;
+        return type == event_type::delay_wheel
+            || type == event_type::repeat_wheel
+            || type == event_type::delay_wheel_simple
+            || type == event_type::repeat_wheel_simple;
+    }
+
+    inline bool is_at(const event_entry_base& entry) noexcept
+    {
+        auto type = entry.type;
+        return type == event_type::at || type == event_type::at_simple;
+    }
+
+    inline bool is_periodic(const event_entry_base& entry) noexcept
+    {
+        auto type = entry.type;
+        return type == event_type::periodic || type == event_type::periodic_simple;
+    }
+
+    inline bool is_async(const event_entry_base& entry) noexcept
+    {
+        auto type = entry.type;
+        return type == event_type::async || type == event_type::async_simple;
+    }
+
+    inline bool is_idle(const event_entry_base& entry) noexcept
+    {
+        auto type = entry.type;
+        return type == event_type::idle || type == event_type::idle_simple;
+    }
+
+    // A slab of event entries addressed by generational handles. The entries
+    // are allocated in fixed-size chunks which are never moved, because the
+    // backends keep pointers to the watchers embedded in them. A handle packs
+    // the slot index (low 32 bits) and the generation of that slot (high 32
+    // bits); the generation is bumped every time a slot is retired, so a stale
+    // handle never resolves to a recycled entry.
+    template <typename Entry>
+    class event_registry
+    {
+    public:
+        static constexpr unsigned chunk_bits = 8;
+        static constexpr std::uint32_t chunk_size = 1u << chunk_bits;
+
+        event_registry() noexcept : _size(0), _live(0), _free_head(npos) {}
+
+        Entry& at(std::uint32_t index) const noexcept
+        {
+            return _chunks[index >> chunk_bits][index & (chunk_size - 1)];
+        }
+
+        Entry* find(event_handle handle) const noexcept
+        {
+            auto index = static_cast<std::uint32_t>(handle);
+            if (index >= _size)
+                return nullptr;
+            auto& entry = at(index);
+            if (entry.type == event_type::none || entry.handle() != handle)
+                return nullptr;
+            return &entry;
+        }
+
+        std::uint32_t size() const noexcept { return _size; }
+
+        // Number of events which have not been retired. Only the loop thread
+        // changes it, but any thread may read it.
+        std::uint32_t live() const noexcept { return _live.load(std::memory_order_relaxed); }
+
+        Entry& allocate()
+        {
+            if (_free_head != npos)
+            {
+                auto& entry = at(_free_head);
+                _free_head = entry.next;
+                _live.store(live() + 1, std::memory_order_relaxed);
+                return entry;
+            }
+
+            if (_size == npos)
+                throw std::length_error("utils::event_loop: too many events");
+
+            if ((_size & (chunk_size - 1)) == 0)
+                _chunks.emplace_back(new Entry[chunk_size]);
+
+            auto index = _size ++;
+            auto& entry = at(index);
+            entry.index = index;
+            entry.generation = 1;
+            _live.store(live() + 1, std::memory_order_relaxed);
+            return entry;
+        }
+
+        // Invalidates all handles to the entry. The slot is recycled
+        // immediately, unless its callback is currently running, in which case
+        // the dispatcher releases it after the callback returns.
+        void retire(Entry& entry) noexcept
+        {
+            if (++ entry.generation == 0)
+                entry.generation = 1;
+            _live.store(live() - 1, std::memory_order_relaxed);
+            if (!entry.is_calling)
+                release(entry);
+        }
+
+        void release(Entry& entry) noexcept
+        {
+            entry.destroy_callback();
+            entry.next = _free_head;
+            _free_head = entry.index;
+        }
+
+    private:
+        std::vector<std::unique_ptr<Entry[]>> _chunks;
+        std::uint32_t _size;
+        std::atomic<std::uint32_t> _live;
+        std::uint32_t _free_head;
+    };
+
+    // An intrusive FIFO of entries in a registry, linked through the prev and
+    // next members of the entries. Any entry may be erased while the queue is
+    // being walked, and entries pushed during a walk are left for the next.
+    template <typename Entry>
+    class event_queue
+    {
+    public:
+        event_queue() noexcept
+            : _head(npos), _tail(npos), _count(0),
+              _cursor(npos), _fresh(npos), _is_walking(false)
+        {}
+
+        std::uint32_t size() const noexcept { return _count; }
+        bool empty() const noexcept { return _count == 0; }
+
+        void push_back(event_registry<Entry>& registry, Entry& entry) noexcept
+        {
+            entry.prev = _tail;
+            entry.next = npos;
+            if (_tail != npos)
+                registry.at(_tail).next = entry.index;
+            else
+                _head = entry.index;
+            _tail = entry.index;
+            ++ _count;
+
+            if (_is_walking && _fresh == npos)
+                _fresh = entry.index;
+        }
+
+        void erase(event_registry<Entry>& registry, Entry& entry) noexcept
+        {
+            if (entry.prev != npos)
+                registry.at(entry.prev).next = entry.next;
+            else
+                _head = entry.next;
+            if (entry.next != npos)
+                registry.at(entry.next).prev = entry.prev;
+            else
+                _tail = entry.prev;
+            -- _count;
+
+            if (entry.index == _cursor)
+                _cursor = entry.next;
+            if (entry.index == _fresh)
+                _fresh = entry.next;
+        }
+
+        template <typename F>
+        void walk(event_registry<Entry>& registry, F&& f)
+        {
+            _is_walking = true;
+            _fresh = npos;
+            auto cur = _head;
+            while (cur != npos && cur != _fresh)
+            {
+                auto& entry = registry.at(cur);
+                _cursor = entry.next;
+                f(entry);
+                cur = _cursor;
+            }
+            _cursor = npos;
+            _is_walking = false;
+        }
+
+        // Ends the current walk after the entry being visited.
+        void stop_walk() noexcept { _cursor = npos; }
+
+    private:
+        std::uint32_t _head, _tail, _count;
+        std::uint32_t _cursor, _fresh;
+        bool _is_walking;
+    };
+
+    // Groups of events which are cancelled together. Group handles are
+    // generational like event handles. The members of a group are linked
+    // through the group_prev and group_next members of the entries, so
+    // joining, leaving and cancelling a group never search or allocate.
+    template <typename Entry>
+    class event_groups
+    {
+    public:
+        event_groups() noexcept : _free_head(npos), _next(0) {}
+
+        event_group create()
+        {
+            std::uint32_t index;
+            if (_free_head != npos)
+            {
+                index = _free_head;
+                _free_head = _slots[index].head;
+            }
+            else
+            {
+                if (_slots.size() == npos)
+                    throw std::length_error("utils::event_loop: too many event groups");
+                index = static_cast<std::uint32_t>(_slots.size());
+                _slots.push_back(slot {1, npos});
+            }
+            _slots[index].head = npos;
+            return static_cast<event_group>(_slots[index].generation) << 32 | index;
+        }
+
+        // The group joined by the next registered event.
+        void select(event_group group) noexcept { _next = group; }
+
+        void join(event_registry<Entry>& registry, Entry& entry) noexcept
+        {
+            auto group = _next;
+            _next = 0;
+            auto s = find(group);
+            if (!s)
+                return;
+
+            entry.group = static_cast<std::uint32_t>(group);
+            entry.group_prev = npos;
+            entry.group_next = s->head;
+            if (s->head != npos)
+                registry.at(s->head).group_prev = entry.index;
+            s->head = entry.index;
+        }
+
+        void leave(event_registry<Entry>& registry, Entry& entry) noexcept
+        {
+            if (entry.group == npos)
+                return;
+            if (entry.group_prev != npos)
+                registry.at(entry.group_prev).group_next = entry.group_next;
+            else
+                _slots[entry.group].head = entry.group_next;
+            if (entry.group_next != npos)
+                registry.at(entry.group_next).group_prev = entry.group_prev;
+            entry.group = npos;
+        }
+
+        // Call cancel_entry(entry) until the group is empty, then free the
+        // group. Every cancelled entry must leave the group, and entries
+        // cancelled as a side effect simply leave it earlier. The handle is
+        // invalidated first, so nothing can join the group meanwhile.
+        template <typename F>
+        void cancel(event_registry<Entry>& registry, event_group group, F&& cancel_entry)
+        {
+            auto s = find(group);
+            if (!s)
+                return;
+            if (++ s->generation == 0)
+                s->generation = 1;
+
+            auto index = static_cast<std::uint32_t>(group);
+            while (_slots[index].head != npos)
+                cancel_entry(registry.at(_slots[index].head));
+
+            _slots[index].head = _free_head;
+            _free_head = index;
+        }
+
+    private:
+        // A free slot links the free list through head.
+        struct slot
+        {
+            std::uint32_t generation;
+            std::uint32_t head;
+        };
+
+        std::vector<slot> _slots;
+        std::uint32_t _free_head;
+        event_group _next;
+
+        slot* find(event_group group) noexcept
+        {
+            auto index = static_cast<std::uint32_t>(group);
+            if (index >= _slots.size())
+                return nullptr;
+            auto& s = _slots[index];
+            if (static_cast<std::uint32_t>(group >> 32) != s.generation)
+                return nullptr;
+            return &s;
+        }
+    };
+
+    // Ready events whose callbacks are held back behind those of a higher
+    // priority class, in the order they became ready. An entry is queued at
+    // most once (its is_ready flag is set meanwhile), and events of entries
+    // cancelled while queued are dropped when they come up.
+    template <typename Entry>
+    class ready_queue
+    {
+    public:
+        ready_queue() noexcept : _head(0) {}
+
+        bool empty() const noexcept { return _head == _events.size(); }
+
+        void push(Entry& entry, int revents)
+        {
+            if (entry.is_ready)
+                return;
+            _events.push_back(ready_event {entry.handle(), revents});
+            entry.is_ready = true;
+        }
+
+        // Call f(entry, revents) for up to *budget* queued events, or all of
+        // them if *budget* is 0. The rest stay at the front of the queue.
+        template <typename F>
+        void run(event_registry<Entry>& registry, std::size_t budget, F&& f)
+        {
+            auto end = _events.size();
+            if (budget != 0 && end - _head > budget)
+                end = _head + budget;
+
+            while (_head < end)
+            {
+                auto event = _events[_head ++];
+                auto entry = registry.find(event.handle);
+                if (!entry)
+                    continue;
+                entry->is_ready = false;
+                f(*entry, event.revents);
+            }
+
+            if (_head == _events.size())
+            {
+                _events.clear();
+                _head = 0;
+            }
+            else if (_head * 2 >= _events.size())
+            {
+                _events.erase(_events.begin(), _events.begin() + _head);
+                _head = 0;
+            }
+        }
+
+    private:
+        struct ready_event
+        {
+            event_handle handle;
+            int revents;
+        };
+
+        std::vector<ready_event> _events;
+        std::size_t _head;
+    };
+
+    // A hierarchical timing wheel: 4 levels of 256 slots, each level 256 times
+    // coarser than the one below. A timer is linked into the slot of the
+    // coarsest level that can still resolve its expiry, and cascades down one
+    // level each time the level below wraps around. Arming, cancelling and
+    // re-arming a timer are all O(1). Times are in seconds of the backend's
+    // monotonic clock.
+    template <typename Entry>
+    struct timer_wheel
+    {
+        static constexpr unsigned level_bits = 8;
+        static constexpr unsigned levels = 4;
+        static constexpr std::uint32_t slots_per_level = 1u << level_bits;
+        static constexpr std::uint32_t slot_mask = slots_per_level - 1;
+
+        event_queue<Entry> slots[levels * slots_per_level];
+        std::uint64_t now;
+        std::size_t count;
+        double resolution;
+        double epoch;
+
+        explicit timer_wheel(double resolution) noexcept
+            : now(0), count(0), resolution(resolution), epoch(0)
+        {}
+
+        // Ticks are counted in integers from the epoch, and deadline_of is
+        // the only conversion of a tick to a time. ticks_at is its exact
+        // inverse, the last tick whose deadline is not after *time*, so a loop
+        // woken at a tick's deadline always reaches that tick.
+        double deadline_of(std::uint64_t tick) const noexcept
+        {
+            return epoch + tick * resolution;
+        }
+
+        std::uint64_t ticks_at(double time) const noexcept
+        {
+            if (!(time > epoch))
+                return 0;
+            auto ticks = static_cast<std::uint64_t>((time - epoch) / resolution);
+            if (deadline_of(ticks + 1) <= time)
+                ++ ticks;
+            else if (ticks != 0 && deadline_of(ticks) > time)
+                -- ticks;
+            return ticks;
+        }
+
+        std::uint64_t ticks_for(double interval) const noexcept
+        {
+            auto ticks = static_cast<std::uint64_t>(interval / resolution + 0.999999);
+            return ticks ? ticks : 1;
+        }
+
+        void insert(event_registry<Entry>& registry, Entry& entry) noexcept
+        {
+            auto& timer = entry.wheel_watcher;
+            auto expires = timer.expires > now ? timer.expires : now + 1;
+            auto delta = expires - now;
+
+            unsigned level = 0;
+            while (level < levels - 1 && delta >= (std::uint64_t(1) << (level_bits * (level + 1))))
+                ++ level;
+
+            // Timers beyond the range of the wheel wait in the furthest slot,
+            // and are placed again when that slot cascades.
+            if (level == levels - 1 && delta >> (level_bits * levels))
+                expires = now + (std::uint64_t(slot_mask) << (level_bits * level));
+
+            timer.slot = level * slots_per_level + ((expires >> (level_bits * level)) & slot_mask);
+            slots[timer.slot].push_back(registry, entry);
+            ++ count;
+        }
+
+        void erase(event_registry<Entry>& registry, Entry& entry) noexcept
+        {
+            auto& timer = entry.wheel_watcher;
+            if (timer.slot == npos)
+                return;
+            slots[timer.slot].erase(registry, entry);
+            timer.slot = npos;
+            -- count;
+        }
+
+        // Advance the wheel by one tick, cascading the upper levels as needed,
+        // and return the level-0 slot whose timers expire now.
+        event_queue<Entry>& tick(event_registry<Entry>& registry) noexcept
+        {
+            ++ now;
+            for (unsigned level = 1; level < levels; ++ level)
+            {
+                if ((now >> (level_bits * (level - 1))) & slot_mask)
+                    break;
+                auto& slot = slots[level * slots_per_level + ((now >> (level_bits * level)) & slot_mask)];
+                slot.walk(registry, [&](Entry& entry)
+                {
+                    this->erase(registry, entry);
+                    this->insert(registry, entry);
+                });
+            }
+            return slots[now & slot_mask];
+        }
+    };
+
+    // A lock-free multi-producer stack of posted callbacks. Only the producer
+    // which finds the stack empty needs to wake the loop up, and the loop takes
+    // the whole stack at once, so a burst of posts costs a single wakeup.
+    class post_queue
+    {
+    public:
+        struct node
+        {
+            node* next;
+            post_func callback;
+
+            explicit node(post_func&& callback)
+                : next(nullptr), callback(std::move(callback))
+            {}
+        };
+
+        post_queue() noexcept : _head(nullptr), _backlog(nullptr) {}
+        ~post_queue();
+
+        post_queue(const post_queue&) = delete;
+        post_queue& operator=(const post_queue&) = delete;
+
+        // Returns whether the queue was empty, i.e. the loop must be woken up.
+        bool push(post_func&& callback);
+
+        // Call all callbacks posted so far, in the order they were posted. If
+        // one throws, the rest are kept for the next call, which the caller
+        // must arrange before letting the exception through.
+        void run(event_loop& loop);
+
+    private:
+        std::atomic<node*> _head;
+        // Callbacks left over by a throwing one, in order. Only touched by
+        // the loop's thread.
+        node* _backlog;
+    };
+
+    template <typename F, typename A, typename B>
+    struct pick_event_func
+    {
+        typedef typename function_traits<F>::function_type FFType;
+        typedef typename function_traits<A>::function_type AFType;
+        typedef typename function_traits<B>::function_type BFType;
+        enum { isA = std::is_same<FFType, AFType>::value,
+               isB = std::is_same<FFType, BFType>::value };
+        static_assert(isA || isB, "Function types for event_loop callbacks mismatch");
+        typedef typename std::conditional<isA, A, B>::type type;
+    };
+}
+
+}
+
+#endif
+
@@ -0,0 +1,498 @@
+//-------------------------------------------------------
+// utils::task: C++20 coroutines on top of utils::event_loop
+//-------------------------------------------------------
+//
+//          Copyright kennytm (auraHT Ltd.) 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file doc/LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef EVENT_LOOP_CORO_HPP_P3HV8QD6WKS
+#define EVENT_LOOP_CORO_HPP_P3HV8QD6WKS 1
+
+/**
+
+``<utils/event_loop-coro.hpp>`` --- Coroutines
+==============================================
+
+Awaitable events and a lazy ``task<T>`` type, so that chains of callbacks can
+be written as straight-line code. Unlike the rest of the library, this header
+requires C++20 coroutines. Include it after choosing the backend, as for
+``<utils/event_loop.hpp>``.
+
+Synopsis
+--------
+
+Blink a LED until someone resets its ``unique_event``::
+
+    #include <utils/event_loop-coro.hpp>
+
+    utils::task<> blink(utils::event_loop& loop, Led& led)
+    {
+        for (;;)
+        {
+            led.toggle();
+            if (co_await loop.sleep(std::chrono::milliseconds(500)).bind(led.blinker))
+                co_return;      // led.blinker has been reset
+        }
+    }
+
+    utils::spawn(blink(loop, led));
+    loop.run();
+
+Members
+-------
+
+.. function:: utils::xx_impl::sleep_awaiter utils::event_loop::sleep(std::chrono::duration<...> after)
+              utils::xx_impl::io_awaiter utils::event_loop::readable(int fd)
+              utils::xx_impl::io_awaiter utils::event_loop::writable(int fd)
+              utils::xx_impl::signal_awaiter utils::event_loop::signal(int signum)
+
+    Awaitables which suspend the coroutine until *after* has passed, *fd* is
+    ready, or *signum* is raised. Each ``co_await`` registers one event with
+    the loop, which is removed before the coroutine is resumed. The result of
+    the ``co_await`` is a ``std::error_code``, which is empty on success.
+
+    Calling ``.bind(owner)`` on an awaitable hands the event to the
+    :type:`~utils::unique_event` *owner* while the coroutine is suspended.
+    Cancelling it (by resetting or destroying *owner*, or by calling
+    :func:`~utils::event_loop::cancel` with its handle) resumes the coroutine
+    on the next iteration of the loop, with ``std::errc::operation_canceled``.
+
+    Destroying a coroutine while it is suspended, e.g. through its
+    :type:`~utils::task`, cancels the event it awaits; its *owner*, if any, is
+    released without cancelling anything. Coroutines which are still
+    suspended when their loop is destroyed are never resumed, and their frames
+    are leaked.
+
+.. type:: class utils::task<T = void>
+    :movable:
+    :noncopyable:
+
+    A coroutine which starts when it is awaited, and then resumes its awaiter
+    by symmetric transfer when it finishes, so deeply nested tasks neither
+    grow the stack nor go through the loop. Awaiting a task produces the
+    value it ``co_return``\ s, or rethrows the exception which escaped it.
+    Destroying a task destroys its coroutine.
+
+    Frames of coroutines returning a task are allocated from a memory pool
+    shared by the loops of the thread, the same kind of pool which stores
+    large callbacks. Frames of up to 512 bytes are recycled without reaching
+    malloc. A task must be destroyed on the thread which created it.
+
+.. function:: void utils::spawn(utils::task<void>&& work)
+
+    Start *work* right away and let it run on its own; its frame is destroyed
+    when it finishes. An exception escaping a spawned task calls
+    ``std::terminate()``.
+
+*/
+
+#if !defined(__cpp_impl_coroutine)
+#error <utils/event_loop-coro.hpp> requires C++20 coroutines
+#endif
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include "event_loop.hpp"
+
+namespace utils {
+
+template <typename T = void>
+class task;
+
+namespace xx_impl
+{
+    struct loop_access
+    {
+        static bool is_closing(const event_loop& loop) noexcept { return loop._is_closing; }
+    };
+
+    //{{{ Frame allocation
+
+    // Loops are confined to their threads, so the pool of the thread serves
+    // every loop on it, without coroutines having to be told their loop.
+    inline callback_pool& frame_pool()
+    {
+        thread_local callback_pool pool;
+        return pool;
+    }
+
+    //}}}
+
+    //{{{ Task promises
+
+    class task_promise_base
+    {
+    public:
+        static void* operator new(std::size_t size)
+        {
+            return frame_pool().allocate(size);
+        }
+
+        static void operator delete(void* frame, std::size_t size) noexcept
+        {
+            frame_pool().deallocate(frame, size);
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+
+        struct final_awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept
+            {
+                auto& promise = self.promise();
+                if (promise._continuation)
+                    return promise._continuation;
+                if (promise._is_detached)
+                    self.destroy();
+                return std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        final_awaiter final_suspend() const noexcept { return {}; }
+
+        void unhandled_exception() noexcept
+        {
+            if (_is_detached)
+                std::terminate();
+            _exception = std::current_exception();
+        }
+
+        void set_continuation(std::coroutine_handle<> continuation) noexcept { _continuation = continuation; }
+        void detach() noexcept { _is_detached = true; }
+
+    protected:
+        std::coroutine_handle<> _continuation;
+        std::exception_ptr _exception;
+        bool _is_detached = false;
+
+        void rethrow_if_failed()
+        {
+            if (_exception)
+                std::rethrow_exception(_exception);
+        }
+    };
+
+    template <typename T>
+    class task_promise final : public task_promise_base
+    {
+        static_assert(!std::is_reference<T>::value, "task<T&> is not supported");
+
+    public:
+        task<T> get_return_object() noexcept;
+
+        template <typename U = T>
+        void return_value(U&& value)
+        {
+            _value.emplace(std::forward<U>(value));
+        }
+
+        T result()
+        {
+            rethrow_if_failed();
+            return std::move(*_value);
+        }
+
+    private:
+        std::optional<T> _value;
+    };
+
+    template <>
+    class task_promise<void> final : public task_promise_base
+    {
+    public:
+        task<void> get_return_object() noexcept;
+
+        void return_void() noexcept {}
+
+        void result() { rethrow_if_failed(); }
+    };
+
+    //}}}
+
+    //{{{ Event awaiters
+
+    class event_awaiter_base
+    {
+    public:
+        event_awaiter_base(event_loop& loop) noexcept
+            : _loop(loop), _owner(nullptr), _handle(0), _is_pending(false), _is_resuming(false)
+        {}
+
+        // Only moved before the coroutine is suspended.
+        event_awaiter_base(event_awaiter_base&&) = default;
+        event_awaiter_base& operator=(const event_awaiter_base&) = delete;
+
+        // The awaiter is destroyed with the coroutine frame. If that happens
+        // while the coroutine is suspended, nothing may resume it later.
+        ~event_awaiter_base()
+        {
+            if (loop_access::is_closing(_loop))
+                return;
+            if (_is_pending)
+            {
+                // Stops the resumer from reporting the cancellation.
+                _is_pending = false;
+                if (_owner && _owner->get_pool() && _owner->get() == _handle)
+                    _owner->release();
+                _loop.cancel(_handle);
+            }
+            else if (_is_resuming)
+                _loop.cancel(_handle);
+        }
+
+        bool await_ready() const noexcept { return false; }
+        std::error_code await_resume() const noexcept { return _error; }
+
+    protected:
+        // Lives in the callback of the event. Resumes the coroutine when
+        // called, and reports the cancellation if it is destroyed first.
+        class resumer
+        {
+        public:
+            explicit resumer(event_awaiter_base* awaiter) noexcept : _awaiter(awaiter) {}
+            resumer(resumer&& other) noexcept : _awaiter(std::exchange(other._awaiter, nullptr)) {}
+            resumer& operator=(resumer&&) = delete;
+
+            ~resumer()
+            {
+                if (_awaiter)
+                    _awaiter->cancelled();
+            }
+
+            void operator()() { std::exchange(_awaiter, nullptr)->resume(); }
+
+        private:
+            event_awaiter_base* _awaiter;
+        };
+
+        event_loop& _loop;
+        unique_event* _owner;
+        std::coroutine_handle<> _coroutine;
+        std::error_code _error;
+        // The awaited event while pending, then the deferred resumption after
+        // a cancellation.
+        event_handle _handle;
+        // The event has been registered and has neither fired nor been
+        // cancelled yet.
+        bool _is_pending;
+        bool _is_resuming;
+
+        void resume()
+        {
+            _is_pending = false;
+            _coroutine.resume();
+        }
+
+        void cancelled() noexcept
+        {
+            if (!_is_pending)
+                return;
+            _is_pending = false;
+            _error = std::make_error_code(std::errc::operation_canceled);
+            if (loop_access::is_closing(_loop))
+                return;
+
+            // The coroutine is resumed from the loop rather than from inside
+            // cancel(), whose caller does not expect it to run.
+            _is_resuming = true;
+            _handle = _loop.delay([this]
+            {
+                _is_resuming = false;
+                _coroutine.resume();
+            });
+        }
+    };
+
+    template <typename Derived>
+    class event_awaiter : public event_awaiter_base
+    {
+    public:
+        using event_awaiter_base::event_awaiter_base;
+
+        Derived&& bind(unique_event& owner) && noexcept
+        {
+            _owner = &owner;
+            return static_cast<Derived&&>(*this);
+        }
+
+        void await_suspend(std::coroutine_handle<> coroutine)
+        {
+            _coroutine = coroutine;
+            _handle = static_cast<Derived*>(this)->start(resumer(this));
+            _is_pending = true;
+            if (_owner)
+                _owner->reset(_loop, event_handle(_handle));
+        }
+    };
+
+    class sleep_awaiter final : public event_awaiter<sleep_awaiter>
+    {
+    public:
+        sleep_awaiter(event_loop& loop, std::chrono::nanoseconds after) noexcept
+            : event_awaiter(loop), _after(after)
+        {}
+
+        event_handle start(resumer&& r)
+        {
+            return _loop.delay(_after, [r = std::move(r)]() mutable { r(); });
+        }
+
+    private:
+        std::chrono::nanoseconds _after;
+    };
+
+    class io_awaiter final : public event_awaiter<io_awaiter>
+    {
+    public:
+        io_awaiter(event_loop& loop, int fd, int events) noexcept
+            : event_awaiter(loop), _fd(fd), _events(events)
+        {}
+
+        event_handle start(resumer&& r)
+        {
+            return _loop.listen(_fd, _events, [r = std::move(r)](int, int, event_loop& loop, event_handle handle) mutable
+            {
+                loop.cancel(handle);
+                r();
+            });
+        }
+
+    private:
+        int _fd;
+        int _events;
+    };
+
+    class signal_awaiter final : public event_awaiter<signal_awaiter>
+    {
+    public:
+        signal_awaiter(event_loop& loop, int signum) noexcept
+            : event_awaiter(loop), _signum(signum)
+        {}
+
+        event_handle start(resumer&& r)
+        {
+            return _loop.signal(_signum, [r = std::move(r)](int, event_loop& loop, event_handle handle) mutable
+            {
+                loop.cancel(handle);
+                r();
+            });
+        }
+
+    private:
+        int _signum;
+    };
+
+    //}}}
+}
+
+template <typename T>
+class task final
+{
+public:
+    typedef xx_impl::task_promise<T> promise_type;
+
+    task() noexcept {}
+    task(task&& other) noexcept : _coroutine(std::exchange(other._coroutine, nullptr)) {}
+
+    task& operator=(task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (_coroutine)
+                _coroutine.destroy();
+            _coroutine = std::exchange(other._coroutine, nullptr);
+        }
+        return *this;
+    }
+
+    ~task()
+    {
+        if (_coroutine)
+            _coroutine.destroy();
+    }
+
+    bool valid() const noexcept { return static_cast<bool>(_coroutine); }
+
+    struct awaiter
+    {
+        std::coroutine_handle<promise_type> coroutine;
+
+        bool await_ready() const noexcept { return coroutine.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+        {
+            coroutine.promise().set_continuation(caller);
+            return coroutine;
+        }
+
+        T await_resume() { return coroutine.promise().result(); }
+    };
+
+    awaiter operator co_await() const noexcept { return awaiter {_coroutine}; }
+
+private:
+    std::coroutine_handle<promise_type> _coroutine;
+
+    explicit task(std::coroutine_handle<promise_type> coroutine) noexcept : _coroutine(coroutine) {}
+
+    friend promise_type;
+    friend void spawn(task<void>&& work);
+};
+
+namespace xx_impl
+{
+    template <typename T>
+    task<T> task_promise<T>::get_return_object() noexcept
+    {
+        return task<T>(std::coroutine_handle<task_promise>::from_promise(*this));
+    }
+
+    inline task<void> task_promise<void>::get_return_object() noexcept
+    {
+        return task<void>(std::coroutine_handle<task_promise>::from_promise(*this));
+    }
+}
+
+inline void spawn(task<void>&& work)
+{
+    auto coroutine = std::exchange(work._coroutine, nullptr);
+    coroutine.promise().detach();
+    coroutine.resume();
+}
+
+template <typename R, typename P>
+xx_impl::sleep_awaiter event_loop::sleep(std::chrono::duration<R, P> after)
+{
+    return xx_impl::sleep_awaiter(*this, std::chrono::duration_cast<std::chrono::nanoseconds>(after));
+}
+
+inline xx_impl::io_awaiter event_loop::readable(int fd)
+{
+    return xx_impl::io_awaiter(*this, fd, io_read);
+}
+
+inline xx_impl::io_awaiter event_loop::writable(int fd)
+{
+    return xx_impl::io_awaiter(*this, fd, io_write);
+}
+
+inline xx_impl::signal_awaiter event_loop::signal(int signum)
+{
+    return xx_impl::signal_awaiter(*this, signum);
+}
+
+}
+
+#endif
+
@@ -0,0 +1,1473 @@
+#include <cerrno>
+#include <cmath>
+#include <ctime>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "event_loop.hpp"
+
+#if defined(UTILS_EVENT_LOOP_BACKEND_EPOLL) || defined(UTILS_EVENT_LOOP_BACKEND_SIMULATED)
+
+#include "ext/posix.hpp"
+
+namespace utils {
+
+namespace
+{
+    // epoll_wait() starts with a small batch, and doubles it every time a
+    // batch comes back full, so loops with many busy fds need few syscalls.
+    constexpr std::size_t min_batch_size = 64;
+    constexpr std::size_t max_batch_size = 4096;
+
+    constexpr double never = std::numeric_limits<double>::infinity();
+
+    double monotonic_now() noexcept
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9;
+    }
+
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    // The virtual clock starts at zero and is only moved by the loop itself.
+    constexpr bool is_simulated = true;
+
+    // Numbers which are not open, regular files and the like cannot be
+    // watched by epoll, but can still be made ready by inject().
+    bool is_unpollable(int err) noexcept
+    {
+        return err == EBADF || err == EPERM;
+    }
+#else
+    constexpr bool is_simulated = false;
+
+    bool is_unpollable(int) noexcept
+    {
+        return false;
+    }
+#endif
+
+    // The wall clock minus the monotonic one. The simulated backend uses its
+    // virtual clock as the wall clock too, so periodic timers stay
+    // reproducible.
+    double wall_clock_offset() noexcept
+    {
+        if (is_simulated)
+            return 0;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec + ts.tv_nsec * 1e-9 - monotonic_now();
+    }
+
+    void close_if_valid(int fd) noexcept
+    {
+        if (fd >= 0)
+            close(fd);
+    }
+}
+
+//{{{ Timer heap
+
+namespace xx_impl
+{
+    void timer_heap::place(event_registry<event_entry>& registry, std::uint32_t pos, const node& n) noexcept
+    {
+        _heap[pos] = n;
+        registry.at(n.index).timer_watcher.heap_index = pos;
+    }
+
+    void timer_heap::sift_up(event_registry<event_entry>& registry, std::uint32_t pos) noexcept
+    {
+        auto n = _heap[pos];
+        while (pos > 0)
+        {
+            auto parent = (pos - 1) / 2;
+            if (_heap[parent].at <= n.at)
+                break;
+            place(registry, pos, _heap[parent]);
+            pos = parent;
+        }
+        place(registry, pos, n);
+    }
+
+    void timer_heap::sift_down(event_registry<event_entry>& registry, std::uint32_t pos) noexcept
+    {
+        auto n = _heap[pos];
+        auto size = static_cast<std::uint32_t>(_heap.size());
+        while (true)
+        {
+            auto child = 2 * pos + 1;
+            if (child >= size)
+                break;
+            if (child + 1 < size && _heap[child + 1].at < _heap[child].at)
+                ++ child;
+            if (n.at <= _heap[child].at)
+                break;
+            place(registry, pos, _heap[child]);
+            pos = child;
+        }
+        place(registry, pos, n);
+    }
+
+    void timer_heap::push(event_registry<event_entry>& registry, event_entry& entry)
+    {
+        node n = {entry.timer_watcher.at, entry.index};
+        _heap.push_back(n);
+        sift_up(registry, static_cast<std::uint32_t>(_heap.size() - 1));
+    }
+
+    void timer_heap::erase(event_registry<event_entry>& registry, event_entry& entry) noexcept
+    {
+        auto pos = entry.timer_watcher.heap_index;
+        entry.timer_watcher.heap_index = npos;
+
+        auto last = _heap.back();
+        _heap.pop_back();
+        if (pos == _heap.size())
+            return;
+
+        place(registry, pos, last);
+        sift_up(registry, pos);
+        sift_down(registry, registry.at(last.index).timer_watcher.heap_index);
+    }
+
+    void timer_heap::update(event_registry<event_entry>& registry, event_entry& entry) noexcept
+    {
+        auto pos = entry.timer_watcher.heap_index;
+        _heap[pos].at = entry.timer_watcher.at;
+        sift_up(registry, pos);
+        sift_down(registry, entry.timer_watcher.heap_index);
+    }
+}
+
+//}}}
+
+//{{{ Structors
+
+event_loop::event_loop()
+    : _epoll_fd(-1),
+      _timer_fd(-1),
+      _signal_fd(-1),
+      _post_fd(-1),
+      _ready(min_batch_size),
+      _now(is_simulated ? 0 : monotonic_now()),
+      _timer_fd_at(never),
+      _holds(0),
+      _is_stopping(false),
+      _is_closing(false),
+      _calls(0),
+      _low_priority_budget(0),
+      _next_priority(priority_normal),
+      _has_high_priority(false),
+      _is_wheel_enabled(false),
+      _is_wheel_ticking(false)
+{
+    sigemptyset(&_signal_mask);
+    sigemptyset(&_blocked_signals);
+
+    try
+    {
+        _epoll_fd = posix::checked(epoll_create1(EPOLL_CLOEXEC));
+        _timer_fd = posix::checked(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC));
+        _post_fd = posix::checked(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC));
+
+        for (int fd : {_timer_fd, _post_fd, _uring.fd()})
+        {
+            if (fd < 0)
+                continue;
+
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            posix::checked(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev));
+        }
+    }
+    catch (...)
+    {
+        close_if_valid(_post_fd);
+        close_if_valid(_timer_fd);
+        close_if_valid(_epoll_fd);
+        throw;
+    }
+}
+
+event_loop::~event_loop()
+{
+    // Callbacks destroyed with the registry must not schedule anything.
+    _is_closing = true;
+    close_if_valid(_signal_fd);
+    close_if_valid(_post_fd);
+    close_if_valid(_timer_fd);
+    close_if_valid(_epoll_fd);
+    pthread_sigmask(SIG_UNBLOCK, &_blocked_signals, nullptr);
+}
+
+//}}}
+
+//{{{ Event registration.
+
+#define STORE_EVENT_EEBHGKGNTWN(EntryType, CallbackType) \
+    auto& entry = _events.allocate(); \
+    new(&entry.CallbackType##_callback) xx_impl::CallbackType##_func(std::move(callback)); \
+    entry.type = xx_impl::event_type::EntryType; \
+    _instrument.assign(entry); \
+    assign_priority(entry); \
+    _groups.join(_events, entry); \
+    auto handle = entry.handle()
+
+// Registering the watcher may fail (e.g. epoll refuses regular files), in
+// which case the entry is given back before the error propagates.
+#define START_WATCHER_A0KX7EW3QJT(...) \
+    try \
+    { \
+        __VA_ARGS__; \
+    } \
+    catch (...) \
+    { \
+        _groups.leave(_events, entry); \
+        _events.retire(entry); \
+        throw; \
+    }
+
+event_handle event_loop::listen_impl(int fd, xx_impl::io_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(io, io);
+    START_WATCHER_A0KX7EW3QJT(start_io(entry, fd, io_read));
+    return handle;
+}
+
+event_handle event_loop::listen_impl(int fd, xx_impl::io_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(io_simple, io_simple);
+    START_WATCHER_A0KX7EW3QJT(start_io(entry, fd, io_read));
+    return handle;
+}
+
+event_handle event_loop::listen_impl(int fd, int events, xx_impl::io_mask_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(io_mask, io_mask);
+    START_WATCHER_A0KX7EW3QJT(start_io(entry, fd, events));
+    return handle;
+}
+
+event_handle event_loop::listen_impl(int fd, int events, xx_impl::io_mask_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(io_mask_simple, io_mask_simple);
+    START_WATCHER_A0KX7EW3QJT(start_io(entry, fd, events));
+    return handle;
+}
+
+event_handle event_loop::signal_impl(int signum, xx_impl::io_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(signal, io);
+    START_WATCHER_A0KX7EW3QJT(start_signal(entry, signum));
+    return handle;
+}
+
+event_handle event_loop::signal_impl(int signum, xx_impl::io_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(signal_simple, io_simple);
+    START_WATCHER_A0KX7EW3QJT(start_signal(entry, signum));
+    return handle;
+}
+
+#define START_TIMER_CW3M0RZ1X5A(EntryType, CallbackType, Interval, Slack) \
+    if (_is_wheel_enabled) \
+    { \
+        STORE_EVENT_EEBHGKGNTWN(EntryType##_wheel, CallbackType); \
+        arm_wheel_timer(entry, Interval); \
+        return handle; \
+    } \
+    \
+    STORE_EVENT_EEBHGKGNTWN(EntryType, CallbackType); \
+    START_WATCHER_A0KX7EW3QJT(start_timer(entry, Interval, Slack)); \
+    return handle
+
+#define START_TIMER_SIMPLE_HZ3U8MLN2Q(EntryType, Interval, Slack) \
+    if (_is_wheel_enabled) \
+    { \
+        STORE_EVENT_EEBHGKGNTWN(EntryType##_wheel_simple, timer_simple); \
+        arm_wheel_timer(entry, Interval); \
+        return handle; \
+    } \
+    \
+    STORE_EVENT_EEBHGKGNTWN(EntryType##_simple, timer_simple); \
+    START_WATCHER_A0KX7EW3QJT(start_timer(entry, Interval, Slack)); \
+    return handle
+
+event_handle event_loop::delay_impl(double after, double slack, xx_impl::delay_func&& callback)
+{
+    START_TIMER_CW3M0RZ1X5A(delay, delay, after, slack);
+}
+
+event_handle event_loop::delay_impl(double after, double slack, xx_impl::timer_simple_func&& callback)
+{
+    START_TIMER_SIMPLE_HZ3U8MLN2Q(delay, after, slack);
+}
+
+event_handle event_loop::repeat_impl(double rep, double slack, xx_impl::repeat_func&& callback)
+{
+    START_TIMER_CW3M0RZ1X5A(repeat, repeat, rep, slack);
+}
+
+event_handle event_loop::repeat_impl(double rep, double slack, xx_impl::timer_simple_func&& callback)
+{
+    START_TIMER_SIMPLE_HZ3U8MLN2Q(repeat, rep, slack);
+}
+
+#undef START_TIMER_SIMPLE_HZ3U8MLN2Q
+#undef START_TIMER_CW3M0RZ1X5A
+
+// Both kinds of deadline become monotonic ones here, so a change of the wall
+// clock afterwards does not move them.
+#define START_AT_R8VXK2MQ4DZ(EntryType, CallbackType) \
+    auto now = is_simulated ? _now : monotonic_now(); \
+    STORE_EVENT_EEBHGKGNTWN(EntryType, CallbackType); \
+    START_WATCHER_A0KX7EW3QJT(start_timer(entry, now - _now + after, 0)); \
+    return handle
+
+event_handle event_loop::at_impl(double after, bool, xx_impl::repeat_func&& callback)
+{
+    START_AT_R8VXK2MQ4DZ(at, repeat);
+}
+
+event_handle event_loop::at_impl(double after, bool, xx_impl::timer_simple_func&& callback)
+{
+    START_AT_R8VXK2MQ4DZ(at_simple, timer_simple);
+}
+
+#undef START_AT_R8VXK2MQ4DZ
+
+#define START_PERIODIC_J5NW0TBE7GY(EntryType, CallbackType) \
+    if (!(interval > 0)) \
+        throw std::invalid_argument("utils::event_loop: periodic interval must be positive"); \
+    STORE_EVENT_EEBHGKGNTWN(EntryType, CallbackType); \
+    START_WATCHER_A0KX7EW3QJT(start_periodic(entry, interval, offset)); \
+    return handle
+
+event_handle event_loop::every_impl(double interval, double offset, xx_impl::repeat_func&& callback)
+{
+    START_PERIODIC_J5NW0TBE7GY(periodic, repeat);
+}
+
+event_handle event_loop::every_impl(double interval, double offset, xx_impl::timer_simple_func&& callback)
+{
+    START_PERIODIC_J5NW0TBE7GY(periodic_simple, timer_simple);
+}
+
+#undef START_PERIODIC_J5NW0TBE7GY
+
+event_handle event_loop::watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(path, path);
+    START_WATCHER_A0KX7EW3QJT(start_path(entry, path, mask));
+    return handle;
+}
+
+event_handle event_loop::watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(path_simple, path_simple);
+    START_WATCHER_A0KX7EW3QJT(start_path(entry, path, mask));
+    return handle;
+}
+
+event_handle event_loop::delay_imm_impl(xx_impl::delay_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(delay_imm, delay);
+    _imms.push_back(_events, entry);
+    return handle;
+}
+
+event_handle event_loop::delay_imm_impl(xx_impl::timer_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(delay_imm_simple, timer_simple);
+    _imms.push_back(_events, entry);
+    return handle;
+}
+
+event_handle event_loop::repeat_imm_impl(xx_impl::repeat_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(repeat_imm, repeat);
+    _imms.push_back(_events, entry);
+    return handle;
+}
+
+event_handle event_loop::repeat_imm_impl(xx_impl::timer_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(repeat_imm_simple, timer_simple);
+    _imms.push_back(_events, entry);
+    return handle;
+}
+
+event_handle event_loop::idle_impl(double budget, xx_impl::delay_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(idle, delay);
+    entry.idle_task.budget = budget;
+    _idles.push_back(_events, entry);
+    return handle;
+}
+
+event_handle event_loop::idle_impl(double budget, xx_impl::idle_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(idle_simple, idle_simple);
+    entry.idle_task.budget = budget;
+    _idles.push_back(_events, entry);
+    return handle;
+}
+
+#define START_ASYNC_P0Y4GN8JWQE(EntryType, CallbackType) \
+    STORE_EVENT_EEBHGKGNTWN(EntryType, CallbackType); \
+    START_WATCHER_A0KX7EW3QJT(start_async(entry, kind, fd, buffer, size, timeout)); \
+    return handle
+
+event_handle event_loop::async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                                    double timeout, xx_impl::async_func&& callback)
+{
+    START_ASYNC_P0Y4GN8JWQE(async, async);
+}
+
+event_handle event_loop::async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                                    double timeout, xx_impl::async_simple_func&& callback)
+{
+    START_ASYNC_P0Y4GN8JWQE(async_simple, async_simple);
+}
+
+#undef START_ASYNC_P0Y4GN8JWQE
+#undef START_WATCHER_A0KX7EW3QJT
+#undef STORE_EVENT_EEBHGKGNTWN
+
+//}}}
+
+//{{{ Invocation
+
+void event_loop::call_entry(xx_impl::event_entry& entry, int revents)
+{
+    auto handle = entry.handle();
+    auto type = entry.type;
+    bool keep = true;
+    auto start = _instrument.now();
+
+    ++ _calls;
+    entry.is_calling = true;
+    switch (type)
+    {
+        case xx_impl::event_type::io:
+            entry.io_callback(entry.io_watcher.fd, *this, handle);
+            break;
+
+        case xx_impl::event_type::signal:
+            entry.io_callback(entry.signal_watcher.signum, *this, handle);
+            break;
+
+        case xx_impl::event_type::io_simple:
+            entry.io_simple_callback(entry.io_watcher.fd);
+            break;
+
+        case xx_impl::event_type::signal_simple:
+            entry.io_simple_callback(entry.signal_watcher.signum);
+            break;
+
+        case xx_impl::event_type::io_mask:
+            entry.io_mask_callback(entry.io_watcher.fd, revents, *this, handle);
+            break;
+
+        case xx_impl::event_type::io_mask_simple:
+            entry.io_mask_simple_callback(entry.io_watcher.fd, revents);
+            break;
+
+        case xx_impl::event_type::delay:
+        case xx_impl::event_type::delay_imm:
+        case xx_impl::event_type::delay_wheel:
+            keep = false;
+            entry.delay_callback(keep, *this, handle);
+            break;
+
+        case xx_impl::event_type::delay_simple:
+        case xx_impl::event_type::delay_imm_simple:
+        case xx_impl::event_type::delay_wheel_simple:
+            keep = false;
+            entry.timer_simple_callback();
+            break;
+
+        case xx_impl::event_type::repeat:
+        case xx_impl::event_type::repeat_imm:
+        case xx_impl::event_type::repeat_wheel:
+            entry.repeat_callback(*this, handle);
+            break;
+
+        case xx_impl::event_type::repeat_simple:
+        case xx_impl::event_type::repeat_imm_simple:
+        case xx_impl::event_type::repeat_wheel_simple:
+            entry.timer_simple_callback();
+            break;
+
+        case xx_impl::event_type::at:
+            keep = false;
+            entry.repeat_callback(*this, handle);
+            break;
+
+        case xx_impl::event_type::at_simple:
+            keep = false;
+            entry.timer_simple_callback();
+            break;
+
+        case xx_impl::event_type::periodic:
+            entry.repeat_callback(*this, handle);
+            break;
+
+        case xx_impl::event_type::periodic_simple:
+            entry.timer_simple_callback();
+            break;
+
+        case xx_impl::event_type::async:
+            keep = false;
+            entry.async_callback(revents, *this, handle);
+            break;
+
+        case xx_impl::event_type::async_simple:
+            keep = false;
+            entry.async_simple_callback(revents);
+            break;
+
+        case xx_impl::event_type::idle:
+            keep = false;
+            entry.delay_callback(keep, *this, handle);
+            break;
+
+        case xx_impl::event_type::idle_simple:
+            keep = entry.idle_simple_callback();
+            break;
+
+        case xx_impl::event_type::path:
+            entry.path_callback(*_paths.current, *this, handle);
+            break;
+
+        case xx_impl::event_type::path_simple:
+            entry.path_simple_callback(*_paths.current);
+            break;
+
+        default:
+            break;
+    }
+    entry.is_calling = false;
+    _instrument.record_call(entry, start);
+
+    if (entry.handle() != handle)
+        // The event was cancelled inside its own callback.
+        _events.release(entry);
+    else if (!keep)
+        cancel(handle);
+}
+
+void event_loop::dispatch(xx_impl::event_entry& entry, int revents)
+{
+    if (!is_deferred(entry))
+        call_entry(entry, revents);
+    else if (entry.priority == priority_normal)
+        _normal_ready.push(entry, revents);
+    else
+        _low_ready.push(entry, revents);
+}
+
+void event_loop::call_ready()
+{
+    auto call = [this](xx_impl::event_entry& entry, int revents)
+    {
+        this->call_entry(entry, revents);
+    };
+
+    if (!_normal_ready.empty())
+        _normal_ready.run(_events, 0, call);
+    if (!_low_ready.empty())
+        _low_ready.run(_events, _low_priority_budget, call);
+}
+
+//}}}
+
+//{{{ Main loop
+
+void event_loop::update_now() noexcept
+{
+    if (!is_simulated)
+        _now = monotonic_now();
+}
+
+void event_loop::run()
+{
+    _is_stopping = false;
+    update_now();
+    while (!_is_stopping && (_events.live() != 0 || _holds != 0))
+        run_once();
+    _is_stopping = false;
+}
+
+void event_loop::run_once()
+{
+    if (!is_simulated)
+        arm_timer_fd();
+
+    // All operations queued during the previous iteration go to the kernel
+    // in a single batch.
+    if (_uring.has_unsubmitted())
+        _uring.submit();
+
+    bool is_busy = !_imms.empty() || !_low_ready.empty() || !_idles.empty();
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    // Only block when no timer could move the virtual clock.
+    bool is_polling = is_busy || !_injected.empty() || next_deadline() != never;
+#else
+    bool is_polling = is_busy;
+#endif
+
+    int count = epoll_wait(_epoll_fd, _ready.data(), static_cast<int>(_ready.size()), is_polling ? 0 : -1);
+    if (count < 0)
+    {
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category());
+        count = 0;
+    }
+
+    update_now();
+    auto calls = _calls;
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    // Nothing can happen before the next deadline, so skip to it.
+    if (count == 0 && !is_busy && _injected.empty())
+    {
+        auto at = next_deadline();
+        if (at != never && at > _now)
+            _now = at;
+    }
+#endif
+    _instrument.iteration_begin();
+
+    for (int i = 0; i < count; ++ i)
+    {
+        auto& ev = _ready[i];
+        int fd = ev.data.fd;
+        if (fd == _timer_fd)
+        {
+            std::uint64_t expirations;
+            if (read(_timer_fd, &expirations, sizeof(expirations)) > 0)
+                _timer_fd_at = never;
+        }
+        else if (fd == _post_fd)
+        {
+            std::uint64_t value;
+            if (read(_post_fd, &value, sizeof(value)) > 0)
+            {
+                try
+                {
+                    _posts.run(*this);
+                }
+                catch (...)
+                {
+                    // Come back for the rest of the batch.
+                    wake_posts();
+                    throw;
+                }
+            }
+        }
+        else if (fd == _signal_fd)
+            call_signals();
+        else if (fd == _uring.fd())
+        {
+            _uring.reap([this](event_handle user_data, int res)
+            {
+                this->complete_async(user_data, res);
+            });
+        }
+        else
+            call_io(fd, ev.events);
+    }
+
+    if (static_cast<std::size_t>(count) == _ready.size() && _ready.size() < max_batch_size)
+        _ready.resize(_ready.size() * 2);
+
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    // Readiness injected by these callbacks waits for the next iteration.
+    _injecting.swap(_injected);
+    for (auto& ready : _injecting)
+    {
+        std::uint32_t epoll_events = 0;
+        if (ready.second & io_read)
+            epoll_events |= EPOLLIN;
+        if (ready.second & io_write)
+            epoll_events |= EPOLLOUT;
+        if (static_cast<std::size_t>(ready.first) < _fds.size())
+            call_io(ready.first, epoll_events);
+    }
+    _injecting.clear();
+#endif
+
+    call_timers();
+    call_ready();
+
+    if (!_imms.empty())
+        call_imms();
+
+    if (!_idles.empty() && count == 0 && _calls == calls)
+        call_idles();
+
+    _instrument.iteration_end(_imms.size());
+}
+
+//}}}
+
+//{{{ File descriptors
+
+void event_loop::add_io_interest(xx_impl::epoll_fd_state& state, int events, int delta) noexcept
+{
+    if (events & io_read)
+        state.readers += delta;
+    if (events & io_write)
+        state.writers += delta;
+    if (events & io_edge)
+        state.edge_triggered += delta;
+}
+
+void event_loop::update_fd(int fd)
+{
+    auto& state = _fds[fd];
+
+    std::uint32_t mask = 0;
+    if (state.readers)
+        mask |= EPOLLIN;
+    if (state.writers)
+        mask |= EPOLLOUT;
+    if (mask && state.edge_triggered)
+        mask |= EPOLLET;
+
+    if (mask == state.registered)
+        return;
+
+    struct epoll_event ev;
+    ev.events = mask;
+    ev.data.fd = fd;
+
+    if (!mask)
+    {
+        // The fd may have been closed already, which removes it from the set.
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+    }
+    else
+    {
+        // The fd number may have been closed and reused since it was last
+        // registered, so fall back between ADD and MOD as needed.
+        int op = state.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        int res = epoll_ctl(_epoll_fd, op, fd, &ev);
+        if (res < 0 && errno == (op == EPOLL_CTL_MOD ? ENOENT : EEXIST))
+        {
+            op = (op == EPOLL_CTL_MOD) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+            res = epoll_ctl(_epoll_fd, op, fd, &ev);
+        }
+        if (res < 0 && !is_unpollable(errno))
+            throw std::system_error(errno, std::generic_category());
+    }
+
+    state.registered = mask;
+}
+
+void event_loop::start_io(xx_impl::event_entry& entry, int fd, int events)
+{
+    if (fd < 0)
+        throw std::system_error(EBADF, std::generic_category());
+
+    // Growing at the end keeps the other states in place, which call_io()
+    // may be walking while a callback listens to a new fd.
+    while (static_cast<std::size_t>(fd) >= _fds.size())
+        _fds.emplace_back();
+
+    auto& state = _fds[fd];
+    auto& watcher = io_watcher_of(entry);
+    watcher.fd = fd;
+    watcher.events = events;
+    add_io_interest(state, events, 1);
+    try
+    {
+        update_fd(fd);
+    }
+    catch (...)
+    {
+        add_io_interest(state, events, -1);
+        throw;
+    }
+    state.listeners.push_back(_events, entry);
+}
+
+void event_loop::stop_io(xx_impl::event_entry& entry) noexcept
+{
+    auto& watcher = io_watcher_of(entry);
+    auto& state = _fds[watcher.fd];
+    state.listeners.erase(_events, entry);
+    add_io_interest(state, watcher.events, -1);
+    try
+    {
+        update_fd(watcher.fd);
+    }
+    catch (...)
+    {
+    }
+}
+
+void event_loop::call_io(int fd, std::uint32_t epoll_events)
+{
+    int revents = 0;
+    if (epoll_events & (EPOLLIN | EPOLLPRI))
+        revents |= io_read;
+    if (epoll_events & EPOLLOUT)
+        revents |= io_write;
+    if (epoll_events & (EPOLLERR | EPOLLHUP))
+        revents |= io_read | io_write;
+
+    auto& state = _fds[fd];
+    state.listeners.walk(_events, [&](xx_impl::event_entry& entry)
+    {
+        int ready = revents & io_watcher_of(entry).events;
+        if (!ready)
+            return;
+        if (xx_impl::is_async(entry))
+            this->call_async(entry);
+        else
+            this->dispatch(entry, ready);
+    });
+}
+
+void event_loop::modify(event_handle handle, int events)
+{
+    auto entry = _events.find(handle);
+    if (!entry)
+        return;
+
+    switch (entry->type)
+    {
+        case xx_impl::event_type::io:
+        case xx_impl::event_type::io_simple:
+        case xx_impl::event_type::io_mask:
+        case xx_impl::event_type::io_mask_simple:
+        {
+            auto& watcher = entry->io_watcher;
+            auto& state = _fds[watcher.fd];
+            auto old_events = watcher.events;
+            add_io_interest(state, old_events, -1);
+            add_io_interest(state, events, 1);
+            watcher.events = events;
+            try
+            {
+                update_fd(watcher.fd);
+            }
+            catch (...)
+            {
+                add_io_interest(state, events, -1);
+                add_io_interest(state, old_events, 1);
+                watcher.events = old_events;
+                throw;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+void event_loop::inject(int fd, int revents)
+{
+    if (fd < 0)
+        throw std::system_error(EBADF, std::generic_category());
+    _injected.emplace_back(fd, revents);
+}
+#endif
+
+//}}}
+
+//{{{ Signals
+
+void event_loop::update_signal_fd()
+{
+    if (_signal_fd >= 0)
+    {
+        posix::checked(signalfd(_signal_fd, &_signal_mask, 0));
+        return;
+    }
+
+    _signal_fd = posix::checked(signalfd(-1, &_signal_mask, SFD_NONBLOCK | SFD_CLOEXEC));
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = _signal_fd;
+    posix::checked(epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _signal_fd, &ev));
+}
+
+void event_loop::start_signal(xx_impl::event_entry& entry, int signum)
+{
+    if (signum <= 0 || signum >= NSIG)
+        throw std::system_error(EINVAL, std::generic_category());
+
+    entry.signal_watcher.signum = signum;
+
+    auto& watchers = _signals[signum];
+    if (watchers.empty())
+    {
+        // signalfd only receives signals which are blocked.
+        sigset_t set, old_set;
+        sigemptyset(&set);
+        sigaddset(&set, signum);
+        pthread_sigmask(SIG_BLOCK, &set, &old_set);
+        if (!sigismember(&old_set, signum))
+            sigaddset(&_blocked_signals, signum);
+
+        sigaddset(&_signal_mask, signum);
+        update_signal_fd();
+    }
+
+    watchers.push_back(_events, entry);
+}
+
+void event_loop::stop_signal(xx_impl::event_entry& entry) noexcept
+{
+    auto signum = entry.signal_watcher.signum;
+    auto& watchers = _signals[signum];
+    watchers.erase(_events, entry);
+    if (!watchers.empty())
+        return;
+
+    sigdelset(&_signal_mask, signum);
+    signalfd(_signal_fd, &_signal_mask, 0);
+
+    if (sigismember(&_blocked_signals, signum))
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, signum);
+        pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+        sigdelset(&_blocked_signals, signum);
+    }
+}
+
+void event_loop::call_signals()
+{
+    struct signalfd_siginfo infos[16];
+    while (true)
+    {
+        auto size = read(_signal_fd, infos, sizeof(infos));
+        if (size <= 0)
+            break;
+
+        auto count = static_cast<std::size_t>(size) / sizeof(infos[0]);
+        for (std::size_t i = 0; i < count; ++ i)
+        {
+            auto signum = static_cast<int>(infos[i].ssi_signo);
+            if (signum > 0 && signum < NSIG)
+            {
+                _signals[signum].walk(_events, [this](xx_impl::event_entry& entry)
+                {
+                    this->dispatch(entry, 0);
+                });
+            }
+        }
+
+        if (count < sizeof(infos) / sizeof(infos[0]))
+            break;
+    }
+}
+
+//}}}
+
+//{{{ Timers
+
+void event_loop::start_timer(xx_impl::event_entry& entry, double after, double slack)
+{
+    auto& watcher = entry.timer_watcher;
+    watcher.due = _now + after;
+    watcher.at = xx_impl::apply_slack(watcher.due, slack);
+    watcher.repeat = after;
+    watcher.slack = slack;
+    _timers.push(_events, entry);
+}
+
+void event_loop::start_periodic(xx_impl::event_entry& entry, double interval, double offset)
+{
+    auto& watcher = entry.timer_watcher;
+    watcher.repeat = interval;
+    watcher.offset = std::fmod(offset, interval);
+    watcher.slack = 0;
+    schedule_periodic(watcher);
+    _timers.push(_events, entry);
+}
+
+void event_loop::schedule_periodic(xx_impl::epoll_timer_watcher& watcher) noexcept
+{
+    // Align to the wall clock afresh every time, so neither a late wakeup nor
+    // a change of the clock shifts the following deadlines. A deadline which
+    // is only a rounding error away is the one that just expired.
+    auto wall = _now + wall_clock_offset();
+    auto next = watcher.offset + (std::floor((wall - watcher.offset) / watcher.repeat) + 1) * watcher.repeat;
+    if (next - wall < watcher.repeat * 1e-9)
+        next += watcher.repeat;
+    watcher.due = _now + (next - wall);
+    watcher.at = watcher.due;
+}
+
+double event_loop::next_deadline() const noexcept
+{
+    auto at = _timers.empty() ? never : _timers.top_at();
+    if (_wheel && _is_wheel_ticking)
+    {
+        auto wheel_at = _wheel->deadline_of(_wheel->now + 1);
+        if (wheel_at < at)
+            at = wheel_at;
+    }
+    return at;
+}
+
+void event_loop::arm_timer_fd()
+{
+    auto at = next_deadline();
+    if (at == _timer_fd_at)
+        return;
+
+    struct itimerspec spec = {};
+    if (at != never)
+    {
+        // A zero it_value would disarm the timer instead.
+        if (at <= 0)
+            at = 1e-9;
+        spec.it_value.tv_sec = static_cast<time_t>(at);
+        spec.it_value.tv_nsec = static_cast<long>((at - spec.it_value.tv_sec) * 1e9);
+    }
+    posix::checked(timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr));
+    _timer_fd_at = at;
+}
+
+void event_loop::call_timers()
+{
+    bool is_first = true;
+    while (!_timers.empty() && _timers.top_at() <= _now)
+    {
+        auto& entry = _events.at(_timers.top_index());
+        auto& watcher = entry.timer_watcher;
+        _timer_stats.expired(is_first, watcher.slack);
+        is_first = false;
+
+        // Like libev, reschedule the timer before calling it. Timers which
+        // should not repeat are cancelled after the callback. The period is
+        // kept on the unrounded deadlines, so slack does not accumulate.
+        if (xx_impl::is_at(entry))
+        {
+            // Parked until the callback, which cancels it.
+            watcher.due = never;
+            watcher.at = never;
+        }
+        else if (xx_impl::is_periodic(entry))
+        {
+            schedule_periodic(watcher);
+        }
+        else
+        {
+            watcher.due += watcher.repeat;
+            if (watcher.due < _now)
+                watcher.due = _now;
+            watcher.at = xx_impl::apply_slack(watcher.due, watcher.slack);
+        }
+
+        // A timer waiting in a ready queue must not expire again in this
+        // iteration, or a zero interval would never leave this loop.
+        if (watcher.at == _now && is_deferred(entry))
+            watcher.at = std::nextafter(_now, never);
+        _timers.update(_events, entry);
+
+        dispatch(entry, 0);
+    }
+
+    if (_wheel && _is_wheel_ticking && _wheel->ticks_at(_now) > _wheel->now)
+        call_wheel();
+}
+
+//}}}
+
+//{{{ Immediate callbacks:
+
+void event_loop::call_imms()
+{
+    _imms.walk(_events, [this](xx_impl::event_entry& entry)
+    {
+        this->call_entry(entry, 0);
+    });
+}
+
+//}}}
+
+//{{{ Idle work
+
+void event_loop::call_idles()
+{
+    // Budgets count from the start of the idle work, so the tasks share it
+    // instead of each taking its full budget in turn. A task which finds its
+    // budget spent waits with those behind it for the next idle iteration,
+    // and a task which had its turn moves to the back, so that they take
+    // turns. Virtual time does not pass while chunks run, so the simulated
+    // backend runs one chunk of each task per iteration instead.
+    auto start = is_simulated ? 0 : monotonic_now();
+    bool is_first = true;
+    _idles.walk(_events, [&](xx_impl::event_entry& entry)
+    {
+        auto deadline = start + entry.idle_task.budget;
+        if (!is_simulated && !is_first && monotonic_now() >= deadline)
+        {
+            _idles.stop_walk();
+            return;
+        }
+        is_first = false;
+
+        auto handle = entry.handle();
+        do
+            this->call_entry(entry, 0);
+        while (!is_simulated && _events.find(handle) == &entry && monotonic_now() < deadline);
+
+        if (_events.find(handle) == &entry)
+        {
+            _idles.erase(_events, entry);
+            _idles.push_back(_events, entry);
+        }
+    });
+}
+
+//}}}
+
+//{{{ Timer wheel
+
+void event_loop::enable_timer_wheel_impl(double resolution)
+{
+    if (resolution <= 0)
+        throw std::invalid_argument("utils::event_loop: timer wheel resolution must be positive");
+
+    if (_wheel)
+    {
+        if (_wheel->count != 0 && _wheel->resolution != resolution)
+            throw std::logic_error("utils::event_loop: cannot change the resolution of a busy timer wheel");
+        _is_wheel_ticking = false;
+        _wheel->resolution = resolution;
+    }
+    else
+    {
+        _wheel.reset(new xx_impl::timer_wheel<xx_impl::event_entry>(resolution));
+    }
+
+    _is_wheel_enabled = true;
+}
+
+xx_impl::event_entry& event_loop::arm_wheel_timer(xx_impl::event_entry& entry, double interval)
+{
+    auto& wheel = *_wheel;
+    if (!_is_wheel_ticking)
+    {
+        // The wheel stops turning when it is empty, so catch up with the
+        // current time before using it again.
+        wheel.epoch = _now;
+        wheel.now = 0;
+        _is_wheel_ticking = true;
+    }
+
+    auto& timer = entry.wheel_watcher;
+    timer.interval = wheel.ticks_for(interval);
+    timer.expires = wheel.now + timer.interval;
+    wheel.insert(_events, entry);
+    return entry;
+}
+
+void event_loop::call_wheel()
+{
+    auto& wheel = *_wheel;
+    auto target = wheel.ticks_at(_now);
+
+    while (wheel.now < target && wheel.count != 0)
+    {
+        wheel.tick(_events).walk(_events, [&](xx_impl::event_entry& entry)
+        {
+            wheel.erase(_events, entry);
+
+            auto handle = entry.handle();
+            this->dispatch(entry, 0);
+
+            // Re-arm repeating timers, unless the callback has cancelled or
+            // restarted the timer itself.
+            if (_events.find(handle) == &entry && entry.wheel_watcher.slot == xx_impl::npos)
+            {
+                entry.wheel_watcher.expires = wheel.now + entry.wheel_watcher.interval;
+                wheel.insert(_events, entry);
+            }
+        });
+    }
+
+    if (wheel.count == 0)
+        _is_wheel_ticking = false;
+    else if (wheel.now < target)
+        wheel.now = target;
+}
+
+//}}}
+
+//{{{ Asynchronous I/O
+
+void event_loop::start_async(xx_impl::event_entry& entry, xx_impl::async_kind kind, int fd, void* buffer,
+                             std::size_t size, double timeout)
+{
+    auto& op = entry.async_watcher.op;
+    xx_impl::prepare_async(op, kind, fd, buffer, size, timeout);
+
+    if (_uring.enabled())
+    {
+        _uring.start(entry.handle(), op);
+        // The kernel holds on to the entry until the operation completes,
+        // just like a running callback would.
+        entry.is_calling = true;
+        return;
+    }
+
+    // Without io_uring, wait for readiness and perform the operation then.
+    start_io(entry, fd, kind == xx_impl::async_kind::write ? io_write : io_read);
+    op.is_waiting = true;
+
+    if (timeout >= 0)
+    {
+        auto handle = entry.handle();
+        op.timer = delay(std::chrono::duration<double>(timeout), [handle](bool&, event_loop& loop, event_handle)
+        {
+            loop.expire_async(handle);
+        });
+    }
+}
+
+void event_loop::stop_async(xx_impl::event_entry& entry) noexcept
+{
+    auto& op = entry.async_watcher.op;
+
+    if (op.is_waiting)
+    {
+        stop_io(entry);
+        op.is_waiting = false;
+    }
+
+    if (op.timer)
+    {
+        auto timer = op.timer;
+        op.timer = 0;
+        cancel(timer);
+    }
+
+    if (op.is_in_kernel)
+    {
+        // The entry is released when the cancelled operation completes. If
+        // the cancellation cannot be queued, the operation simply runs to
+        // completion instead.
+        try
+        {
+            _uring.cancel(entry.handle());
+        }
+        catch (...)
+        {
+        }
+    }
+}
+
+void event_loop::call_async(xx_impl::event_entry& entry)
+{
+    auto res = xx_impl::perform_async(entry.async_watcher.op);
+    if (res == -EAGAIN || res == -EWOULDBLOCK || res == -EINTR)
+        return;
+
+    stop_async(entry);
+    call_entry(entry, static_cast<int>(res));
+}
+
+void event_loop::expire_async(event_handle handle)
+{
+    auto entry = _events.find(handle);
+    if (!entry)
+        return;
+
+    // The timer is being called and finishes by itself.
+    entry->async_watcher.op.timer = 0;
+    stop_async(*entry);
+    call_entry(*entry, -ETIMEDOUT);
+}
+
+void event_loop::complete_async(event_handle user_data, int res)
+{
+    auto& entry = _events.at(static_cast<std::uint32_t>(user_data));
+    auto& op = entry.async_watcher.op;
+    op.is_in_kernel = false;
+    entry.is_calling = false;
+
+    if (entry.handle() != user_data)
+    {
+        // The operation was cancelled while in the kernel.
+        _events.release(entry);
+        return;
+    }
+
+    if (res == -ECANCELED && op.has_timeout())
+        res = -ETIMEDOUT;
+    call_entry(entry, res);
+}
+
+//}}}
+
+//{{{ Cross-thread posts
+
+void event_loop::post_impl(xx_impl::post_func&& callback)
+{
+    if (_posts.push(std::move(callback)))
+        wake_posts();
+}
+
+void event_loop::wake_posts() noexcept
+{
+    std::uint64_t one = 1;
+    while (write(_post_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+void event_loop::post_impl(xx_impl::post_simple_func&& callback)
+{
+    post_impl(xx_impl::post_func([callback](event_loop&) { callback(); }));
+}
+
+//}}}
+
+void event_loop::stop_watcher(xx_impl::event_entry& entry) noexcept
+{
+    switch (entry.type)
+    {
+        case xx_impl::event_type::io:
+        case xx_impl::event_type::io_simple:
+        case xx_impl::event_type::io_mask:
+        case xx_impl::event_type::io_mask_simple:
+            stop_io(entry);
+            break;
+
+        case xx_impl::event_type::signal:
+        case xx_impl::event_type::signal_simple:
+            stop_signal(entry);
+            break;
+
+        case xx_impl::event_type::delay:
+        case xx_impl::event_type::delay_simple:
+        case xx_impl::event_type::repeat:
+        case xx_impl::event_type::repeat_simple:
+        case xx_impl::event_type::at:
+        case xx_impl::event_type::at_simple:
+        case xx_impl::event_type::periodic:
+        case xx_impl::event_type::periodic_simple:
+            _timers.erase(_events, entry);
+            break;
+
+        case xx_impl::event_type::delay_wheel:
+        case xx_impl::event_type::delay_wheel_simple:
+        case xx_impl::event_type::repeat_wheel:
+        case xx_impl::event_type::repeat_wheel_simple:
+            _wheel->erase(_events, entry);
+            break;
+
+        case xx_impl::event_type::delay_imm:
+        case xx_impl::event_type::delay_imm_simple:
+        case xx_impl::event_type::repeat_imm:
+        case xx_impl::event_type::repeat_imm_simple:
+            _imms.erase(_events, entry);
+            break;
+
+        case xx_impl::event_type::idle:
+        case xx_impl::event_type::idle_simple:
+            _idles.erase(_events, entry);
+            break;
+
+        case xx_impl::event_type::async:
+        case xx_impl::event_type::async_simple:
+            stop_async(entry);
+            break;
+
+        case xx_impl::event_type::path:
+        case xx_impl::event_type::path_simple:
+            stop_path(entry);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void event_loop::restart(event_handle handle)
+{
+    auto entry = _events.find(handle);
+    if (!entry)
+        return;
+
+    switch (entry->type)
+    {
+        case xx_impl::event_type::delay:
+        case xx_impl::event_type::delay_simple:
+        case xx_impl::event_type::repeat:
+        case xx_impl::event_type::repeat_simple:
+        {
+            auto& watcher = entry->timer_watcher;
+            watcher.due = _now + watcher.repeat;
+            watcher.at = xx_impl::apply_slack(watcher.due, watcher.slack);
+            _timers.update(_events, *entry);
+            break;
+        }
+
+        case xx_impl::event_type::delay_wheel:
+        case xx_impl::event_type::delay_wheel_simple:
+        case xx_impl::event_type::repeat_wheel:
+        case xx_impl::event_type::repeat_wheel_simple:
+        {
+            auto& timer = entry->wheel_watcher;
+            _wheel->erase(_events, *entry);
+            timer.expires = _wheel->now + timer.interval;
+            _wheel->insert(_events, *entry);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void event_loop::cancel_entry(xx_impl::event_entry& entry) noexcept
+{
+    stop_watcher(entry);
+    _groups.leave(_events, entry);
+    _events.retire(entry);
+}
+
+void event_loop::cancel(event_handle handle)
+{
+    auto entry = _events.find(handle);
+    if (entry)
+        cancel_entry(*entry);
+}
+
+void event_loop::cancel_group(event_group group)
+{
+    _groups.cancel(_events, group, [this](xx_impl::event_entry& entry)
+    {
+        this->cancel_entry(entry);
+    });
+}
+
+event_loop& get_main_loop()
+{
+    static thread_local event_loop loop;
+    return loop;
+}
+
+}
+
+#endif
+
@@ -0,0 +1,626 @@
+
+#ifndef EVENT_LOOP_EPOLL_HPP_B8RM5Z1YQ7D
+#define EVENT_LOOP_EPOLL_HPP_B8RM5Z1YQ7D
+
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <utility>
+#include <sys/epoll.h>
+#include "event_loop.hpp"
+#include "event_loop-common.hpp"
+#include "event_loop-uring.hpp"
+#include "event_loop-inotify.hpp"
+#include "event_loop-instrument.hpp"
+
+namespace utils {
+
+namespace xx_impl
+{
+    struct epoll_io_watcher
+    {
+        int fd;
+        int events;
+    };
+
+    struct epoll_signal_watcher
+    {
+        int signum;
+    };
+
+    // The timer expires at *at*, which is *due* rounded by the slack.
+    // Periodic timers are due at offset + k * repeat on the wall clock.
+    struct epoll_timer_watcher
+    {
+        double at;
+        double due;
+        double repeat;
+        double slack;
+        double offset;
+        std::uint32_t heap_index;
+    };
+
+    // The io watcher is only used when io_uring is unavailable.
+    struct epoll_async_watcher
+    {
+        epoll_io_watcher io;
+        async_op op;
+    };
+
+    // File descriptor and signal watchers are linked into the event_queue of
+    // their fd or signal number through the prev and next members.
+    struct event_entry : event_entry_base
+    {
+        union
+        {
+            epoll_io_watcher io_watcher;
+            epoll_signal_watcher signal_watcher;
+            epoll_timer_watcher timer_watcher;
+            wheel_timer wheel_watcher;
+            epoll_async_watcher async_watcher;
+            idle_budget idle_task;
+            inotify_watcher path_watcher;
+        };
+    };
+
+    struct epoll_fd_state
+    {
+        event_queue<event_entry> listeners;
+        std::uint32_t readers;
+        std::uint32_t writers;
+        std::uint32_t edge_triggered;
+        std::uint32_t registered;
+
+        epoll_fd_state() noexcept
+            : readers(0), writers(0), edge_triggered(0), registered(0)
+        {}
+    };
+
+    // A binary min-heap of timer entries. The deadlines are copied into the
+    // heap, so sifting does not need to touch the entries themselves.
+    class timer_heap
+    {
+    public:
+        bool empty() const noexcept { return _heap.empty(); }
+        double top_at() const noexcept { return _heap.front().at; }
+        std::uint32_t top_index() const noexcept { return _heap.front().index; }
+
+        void push(event_registry<event_entry>& registry, event_entry& entry);
+        void erase(event_registry<event_entry>& registry, event_entry& entry) noexcept;
+        void update(event_registry<event_entry>& registry, event_entry& entry) noexcept;
+
+    private:
+        struct node
+        {
+            double at;
+            std::uint32_t index;
+        };
+
+        std::vector<node> _heap;
+
+        void place(event_registry<event_entry>& registry, std::uint32_t pos, const node& n) noexcept;
+        void sift_up(event_registry<event_entry>& registry, std::uint32_t pos) noexcept;
+        void sift_down(event_registry<event_entry>& registry, std::uint32_t pos) noexcept;
+    };
+}
+
+
+class event_loop final
+{
+public:
+    event_loop();
+
+    event_loop& with_tag(const char* tag) noexcept
+    {
+        _instrument.tag_next(tag);
+        return *this;
+    }
+
+    event_group create_group() { return _groups.create(); }
+
+    event_loop& with_group(event_group group) noexcept
+    {
+        _groups.select(group);
+        return *this;
+    }
+
+    event_loop& with_priority(event_priority priority) noexcept
+    {
+        _next_priority = priority;
+        return *this;
+    }
+
+    void set_low_priority_budget(std::size_t budget) noexcept { _low_priority_budget = budget; }
+
+    std::size_t live_events() const noexcept { return _events.live(); }
+
+    event_loop_snapshot snapshot() const
+    {
+        auto result = _instrument.snapshot(_events.live(), _imms.size());
+        result.timer_wakeups = _timer_stats.wakeups;
+        result.coalesced_timers = _timer_stats.coalesced;
+        return result;
+    }
+
+    void reset_snapshot() noexcept
+    {
+        _instrument.reset();
+        _timer_stats = xx_impl::timer_stats();
+    }
+
+    template <typename F>
+    event_handle listen(int fd, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::io_func, xx_impl::io_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return listen_impl(fd, std::move(callback));
+    }
+
+    template <typename F>
+    event_handle listen(int fd, int events, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::io_mask_func, xx_impl::io_mask_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return listen_impl(fd, events, std::move(callback));
+    }
+
+    void modify(event_handle handle, int events);
+
+    template <typename F>
+    event_handle signal(int signum, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::io_func, xx_impl::io_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return signal_impl(signum, std::move(callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle delay(std::chrono::duration<R, P> after, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<double>>(after).count();
+        typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return delay_impl(seconds, 0, std::move(callback));
+    }
+
+    template <typename R, typename P, typename R2, typename P2, typename F>
+    event_handle delay(std::chrono::duration<R, P> after, std::chrono::duration<R2, P2> slack, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<double>>(after).count();
+        typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return delay_impl(seconds, to_timeout(slack), std::move(callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle repeat(std::chrono::duration<R, P> interval, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<double>>(interval).count();
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return repeat_impl(seconds, 0, std::move(callback));
+    }
+
+    template <typename R, typename P, typename R2, typename P2, typename F>
+    event_handle repeat(std::chrono::duration<R, P> interval, std::chrono::duration<R2, P2> slack, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<double>>(interval).count();
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return repeat_impl(seconds, to_timeout(slack), std::move(callback));
+    }
+
+    template <typename F>
+    event_handle delay(F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return delay_imm_impl(std::move(callback));
+    }
+
+    template <typename F>
+    event_handle repeat(F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return repeat_imm_impl(std::move(callback));
+    }
+
+    template <typename C, typename D, typename F>
+    event_handle at(std::chrono::time_point<C, D> when, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return at_impl(to_timeout(when - C::now()), !C::is_steady, std::move(callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle every(std::chrono::duration<R, P> interval, F&& gen_callback)
+    {
+        return every(interval, std::chrono::seconds(0), std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename R2, typename P2, typename F>
+    event_handle every(std::chrono::duration<R, P> interval, std::chrono::duration<R2, P2> offset, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return every_impl(duration_cast<duration<double>>(interval).count(),
+                          duration_cast<duration<double>>(offset).count(), std::move(callback));
+    }
+
+    // Raw function pointers with a context, stored inline and called directly.
+
+    event_handle listen(int fd, xx_impl::io_func::raw_type function, void* ctx)
+    {
+        return listen_impl(fd, xx_impl::io_func(function, ctx));
+    }
+
+    event_handle listen(int fd, int events, xx_impl::io_mask_func::raw_type function, void* ctx)
+    {
+        return listen_impl(fd, events, xx_impl::io_mask_func(function, ctx));
+    }
+
+    event_handle signal(int signum, xx_impl::io_func::raw_type function, void* ctx)
+    {
+        return signal_impl(signum, xx_impl::io_func(function, ctx));
+    }
+
+    template <typename R, typename P>
+    event_handle delay(std::chrono::duration<R, P> after, xx_impl::delay_func::raw_type function, void* ctx)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<double>>(after).count();
+        return delay_impl(seconds, 0, xx_impl::delay_func(function, ctx));
+    }
+
+    template <typename R, typename P>
+    event_handle repeat(std::chrono::duration<R, P> interval, xx_impl::repeat_func::raw_type function, void* ctx)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<double>>(interval).count();
+        return repeat_impl(seconds, 0, xx_impl::repeat_func(function, ctx));
+    }
+
+    event_handle delay(xx_impl::delay_func::raw_type function, void* ctx)
+    {
+        return delay_imm_impl(xx_impl::delay_func(function, ctx));
+    }
+
+    event_handle repeat(xx_impl::repeat_func::raw_type function, void* ctx)
+    {
+        return repeat_imm_impl(xx_impl::repeat_func(function, ctx));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle when_idle(std::chrono::duration<R, P> budget, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::idle_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return idle_impl(to_timeout(budget), std::move(callback));
+    }
+
+    template <typename F>
+    void post(F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::post_func, xx_impl::post_simple_func>::type
+            callback (std::forward<F>(gen_callback));
+        post_impl(std::move(callback));
+    }
+
+    template <typename F>
+    event_handle async_read(int fd, void* buffer, std::size_t size, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::read, fd, buffer, size, -1, std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle async_read(int fd, void* buffer, std::size_t size, std::chrono::duration<R, P> timeout, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::read, fd, buffer, size, to_timeout(timeout), std::forward<F>(gen_callback));
+    }
+
+    template <typename F>
+    event_handle async_write(int fd, const void* buffer, std::size_t size, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::write, fd, buffer, size, -1, std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle async_write(int fd, const void* buffer, std::size_t size, std::chrono::duration<R, P> timeout, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::write, fd, buffer, size, to_timeout(timeout), std::forward<F>(gen_callback));
+    }
+
+    template <typename F>
+    event_handle async_accept(int fd, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::accept, fd, nullptr, 0, -1, std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle async_accept(int fd, std::chrono::duration<R, P> timeout, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::accept, fd, nullptr, 0, to_timeout(timeout), std::forward<F>(gen_callback));
+    }
+
+    bool register_buffers(const struct iovec* buffers, unsigned count)
+    {
+        return _uring.register_buffers(buffers, count);
+    }
+
+    void unregister_buffers() noexcept { _uring.unregister_buffers(); }
+
+    bool is_io_uring_enabled() const noexcept { return _uring.enabled(); }
+
+    template <typename R, typename P>
+    void enable_timer_wheel(std::chrono::duration<R, P> resolution)
+    {
+        using namespace std::chrono;
+        enable_timer_wheel_impl(duration_cast<duration<double>>(resolution).count());
+    }
+
+    void disable_timer_wheel() noexcept { _is_wheel_enabled = false; }
+
+    template <typename R, typename P>
+    xx_impl::sleep_awaiter sleep(std::chrono::duration<R, P> after);
+    xx_impl::io_awaiter readable(int fd);
+    xx_impl::io_awaiter writable(int fd);
+    xx_impl::signal_awaiter signal(int signum);
+
+    template <typename F>
+    event_group forward(int src_fd, int dst_fd, const forward_options& options, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::forward_func, xx_impl::forward_simple_func>::type
+            callback (std::forward<F>(gen_callback));
+        return forward_impl(src_fd, dst_fd, options, std::move(callback));
+    }
+
+    template <typename F>
+    event_group forward(int src_fd, int dst_fd, F&& gen_callback)
+    {
+        return forward(src_fd, dst_fd, forward_options(), std::forward<F>(gen_callback));
+    }
+
+    template <typename F>
+    event_handle watch_path(const std::string& path, std::uint32_t mask, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::path_func, xx_impl::path_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return watch_path_impl(path.c_str(), mask, std::move(callback));
+    }
+
+    template <typename R, typename P>
+    void set_path_coalescing(std::chrono::duration<R, P> window)
+    {
+        using namespace std::chrono;
+        _paths.window = duration_cast<duration<double>>(window).count();
+    }
+
+    // Defined in offload_pool.hpp.
+    template <typename F, typename G>
+    bool offload(F&& work, G&& then);
+
+    void restart(event_handle handle);
+
+    void cancel(event_handle handle);
+
+    void cancel_group(event_group group);
+
+    void run();
+
+    void stop() noexcept { _is_stopping = true; }
+
+    void hold() noexcept { ++ _holds; }
+    void release() noexcept { -- _holds; }
+
+    int get_epoll_fd() const noexcept { return _epoll_fd; }
+
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    std::chrono::nanoseconds now() const noexcept
+    {
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(duration<double>(_now));
+    }
+
+    template <typename R, typename P>
+    void advance(std::chrono::duration<R, P> by) noexcept
+    {
+        _now += to_timeout(by);
+    }
+
+    void inject(int fd, int revents);
+#endif
+
+    ~event_loop();
+
+private:
+    friend struct xx_impl::loop_access;
+
+    int _epoll_fd;
+    int _timer_fd;
+    int _signal_fd;
+    int _post_fd;
+
+    std::vector<struct epoll_event> _ready;
+    double _now;
+    double _timer_fd_at;
+    std::size_t _holds;
+    bool _is_stopping;
+    bool _is_closing;
+
+    xx_impl::event_queue<xx_impl::event_entry> _imms;
+    xx_impl::event_queue<xx_impl::event_entry> _idles;
+
+    // The number of callbacks called so far. An iteration which calls none
+    // and finds nothing ready is idle.
+    std::uint64_t _calls;
+
+    // The pool must outlive the entries holding callbacks allocated from it.
+    xx_impl::callback_pool _callback_pool;
+    xx_impl::event_registry<xx_impl::event_entry> _events;
+    xx_impl::event_groups<xx_impl::event_entry> _groups;
+
+    std::deque<xx_impl::epoll_fd_state> _fds;
+    xx_impl::event_queue<xx_impl::event_entry> _signals[NSIG];
+    sigset_t _signal_mask;
+    sigset_t _blocked_signals;
+
+    xx_impl::timer_heap _timers;
+    xx_impl::timer_stats _timer_stats;
+
+    xx_impl::post_queue _posts;
+
+    // Normal-priority events only wait behind high-priority ones once the
+    // loop has had any of the latter.
+    xx_impl::ready_queue<xx_impl::event_entry> _normal_ready;
+    xx_impl::ready_queue<xx_impl::event_entry> _low_ready;
+    std::size_t _low_priority_budget;
+    event_priority _next_priority;
+    bool _has_high_priority;
+
+    std::unique_ptr<xx_impl::timer_wheel<xx_impl::event_entry>> _wheel;
+    bool _is_wheel_enabled;
+    bool _is_wheel_ticking;
+
+    xx_impl::uring _uring;
+    xx_impl::path_table _paths;
+
+    xx_impl::instrument _instrument;
+
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    // Readiness injected for the next iteration, as (fd, revents) pairs.
+    std::vector<std::pair<int, int>> _injected;
+    std::vector<std::pair<int, int>> _injecting;
+#endif
+
+    event_handle listen_impl(int fd, xx_impl::io_func&& callback);
+    event_handle listen_impl(int fd, xx_impl::io_simple_func&& callback);
+    event_handle listen_impl(int fd, int events, xx_impl::io_mask_func&& callback);
+    event_handle listen_impl(int fd, int events, xx_impl::io_mask_simple_func&& callback);
+    event_handle signal_impl(int signum, xx_impl::io_func&& callback);
+    event_handle signal_impl(int signum, xx_impl::io_simple_func&& callback);
+    event_handle delay_impl(double after, double slack, xx_impl::delay_func&& callback);
+    event_handle delay_impl(double after, double slack, xx_impl::timer_simple_func&& callback);
+    event_handle repeat_impl(double rep, double slack, xx_impl::repeat_func&& callback);
+    event_handle repeat_impl(double rep, double slack, xx_impl::timer_simple_func&& callback);
+    event_handle delay_imm_impl(xx_impl::delay_func&& callback);
+    event_handle delay_imm_impl(xx_impl::timer_simple_func&& callback);
+    event_handle repeat_imm_impl(xx_impl::repeat_func&& callback);
+    event_handle repeat_imm_impl(xx_impl::timer_simple_func&& callback);
+    event_handle at_impl(double after, bool is_wall_clock, xx_impl::repeat_func&& callback);
+    event_handle at_impl(double after, bool is_wall_clock, xx_impl::timer_simple_func&& callback);
+    event_handle every_impl(double interval, double offset, xx_impl::repeat_func&& callback);
+    event_handle every_impl(double interval, double offset, xx_impl::timer_simple_func&& callback);
+    event_handle idle_impl(double budget, xx_impl::delay_func&& callback);
+    event_handle idle_impl(double budget, xx_impl::idle_simple_func&& callback);
+
+    event_handle watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_func&& callback);
+    event_handle watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_simple_func&& callback);
+    // Defined in event_loop-inotify.cpp.
+    void start_path(xx_impl::event_entry& entry, const char* path, std::uint32_t mask);
+    void stop_path(xx_impl::event_entry& entry) noexcept;
+    void read_paths();
+    void flush_paths();
+
+    template <typename R, typename P>
+    static double to_timeout(std::chrono::duration<R, P> timeout)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<double>>(timeout).count();
+        return seconds < 0 ? 0 : seconds;
+    }
+
+    template <typename F>
+    event_handle make_async(xx_impl::async_kind kind, int fd, const void* buffer, std::size_t size,
+                            double timeout, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::async_func, xx_impl::async_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return async_impl(kind, fd, const_cast<void*>(buffer), size, timeout, std::move(callback));
+    }
+
+    event_handle async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                            double timeout, xx_impl::async_func&& callback);
+    event_handle async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                            double timeout, xx_impl::async_simple_func&& callback);
+
+    void call_entry(xx_impl::event_entry& entry, int revents);
+    void dispatch(xx_impl::event_entry& entry, int revents);
+    void call_ready();
+    void stop_watcher(xx_impl::event_entry& entry) noexcept;
+    void cancel_entry(xx_impl::event_entry& entry) noexcept;
+
+    void assign_priority(xx_impl::event_entry& entry) noexcept
+    {
+        entry.priority = static_cast<signed char>(_next_priority);
+        entry.is_ready = false;
+        if (_next_priority == priority_high)
+            _has_high_priority = true;
+        _next_priority = priority_normal;
+    }
+
+    bool is_deferred(const xx_impl::event_entry& entry) const noexcept
+    {
+        return entry.priority < priority_normal
+            || (entry.priority == priority_normal && _has_high_priority);
+    }
+
+    void run_once();
+    void update_now() noexcept;
+
+    static xx_impl::epoll_io_watcher& io_watcher_of(xx_impl::event_entry& entry) noexcept
+    {
+        return xx_impl::is_async(entry) ? entry.async_watcher.io : entry.io_watcher;
+    }
+
+    void start_io(xx_impl::event_entry& entry, int fd, int events);
+    void stop_io(xx_impl::event_entry& entry) noexcept;
+    void add_io_interest(xx_impl::epoll_fd_state& state, int events, int delta) noexcept;
+    void update_fd(int fd);
+    void call_io(int fd, std::uint32_t epoll_events);
+
+    void start_signal(xx_impl::event_entry& entry, int signum);
+    void stop_signal(xx_impl::event_entry& entry) noexcept;
+    void update_signal_fd();
+    void call_signals();
+
+    void start_timer(xx_impl::event_entry& entry, double after, double slack);
+    void start_periodic(xx_impl::event_entry& entry, double interval, double offset);
+    void schedule_periodic(xx_impl::epoll_timer_watcher& watcher) noexcept;
+    double next_deadline() const noexcept;
+    void arm_timer_fd();
+    void call_timers();
+
+    void call_imms();
+    void call_idles();
+
+    void post_impl(xx_impl::post_func&& callback);
+    void post_impl(xx_impl::post_simple_func&& callback);
+    void wake_posts() noexcept;
+
+    // Defined in event_loop-forward.cpp, on top of the public interface.
+    event_group forward_impl(int src_fd, int dst_fd, const forward_options& options, xx_impl::forward_func&& callback);
+    event_group forward_impl(int src_fd, int dst_fd, const forward_options& options, xx_impl::forward_simple_func&& callback);
+
+    void start_async(xx_impl::event_entry& entry, xx_impl::async_kind kind, int fd, void* buffer,
+                     std::size_t size, double timeout);
+    void stop_async(xx_impl::event_entry& entry) noexcept;
+    void call_async(xx_impl::event_entry& entry);
+    void expire_async(event_handle handle);
+    void complete_async(event_handle user_data, int res);
+
+    void enable_timer_wheel_impl(double resolution);
+    xx_impl::event_entry& arm_wheel_timer(xx_impl::event_entry& entry, double interval);
+    void call_wheel();
+};
+
+}
+
+#endif
+
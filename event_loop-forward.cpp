@@ -0,0 +1,281 @@
+//{{{ Headers
+
+#include <algorithm>
+#include <cerrno>
+#include <memory>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "event_loop.hpp"
+
+//}}}
+
+namespace utils {
+
+//{{{ Forward state
+
+namespace
+{
+    bool is_regular_file(int fd)
+    {
+        struct stat st;
+        if (fstat(fd, &st) < 0)
+            throw std::system_error(errno, std::generic_category());
+        return S_ISREG(st.st_mode);
+    }
+
+    bool is_retryable(int err) noexcept
+    {
+        return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+    }
+
+    // Shared by the events driving a forward, and destroyed with the last of
+    // them.
+    struct forwarder
+    {
+        int src;
+        int dst;
+        // The internal pipe; both are -1 when sendfile() is used.
+        int pipe_r;
+        int pipe_w;
+
+        std::uint64_t limit;
+        std::uint64_t read;
+        std::uint64_t written;
+        std::size_t chunk;
+        // Bytes in the pipe which have not been written to dst yet.
+        std::size_t buffered;
+
+        bool is_src_done;
+        bool is_pipe_full;
+        bool is_finished;
+
+        event_group group;
+        // 0 for a side which is not watched, e.g. a regular file.
+        event_handle reader;
+        event_handle writer;
+        int reader_events;
+        int writer_events;
+
+        xx_impl::forward_func callback;
+
+        forwarder(int src, int dst, const forward_options& options, xx_impl::forward_func&& callback)
+            : src(src), dst(dst), pipe_r(-1), pipe_w(-1)
+            , limit(options.limit), read(0), written(0)
+            , chunk(std::max<std::size_t>(options.chunk_size, 1)), buffered(0)
+            , is_src_done(false), is_pipe_full(false), is_finished(false)
+            , group(0), reader(0), writer(0), reader_events(0), writer_events(0)
+            , callback(std::move(callback))
+        {}
+
+        ~forwarder()
+        {
+            if (pipe_r >= 0)
+            {
+                close(pipe_r);
+                close(pipe_w);
+            }
+        }
+
+        void open_pipe()
+        {
+            int fds[2];
+            if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+                throw std::system_error(errno, std::generic_category());
+            pipe_r = fds[0];
+            pipe_w = fds[1];
+
+            // Hold a whole chunk if allowed; otherwise fall back to the
+            // capacity the pipe already has.
+            int capacity = fcntl(pipe_w, F_SETPIPE_SZ, static_cast<int>(std::min<std::size_t>(chunk, 1 << 30)));
+            if (capacity < 0)
+                capacity = fcntl(pipe_w, F_GETPIPE_SZ);
+            if (capacity > 0)
+                chunk = std::min(chunk, static_cast<std::size_t>(capacity));
+        }
+
+        std::size_t next_size(std::size_t room) const noexcept
+        {
+            if (limit && limit - read < room)
+                return static_cast<std::size_t>(limit - read);
+            return room;
+        }
+
+        void finish(event_loop& loop, int error)
+        {
+            if (is_finished)
+                return;
+            is_finished = true;
+            loop.cancel_group(group);
+            callback(written, error, loop);
+        }
+
+        void update_interest(event_loop& loop)
+        {
+            if (is_finished)
+                return;
+
+            if (reader)
+            {
+                int events = (!is_src_done && !is_pipe_full && buffered < chunk) ? io_read : 0;
+                if (events != reader_events)
+                {
+                    reader_events = events;
+                    loop.modify(reader, events);
+                }
+            }
+            if (writer && pipe_r >= 0)
+            {
+                int events = buffered ? io_write : 0;
+                if (events != writer_events)
+                {
+                    writer_events = events;
+                    loop.modify(writer, events);
+                }
+            }
+        }
+
+        // splice() from the pipe into dst until either runs dry.
+        void drain(event_loop& loop)
+        {
+            while (buffered)
+            {
+                ssize_t n = splice(pipe_r, nullptr, dst, nullptr, buffered, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    if (is_retryable(errno))
+                        break;
+                    return finish(loop, errno);
+                }
+                buffered -= n;
+                written += n;
+                is_pipe_full = false;
+            }
+
+            if (is_src_done && !buffered)
+                return finish(loop, 0);
+            update_interest(loop);
+        }
+
+        // splice() from src into the pipe, then pass it on straight away.
+        void fill(event_loop& loop)
+        {
+            std::size_t size = next_size(chunk - buffered);
+            if (size)
+            {
+                ssize_t n = splice(src, nullptr, pipe_w, nullptr, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n < 0)
+                {
+                    if (!is_retryable(errno))
+                        return finish(loop, errno);
+                    // Either src has nothing after all, or the pipe ran out
+                    // of slots before bytes; wait for dst to take some.
+                    if (errno != EINTR && buffered)
+                        is_pipe_full = true;
+                }
+                else if (n == 0)
+                    is_src_done = true;
+                else
+                {
+                    buffered += n;
+                    read += n;
+                }
+            }
+            if (limit && read == limit)
+                is_src_done = true;
+
+            drain(loop);
+        }
+
+        // sendfile() the next chunk of a regular file into dst.
+        void send(event_loop& loop)
+        {
+            std::size_t size = next_size(chunk);
+            ssize_t n = size ? sendfile(dst, src, nullptr, size) : 0;
+            if (n < 0)
+            {
+                if (!is_retryable(errno))
+                    finish(loop, errno);
+                return;
+            }
+            read += n;
+            written += n;
+            if (n == 0 || (limit && written == limit))
+                finish(loop, 0);
+        }
+    };
+}
+
+//}}}
+
+//{{{ forward
+
+event_group event_loop::forward_impl(int src_fd, int dst_fd, const forward_options& options, xx_impl::forward_func&& callback)
+{
+    bool is_src_file = is_regular_file(src_fd);
+    bool is_dst_file = is_regular_file(dst_fd);
+
+    auto state = std::make_shared<forwarder>(src_fd, dst_fd, options, std::move(callback));
+    if (!is_src_file)
+        state->open_pipe();
+
+    unique_event_group group (*this, create_group());
+    state->group = group.get();
+
+    if (is_src_file)
+    {
+        // Regular files are always ready, so a file-to-file copy proceeds in
+        // chunks on the immediate queue instead.
+        if (is_dst_file)
+        {
+            state->writer = with_group(state->group).repeat([state](event_loop& loop, event_handle)
+            {
+                state->send(loop);
+            });
+        }
+        else
+        {
+            state->writer_events = io_write;
+            state->writer = with_group(state->group).listen(dst_fd, io_write, [state](int, int, event_loop& loop, event_handle)
+            {
+                state->send(loop);
+            });
+        }
+    }
+    else
+    {
+        state->reader_events = io_read;
+        state->reader = with_group(state->group).listen(src_fd, io_read, [state](int, int, event_loop& loop, event_handle)
+        {
+            state->fill(loop);
+        });
+        // A regular file takes everything at once in fill(), so only a
+        // pollable dst needs a watcher, which starts suspended.
+        if (!is_dst_file)
+        {
+            state->writer = with_group(state->group).listen(dst_fd, 0, [state](int, int, event_loop& loop, event_handle)
+            {
+                state->drain(loop);
+            });
+        }
+    }
+
+    return group.release();
+}
+
+event_group event_loop::forward_impl(int src_fd, int dst_fd, const forward_options& options, xx_impl::forward_simple_func&& callback)
+{
+    return forward_impl(src_fd, dst_fd, options, [callback](std::uint64_t bytes, int error, event_loop&)
+    {
+        callback(bytes, error);
+    });
+}
+
+//}}}
+
+}
+
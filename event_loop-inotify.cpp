@@ -0,0 +1,196 @@
+//{{{ Headers
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "event_loop.hpp"
+
+//}}}
+
+namespace utils {
+
+//{{{ path_table
+
+namespace xx_impl
+{
+    void path_table::coalesce(int wd, const char* name, std::uint32_t mask, std::uint32_t cookie)
+    {
+        std::string key (reinterpret_cast<const char*>(&wd), sizeof(wd));
+        key += name;
+
+        auto it = _index.find(key);
+        if (it != _index.end())
+        {
+            auto& r = pending[it->second];
+            r.mask |= mask;
+            r.cookie = cookie ? cookie : r.cookie;
+            ++ r.count;
+            return;
+        }
+
+        _index.emplace(std::move(key), pending.size());
+        record r = {wd, mask, cookie, 1, name};
+        pending.push_back(std::move(r));
+    }
+
+    std::vector<path_table::record> path_table::take() noexcept
+    {
+        std::vector<record> records;
+        records.swap(pending);
+        _index.clear();
+        return records;
+    }
+}
+
+//}}}
+
+//{{{ Watches
+
+// Reported to every event regardless of the mask it asked for.
+static constexpr std::uint32_t always_reported = IN_IGNORED | IN_Q_OVERFLOW | IN_UNMOUNT;
+
+void event_loop::start_path(xx_impl::event_entry& entry, const char* path, std::uint32_t mask)
+{
+    if (!_paths.fd)
+        _paths.fd.reset(posix::checked(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)));
+
+    // inotify has one watch per file, so the masks of all events on it are
+    // merged into the watch.
+    int wd = posix::checked(inotify_add_watch(_paths.fd.get(), path, mask | IN_MASK_ADD));
+    auto& watch = _paths.watches[wd];
+    if (watch.handles.empty())
+        watch.path = path;
+    watch.handles.push_back(entry.handle());
+    entry.path_watcher.wd = wd;
+    entry.path_watcher.mask = mask & IN_ALL_EVENTS;
+
+    if (!_paths.reader)
+        _paths.reader = listen(_paths.fd.get(), [this](int) { read_paths(); });
+}
+
+void event_loop::stop_path(xx_impl::event_entry& entry) noexcept
+{
+    auto wd = entry.path_watcher.wd;
+    auto it = _paths.watches.find(wd);
+    if (it == _paths.watches.end())
+        return;
+
+    auto& handles = it->second.handles;
+    handles.erase(std::remove(handles.begin(), handles.end(), entry.handle()), handles.end());
+    if (handles.empty())
+    {
+        inotify_rm_watch(_paths.fd.get(), wd);
+        _paths.watches.erase(it);
+    }
+    else
+    {
+        // Shrink the watch to what the remaining events ask for. If the path
+        // names another file by now, leave that one alone.
+        std::uint32_t mask = 0;
+        for (auto handle : handles)
+            if (auto other = _events.find(handle))
+                mask |= other->path_watcher.mask;
+        int new_wd = inotify_add_watch(_paths.fd.get(), it->second.path.c_str(), mask);
+        if (new_wd >= 0 && new_wd != wd && _paths.watches.find(new_wd) == _paths.watches.end())
+            inotify_rm_watch(_paths.fd.get(), new_wd);
+    }
+
+    // The reader would keep the loop running.
+    if (_paths.watches.empty())
+    {
+        cancel(_paths.reader);
+        cancel(_paths.flush_timer);
+        _paths.reader = 0;
+        _paths.flush_timer = 0;
+        _paths.take();
+    }
+}
+
+void event_loop::read_paths()
+{
+    // Room for at least 64 events with the longest names; a full buffer
+    // means there may be more.
+    constexpr std::size_t max_event_size = sizeof(struct inotify_event) + NAME_MAX + 1;
+    alignas(struct inotify_event) char buffer[64 * max_event_size];
+
+    ssize_t size;
+    do
+    {
+        size = read(_paths.fd.get(), buffer, sizeof(buffer));
+        if (size <= 0)
+            break;
+
+        for (auto p = buffer; p < buffer + size; )
+        {
+            auto event = reinterpret_cast<const struct inotify_event*>(p);
+            _paths.coalesce(event->wd, event->len ? event->name : "", event->mask, event->cookie);
+            p += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    while (static_cast<std::size_t>(size) > sizeof(buffer) - max_event_size);
+
+    if (_paths.pending.empty())
+        return;
+
+    if (_paths.window <= 0)
+        flush_paths();
+    else if (!_paths.flush_timer)
+    {
+        _paths.flush_timer = delay(std::chrono::duration<double>(_paths.window), [this]
+        {
+            _paths.flush_timer = 0;
+            flush_paths();
+        });
+    }
+}
+
+void event_loop::flush_paths()
+{
+    for (auto& r : _paths.take())
+    {
+        std::vector<event_handle> targets;
+        if (r.wd < 0)
+        {
+            // The queue overflowed, which concerns everyone.
+            for (auto& w : _paths.watches)
+                targets.insert(targets.end(), w.second.handles.begin(), w.second.handles.end());
+        }
+        else
+        {
+            auto it = _paths.watches.find(r.wd);
+            if (it == _paths.watches.end())
+                continue;
+            targets = it->second.handles;
+        }
+
+        path_event event;
+        event.cookie = r.cookie;
+        event.count = r.count;
+        event.name = r.name.c_str();
+
+        for (auto handle : targets)
+        {
+            auto entry = _events.find(handle);
+            if (!entry)
+                continue;
+            event.mask = r.mask & (entry->path_watcher.mask | always_reported | IN_ISDIR);
+            if (!(event.mask & ~IN_ISDIR))
+                continue;
+            _paths.current = &event;
+            call_entry(*entry, 0);
+        }
+
+        // The kernel has dropped the watch, e.g. because the file is gone.
+        if (r.mask & IN_IGNORED)
+            for (auto handle : targets)
+                cancel(handle);
+    }
+    _paths.current = nullptr;
+}
+
+//}}}
+
+}
+
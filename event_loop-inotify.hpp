@@ -0,0 +1,77 @@
+#ifndef EVENT_LOOP_INOTIFY_HPP_T3KD8VQ1XRM
+#define EVENT_LOOP_INOTIFY_HPP_T3KD8VQ1XRM
+
+// Filesystem watches shared by all event_loop backends. A loop owns one
+// inotify instance, created with the first watch_path() event; the backend
+// only stores the entry, and event_loop-inotify.cpp does the rest through
+// the loop's own listen() and delay().
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "event_loop-common.hpp"
+#include "ext/posix.hpp"
+
+namespace utils {
+
+struct path_event
+{
+    std::uint32_t mask;
+    std::uint32_t cookie;
+    std::uint32_t count;
+    const char* name;
+};
+
+namespace xx_impl
+{
+    struct inotify_watcher
+    {
+        int wd;
+        std::uint32_t mask;
+    };
+
+    class path_table
+    {
+    public:
+        // An inotify watch, shared by every event on the same file.
+        struct watch
+        {
+            std::string path;
+            std::vector<event_handle> handles;
+        };
+
+        // The events of one path since the last delivery, merged.
+        struct record
+        {
+            int wd;
+            std::uint32_t mask;
+            std::uint32_t cookie;
+            std::uint32_t count;
+            std::string name;
+        };
+
+        posix::unique_fd fd;
+        event_handle reader;
+        event_handle flush_timer;
+        double window;
+        std::unordered_map<int, watch> watches;
+        std::vector<record> pending;
+        // The event being delivered by call_entry().
+        const path_event* current;
+
+        path_table() noexcept : reader(0), flush_timer(0), window(0), current(nullptr) {}
+
+        void coalesce(int wd, const char* name, std::uint32_t mask, std::uint32_t cookie);
+        std::vector<record> take() noexcept;
+
+    private:
+        std::unordered_map<std::string, std::size_t> _index;
+    };
+}
+
+}
+
+#endif
+
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <stdexcept>
+#include "event_loop-instrument.hpp"
+
+namespace utils {
+
+//{{{ Snapshot
+
+double event_loop_histogram::percentile(double p) const noexcept
+{
+    if (count == 0)
+        return 0;
+
+    auto rank = static_cast<std::uint64_t>(p / 100 * count + 0.5);
+    if (rank == 0)
+        rank = 1;
+
+    std::uint64_t seen = 0;
+    for (auto& bucket : buckets)
+    {
+        seen += bucket.second;
+        if (seen >= rank)
+            return std::min(bucket.first, max);
+    }
+    return max;
+}
+
+void event_loop_snapshot::dump(std::ostream& stream) const
+{
+    if (!enabled)
+    {
+        stream << "event_loop: instrumentation disabled (define UTILS_EVENT_LOOP_INSTRUMENT)\n";
+        return;
+    }
+
+    auto flags = stream.flags();
+    auto precision = stream.precision();
+    stream << std::fixed << std::setprecision(1);
+
+    stream << "event_loop: " << iterations << " iterations, "
+           << live_events << " live events, " << pending_imms << " pending immediates, "
+           << timer_wakeups << " timer wakeups, " << coalesced_timers << " coalesced timers\n";
+
+    auto row = [&](const std::string& type, const std::string& tag, const event_loop_histogram& h)
+    {
+        stream << "  " << std::left << std::setw(20) << type << std::setw(24) << tag << std::right
+               << std::setw(10) << h.count
+               << std::setw(12) << h.mean
+               << std::setw(12) << h.percentile(50)
+               << std::setw(12) << h.percentile(99)
+               << std::setw(12) << h.max << '\n';
+    };
+
+    stream << "  " << std::left << std::setw(20) << "type" << std::setw(24) << "tag" << std::right
+           << std::setw(10) << "count"
+           << std::setw(12) << "mean"
+           << std::setw(12) << "p50"
+           << std::setw(12) << "p99"
+           << std::setw(12) << "max" << '\n';
+
+    row("(iteration busy ns)", "", iteration_busy);
+    row("(dispatches/iter)", "", iteration_dispatches);
+    row("(imm depth)", "", imm_depth);
+    for (auto& cb : callbacks)
+        row(cb.type, cb.tag, cb.runtime);
+
+    stream.flags(flags);
+    stream.precision(precision);
+}
+
+//}}}
+
+namespace xx_impl
+{
+    const char* event_type_name(event_type type) noexcept
+    {
+        switch (type)
+        {
+            case event_type::io: return "io";
+            case event_type::io_simple: return "io_simple";
+            case event_type::io_mask: return "io_mask";
+            case event_type::io_mask_simple: return "io_mask_simple";
+            case event_type::signal: return "signal";
+            case event_type::signal_simple: return "signal_simple";
+            case event_type::delay: return "delay";
+            case event_type::delay_simple: return "delay_simple";
+            case event_type::delay_imm: return "delay_imm";
+            case event_type::delay_imm_simple: return "delay_imm_simple";
+            case event_type::repeat: return "repeat";
+            case event_type::repeat_simple: return "repeat_simple";
+            case event_type::repeat_imm: return "repeat_imm";
+            case event_type::repeat_imm_simple: return "repeat_imm_simple";
+            case event_type::delay_wheel: return "delay_wheel";
+            case event_type::delay_wheel_simple: return "delay_wheel_simple";
+            case event_type::repeat_wheel: return "repeat_wheel";
+            case event_type::repeat_wheel_simple: return "repeat_wheel_simple";
+            case event_type::at: return "at";
+            case event_type::at_simple: return "at_simple";
+            case event_type::periodic: return "periodic";
+            case event_type::periodic_simple: return "periodic_simple";
+            case event_type::async: return "async";
+            case event_type::async_simple: return "async_simple";
+            case event_type::idle: return "idle";
+            case event_type::idle_simple: return "idle_simple";
+            case event_type::path: return "path";
+            case event_type::path_simple: return "path_simple";
+            default: return "none";
+        }
+    }
+
+    //{{{ log_histogram
+
+    void log_histogram::reset() noexcept
+    {
+        std::fill(std::begin(_counts), std::end(_counts), 0);
+        _count = 0;
+        _sum = 0;
+        _min = std::numeric_limits<std::uint64_t>::max();
+        _max = 0;
+    }
+
+    event_loop_histogram log_histogram::export_to(double scale) const
+    {
+        event_loop_histogram result;
+        result.count = _count;
+        if (_count == 0)
+            return result;
+
+        result.min = _min * scale;
+        result.max = _max * scale;
+        result.mean = static_cast<double>(_sum) / _count * scale;
+        for (unsigned i = 0; i < bucket_count; ++ i)
+            if (_counts[i])
+                result.buckets.emplace_back(upper_bound_of(i) * scale, _counts[i]);
+        return result;
+    }
+
+    //}}}
+
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+
+    //{{{ instrument
+
+    // Slot 0 collects the events registered after all slots are taken.
+    static constexpr std::size_t max_slots = std::numeric_limits<std::uint16_t>::max();
+
+    instrument::instrument()
+        : _next_tag(nullptr),
+          _iteration_start(0),
+          _dispatches(0),
+          _iterations(0),
+          _epoch_ticks(now()),
+          _epoch_time(std::chrono::steady_clock::now())
+    {
+        _slots.emplace_back(new slot {event_type::none, "(untracked)", log_histogram()});
+    }
+
+    void instrument::assign(event_entry_base& entry)
+    {
+        auto tag = _next_tag;
+        _next_tag = nullptr;
+
+        auto key = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(tag)) << 6
+                 | static_cast<std::uint64_t>(entry.type);
+        auto it = _slot_index.find(key);
+        if (it != _slot_index.end())
+        {
+            entry.stat_slot = it->second;
+            return;
+        }
+
+        if (_slots.size() >= max_slots)
+        {
+            entry.stat_slot = 0;
+            return;
+        }
+
+        auto index = static_cast<std::uint16_t>(_slots.size());
+        _slots.emplace_back(new slot {entry.type, tag, log_histogram()});
+        _slot_index.emplace(key, index);
+        entry.stat_slot = index;
+    }
+
+    double instrument::nanoseconds_per_tick() const
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        // Calibrate the TSC against the steady clock over the lifetime of the
+        // loop, waiting a little if the loop is too young to tell.
+        using namespace std::chrono;
+        auto elapsed = steady_clock::now() - _epoch_time;
+        while (elapsed < milliseconds(1))
+            elapsed = steady_clock::now() - _epoch_time;
+        auto ticks = now() - _epoch_ticks;
+        return duration_cast<duration<double, std::nano>>(elapsed).count() / ticks;
+#else
+        return 1;
+#endif
+    }
+
+    event_loop_snapshot instrument::snapshot(std::size_t live_events, std::size_t pending_imms) const
+    {
+        auto scale = nanoseconds_per_tick();
+
+        event_loop_snapshot result;
+        result.enabled = true;
+        result.iterations = _iterations;
+        result.live_events = live_events;
+        result.pending_imms = pending_imms;
+        result.iteration_busy = _iteration_busy.export_to(scale);
+        result.iteration_dispatches = _iteration_dispatches.export_to(1);
+        result.imm_depth = _imm_depth.export_to(1);
+
+        for (auto& s : _slots)
+        {
+            auto runtime = s->runtime.export_to(scale);
+            if (runtime.count == 0)
+                continue;
+            event_loop_snapshot::callback_stats stats;
+            stats.type = event_type_name(s->type);
+            stats.tag = s->tag ? s->tag : "";
+            stats.runtime = std::move(runtime);
+            result.callbacks.push_back(std::move(stats));
+        }
+
+        return result;
+    }
+
+    void instrument::reset() noexcept
+    {
+        for (auto& s : _slots)
+            s->runtime.reset();
+        _iteration_busy.reset();
+        _iteration_dispatches.reset();
+        _imm_depth.reset();
+        _iterations = 0;
+    }
+
+    //}}}
+
+#endif
+}
+
+}
+
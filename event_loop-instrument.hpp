@@ -0,0 +1,243 @@
+
+#ifndef EVENT_LOOP_INSTRUMENT_HPP_E5LC1NW8TPA
+#define EVENT_LOOP_INSTRUMENT_HPP_E5LC1NW8TPA
+
+// Opt-in instrumentation of event_loop dispatch. Define
+// UTILS_EVENT_LOOP_INSTRUMENT consistently in every translation unit to
+// enable it; otherwise xx_impl::instrument is an empty class whose members
+// compile to nothing.
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+#include "event_loop-common.hpp"
+
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+#include <chrono>
+#include <unordered_map>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+namespace utils {
+
+struct event_loop_histogram
+{
+    std::uint64_t count;
+    double min;
+    double max;
+    double mean;
+
+    // Non-empty buckets as (upper bound, count), in increasing order.
+    std::vector<std::pair<double, std::uint64_t>> buckets;
+
+    event_loop_histogram() noexcept : count(0), min(0), max(0), mean(0) {}
+
+    double percentile(double p) const noexcept;
+};
+
+struct event_loop_snapshot
+{
+    struct callback_stats
+    {
+        std::string type;
+        std::string tag;
+        event_loop_histogram runtime;
+    };
+
+    bool enabled;
+    std::uint64_t iterations;
+    std::size_t live_events;
+    std::size_t pending_imms;
+    std::uint64_t timer_wakeups;
+    std::uint64_t coalesced_timers;
+
+    std::vector<callback_stats> callbacks;
+    event_loop_histogram iteration_busy;
+    event_loop_histogram iteration_dispatches;
+    event_loop_histogram imm_depth;
+
+    event_loop_snapshot() noexcept
+        : enabled(false), iterations(0), live_events(0), pending_imms(0),
+          timer_wakeups(0), coalesced_timers(0)
+    {}
+
+    void dump(std::ostream& stream) const;
+};
+
+namespace xx_impl
+{
+    const char* event_type_name(event_type type) noexcept;
+
+    // A log-linear histogram in the spirit of HdrHistogram: values below 32
+    // are exact, and every power of two above is split into 32 buckets, so
+    // the relative error stays around 3% across the whole range. Recording is
+    // a count-leading-zeros and an increment.
+    class log_histogram
+    {
+    public:
+        static constexpr unsigned sub_bits = 5;
+        static constexpr unsigned sub_count = 1u << sub_bits;
+        static constexpr unsigned max_exponent = 42;
+        static constexpr unsigned bucket_count = (max_exponent - sub_bits + 2) * sub_count;
+
+        log_histogram() noexcept { reset(); }
+
+        void record(std::uint64_t value) noexcept
+        {
+            ++ _counts[index_of(value)];
+            ++ _count;
+            _sum += value;
+            if (value < _min)
+                _min = value;
+            if (value > _max)
+                _max = value;
+        }
+
+        void reset() noexcept;
+
+        // Convert to the public form, multiplying values by *scale*.
+        event_loop_histogram export_to(double scale) const;
+
+        static unsigned index_of(std::uint64_t value) noexcept
+        {
+            if (value < sub_count)
+                return static_cast<unsigned>(value);
+            unsigned exponent = 63 - __builtin_clzll(value);
+            if (exponent > max_exponent)
+                return bucket_count - 1;
+            unsigned shift = exponent - sub_bits;
+            return (shift + 1) * sub_count + static_cast<unsigned>(value >> shift) - sub_count;
+        }
+
+        static std::uint64_t upper_bound_of(unsigned index) noexcept
+        {
+            if (index < sub_count)
+                return index;
+            unsigned shift = index / sub_count - 1;
+            std::uint64_t mantissa = index % sub_count + sub_count;
+            return ((mantissa + 1) << shift) - 1;
+        }
+
+    private:
+        std::uint64_t _counts[bucket_count];
+        std::uint64_t _count;
+        std::uint64_t _sum;
+        std::uint64_t _min;
+        std::uint64_t _max;
+    };
+
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+
+    class instrument
+    {
+    public:
+        typedef std::uint64_t stamp;
+
+        instrument();
+
+        // Time stamps are TSC cycles where available, which are converted to
+        // nanoseconds when a snapshot is taken.
+        static stamp now() noexcept
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        void tag_next(const char* tag) noexcept { _next_tag = tag; }
+
+        // Give a newly registered entry the histogram of its type and tag.
+        void assign(event_entry_base& entry);
+
+        void record_call(const event_entry_base& entry, stamp start) noexcept
+        {
+            _slots[entry.stat_slot]->runtime.record(now() - start);
+            ++ _dispatches;
+        }
+
+        // Called when the loop wakes up from polling, and right before it
+        // polls again.
+        void iteration_begin() noexcept
+        {
+            _iteration_start = now();
+            _dispatches = 0;
+        }
+
+        void iteration_end(std::size_t pending_imms) noexcept
+        {
+            if (!_iteration_start)
+                return;
+            _iteration_busy.record(now() - _iteration_start);
+            _iteration_dispatches.record(_dispatches);
+            _imm_depth.record(pending_imms);
+            _iteration_start = 0;
+            ++ _iterations;
+        }
+
+        event_loop_snapshot snapshot(std::size_t live_events, std::size_t pending_imms) const;
+        void reset() noexcept;
+
+    private:
+        struct slot
+        {
+            event_type type;
+            const char* tag;
+            log_histogram runtime;
+        };
+
+        std::vector<std::unique_ptr<slot>> _slots;
+        std::unordered_map<std::uint64_t, std::uint16_t> _slot_index;
+        const char* _next_tag;
+
+        stamp _iteration_start;
+        std::uint64_t _dispatches;
+        std::uint64_t _iterations;
+        log_histogram _iteration_busy;
+        log_histogram _iteration_dispatches;
+        log_histogram _imm_depth;
+
+        stamp _epoch_ticks;
+        std::chrono::steady_clock::time_point _epoch_time;
+
+        double nanoseconds_per_tick() const;
+    };
+
+#else
+
+    class instrument
+    {
+    public:
+        typedef std::uint64_t stamp;
+
+        static constexpr stamp now() noexcept { return 0; }
+        void tag_next(const char*) noexcept {}
+        void assign(event_entry_base&) noexcept {}
+        void record_call(const event_entry_base&, stamp) noexcept {}
+        void iteration_begin() noexcept {}
+        void iteration_end(std::size_t) noexcept {}
+        void reset() noexcept {}
+
+        event_loop_snapshot snapshot(std::size_t live_events, std::size_t pending_imms) const
+        {
+            event_loop_snapshot result;
+            result.live_events = live_events;
+            result.pending_imms = pending_imms;
+            return result;
+        }
+    };
+
+#endif
+}
+
+}
+
+#endif
+
@@ -1,5 +1,7 @@
+#include <cerrno>
+#include <cmath>
 #include <cstdio>
-#include <algorithm>
+#include <stdexcept>
 #include <pthread.h>
 #include "event_loop.hpp"
 
@@ -7,118 +9,29 @@
 
 namespace utils {
 
-//{{{ Structors of xx_impl::entry
-
-namespace xx_impl
-{
-    event_entry::event_entry() {}
-
-#define PERFORM_ON_FUNCS_I9X9CQ21RH(MACRO) \
-    switch (type) \
-    { \
-        case event_type::io: \
-        case event_type::signal: \
-            MACRO(io_); \
-            break; \
-        \
-        case event_type::io_simple: \
-        case event_type::signal_simple: \
-            MACRO(io_simple_); \
-            break; \
-        \
-        case event_type::delay: \
-        case event_type::delay_imm: \
-            MACRO(delay_); \
-            break; \
-        \
-        case event_type::repeat: \
-        case event_type::repeat_imm: \
-            MACRO(repeat_); \
-            break; \
-        \
-        case event_type::delay_simple: \
-        case event_type::delay_imm_simple: \
-        case event_type::repeat_simple: \
-        case event_type::repeat_imm_simple: \
-            MACRO(timer_simple_); \
-            break; \
-        \
-        default: \
-            break; \
-    }
-
-#define DESTROY_FUNC_OREMUDH6SC(Prefix) \
-    Prefix##callback.~Prefix##func()
-
-#define MOVE_FUNC_LTPS9ZCP03S(Prefix) \
-    new(&Prefix##callback) Prefix##func(std::move(other.Prefix##callback))
-
-
-    event_entry::~event_entry()
-    {
-        PERFORM_ON_FUNCS_I9X9CQ21RH(DESTROY_FUNC_OREMUDH6SC)
-    }
-
-    event_entry::event_entry(event_entry&& other)
-        : type(other.type)
-    {
-        PERFORM_ON_FUNCS_I9X9CQ21RH(MOVE_FUNC_LTPS9ZCP03S)
-
-        switch (type)
-        {
-            case event_type::io:
-            case event_type::io_simple:
-                io_watcher = std::move(other.io_watcher);
-                break;
-
-            case event_type::signal:
-            case event_type::signal_simple:
-                signal_watcher = std::move(other.signal_watcher);
-                break;
-
-            case event_type::delay:
-            case event_type::delay_simple:
-            case event_type::repeat:
-            case event_type::repeat_simple:
-                timer_watcher = std::move(other.timer_watcher);
-                break;
-
-            default:
-                break;
-        }
-    }
-}
-
-//}}}
+static_assert(int(io_read) == int(EV_READ) && int(io_write) == int(EV_WRITE),
+              "utils::io_events must match the libev flags");
 
 //{{{ Event registration.
 
-namespace xx_impl
-{
-    static constexpr int watcher_type_io = 1;
-    static constexpr int watcher_type_signal = 2;
-    static constexpr int watcher_type_timer = 3;
-}
-
 #define STORE_EVENT_EEBHGKGNTWN(EntryType, CallbackType) \
-    auto handle = _event_counter ++; \
-    \
-    xx_impl::event_entry entry; \
+    auto& entry = _events.allocate(); \
     new(&entry.CallbackType##_callback) xx_impl::CallbackType##_func(std::move(callback)); \
     entry.type = xx_impl::event_type::EntryType; \
-    \
-    _events.push_front(std::move(entry)); \
-    _map.emplace(handle, _events.begin())
+    _instrument.assign(entry); \
+    assign_priority(entry); \
+    _groups.join(_events, entry); \
+    auto handle = entry.handle()
 
 #define START_LIBEV_EVENT_4LEMEBLRCSS(LibEVType, ...) \
-    auto watcher = &(_events.front().LibEVType##_watcher); \
-    ev_##LibEVType##_init(watcher, [](struct ev_loop* loop, ev_##LibEVType* watcher, int) \
+    auto watcher = &(entry.LibEVType##_watcher); \
+    ev_##LibEVType##_init(watcher, [](struct ev_loop* loop, ev_##LibEVType* watcher, int revents) \
     { \
         auto this_ = static_cast<event_loop*>(ev_userdata(loop)); \
-        auto handle = reinterpret_cast<event_handle>(watcher->data); \
-        this_->call(handle, watcher, xx_impl::watcher_type_##LibEVType); \
+        this_->dispatch(*static_cast<xx_impl::event_entry*>(watcher->data), revents); \
     }, __VA_ARGS__); \
-    watcher->data = reinterpret_cast<void*>(handle); \
+    watcher->data = &entry; \
+    ev_set_priority(watcher, entry.priority); \
     ev_##LibEVType##_start(_loop, watcher)
 
 event_handle event_loop::listen_impl(int fd, xx_impl::io_func&& callback)
@@ -135,6 +48,20 @@ event_handle event_loop::listen_impl(int fd, xx_impl::io_simple_func&& callback)
     return handle;
 }
 
+event_handle event_loop::listen_impl(int fd, int events, xx_impl::io_mask_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(io_mask, io_mask);
+    START_LIBEV_EVENT_4LEMEBLRCSS(io, fd, events & io_read_write);
+    return handle;
+}
+
+event_handle event_loop::listen_impl(int fd, int events, xx_impl::io_mask_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(io_mask_simple, io_mask_simple);
+    START_LIBEV_EVENT_4LEMEBLRCSS(io, fd, events & io_read_write);
+    return handle;
+}
+
 event_handle event_loop::signal_impl(int signum, xx_impl::io_func&& callback)
 {
     STORE_EVENT_EEBHGKGNTWN(signal, io);
@@ -149,176 +76,448 @@ event_handle event_loop::signal_impl(int signum, xx_impl::io_simple_func&& callb
     return handle;
 }
 
-event_handle event_loop::delay_impl(ev_tstamp after, xx_impl::delay_func&& callback)
+event_handle event_loop::delay_impl(ev_tstamp after, ev_tstamp slack, xx_impl::delay_func&& callback)
 {
+    if (_is_wheel_enabled)
+    {
+        STORE_EVENT_EEBHGKGNTWN(delay_wheel, delay);
+        arm_wheel_timer(entry, after);
+        return handle;
+    }
+
     STORE_EVENT_EEBHGKGNTWN(delay, delay);
-    START_LIBEV_EVENT_4LEMEBLRCSS(timer, after, after);
+    start_timer(entry, after, slack);
     return handle;
 }
 
-event_handle event_loop::delay_impl(ev_tstamp after, xx_impl::timer_simple_func&& callback)
+event_handle event_loop::delay_impl(ev_tstamp after, ev_tstamp slack, xx_impl::timer_simple_func&& callback)
 {
+    if (_is_wheel_enabled)
+    {
+        STORE_EVENT_EEBHGKGNTWN(delay_wheel_simple, timer_simple);
+        arm_wheel_timer(entry, after);
+        return handle;
+    }
+
     STORE_EVENT_EEBHGKGNTWN(delay_simple, timer_simple);
-    START_LIBEV_EVENT_4LEMEBLRCSS(timer, after, after);
+    start_timer(entry, after, slack);
     return handle;
 }
 
-event_handle event_loop::repeat_impl(ev_tstamp rep, xx_impl::repeat_func&& callback)
+event_handle event_loop::repeat_impl(ev_tstamp rep, ev_tstamp slack, xx_impl::repeat_func&& callback)
 {
+    if (_is_wheel_enabled)
+    {
+        STORE_EVENT_EEBHGKGNTWN(repeat_wheel, repeat);
+        arm_wheel_timer(entry, rep);
+        return handle;
+    }
+
     STORE_EVENT_EEBHGKGNTWN(repeat, repeat);
-    START_LIBEV_EVENT_4LEMEBLRCSS(timer, rep, rep);
+    start_timer(entry, rep, slack);
     return handle;
 }
 
-event_handle event_loop::repeat_impl(ev_tstamp rep, xx_impl::timer_simple_func&& callback)
+event_handle event_loop::repeat_impl(ev_tstamp rep, ev_tstamp slack, xx_impl::timer_simple_func&& callback)
 {
+    if (_is_wheel_enabled)
+    {
+        STORE_EVENT_EEBHGKGNTWN(repeat_wheel_simple, timer_simple);
+        arm_wheel_timer(entry, rep);
+        return handle;
+    }
+
     STORE_EVENT_EEBHGKGNTWN(repeat_simple, timer_simple);
-    START_LIBEV_EVENT_4LEMEBLRCSS(timer, rep, rep);
+    start_timer(entry, rep, slack);
+    return handle;
+}
+
+event_handle event_loop::at_impl(ev_tstamp after, bool is_wall_clock, xx_impl::repeat_func&& callback)
+{
+    if (is_wall_clock)
+    {
+        // An absolute periodic follows changes of the wall clock.
+        STORE_EVENT_EEBHGKGNTWN(periodic, repeat);
+        START_LIBEV_EVENT_4LEMEBLRCSS(periodic, ev_time() + after, 0., nullptr);
+        return handle;
+    }
+
+    STORE_EVENT_EEBHGKGNTWN(at, repeat);
+    start_deadline(entry, after);
+    return handle;
+}
+
+event_handle event_loop::at_impl(ev_tstamp after, bool is_wall_clock, xx_impl::timer_simple_func&& callback)
+{
+    if (is_wall_clock)
+    {
+        STORE_EVENT_EEBHGKGNTWN(periodic_simple, timer_simple);
+        START_LIBEV_EVENT_4LEMEBLRCSS(periodic, ev_time() + after, 0., nullptr);
+        return handle;
+    }
+
+    STORE_EVENT_EEBHGKGNTWN(at_simple, timer_simple);
+    start_deadline(entry, after);
+    return handle;
+}
+
+event_handle event_loop::every_impl(ev_tstamp interval, ev_tstamp offset, xx_impl::repeat_func&& callback)
+{
+    if (!(interval > 0))
+        throw std::invalid_argument("utils::event_loop: periodic interval must be positive");
+    STORE_EVENT_EEBHGKGNTWN(periodic, repeat);
+    START_LIBEV_EVENT_4LEMEBLRCSS(periodic, std::fmod(offset, interval), interval, nullptr);
+    return handle;
+}
+
+event_handle event_loop::every_impl(ev_tstamp interval, ev_tstamp offset, xx_impl::timer_simple_func&& callback)
+{
+    if (!(interval > 0))
+        throw std::invalid_argument("utils::event_loop: periodic interval must be positive");
+    STORE_EVENT_EEBHGKGNTWN(periodic_simple, timer_simple);
+    START_LIBEV_EVENT_4LEMEBLRCSS(periodic, std::fmod(offset, interval), interval, nullptr);
     return handle;
 }
 
 #undef START_LIBEV_EVENT_4LEMEBLRCSS
 
+event_handle event_loop::watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(path, path);
+    try
+    {
+        start_path(entry, path, mask);
+    }
+    catch (...)
+    {
+        _groups.leave(_events, entry);
+        _events.retire(entry);
+        throw;
+    }
+    return handle;
+}
+
+event_handle event_loop::watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(path_simple, path_simple);
+    try
+    {
+        start_path(entry, path, mask);
+    }
+    catch (...)
+    {
+        _groups.leave(_events, entry);
+        _events.retire(entry);
+        throw;
+    }
+    return handle;
+}
+
 event_handle event_loop::delay_imm_impl(xx_impl::delay_func&& callback)
 {
     STORE_EVENT_EEBHGKGNTWN(delay_imm, delay);
-    start_imm_watcher();
+    start_imm_watcher(entry);
     return handle;
 }
 
 event_handle event_loop::delay_imm_impl(xx_impl::timer_simple_func&& callback)
 {
     STORE_EVENT_EEBHGKGNTWN(delay_imm_simple, timer_simple);
-    start_imm_watcher();
+    start_imm_watcher(entry);
     return handle;
 }
 
 event_handle event_loop::repeat_imm_impl(xx_impl::repeat_func&& callback)
 {
     STORE_EVENT_EEBHGKGNTWN(repeat_imm, repeat);
-    start_imm_watcher();
+    start_imm_watcher(entry);
     return handle;
 }
 
 event_handle event_loop::repeat_imm_impl(xx_impl::timer_simple_func&& callback)
 {
     STORE_EVENT_EEBHGKGNTWN(repeat_imm_simple, timer_simple);
-    start_imm_watcher();
+    start_imm_watcher(entry);
     return handle;
 }
 
+event_handle event_loop::idle_impl(ev_tstamp budget, xx_impl::delay_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(idle, delay);
+    entry.idle_task.budget = budget;
+    start_idle_watcher(entry);
+    return handle;
+}
+
+event_handle event_loop::idle_impl(ev_tstamp budget, xx_impl::idle_simple_func&& callback)
+{
+    STORE_EVENT_EEBHGKGNTWN(idle_simple, idle_simple);
+    entry.idle_task.budget = budget;
+    start_idle_watcher(entry);
+    return handle;
+}
+
+#define START_ASYNC_P0Y4GN8JWQE(EntryType, CallbackType) \
+    STORE_EVENT_EEBHGKGNTWN(EntryType, CallbackType); \
+    try \
+    { \
+        start_async(entry, kind, fd, buffer, size, timeout); \
+    } \
+    catch (...) \
+    { \
+        _groups.leave(_events, entry); \
+        _events.retire(entry); \
+        throw; \
+    } \
+    return handle
+
+event_handle event_loop::async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                                    ev_tstamp timeout, xx_impl::async_func&& callback)
+{
+    START_ASYNC_P0Y4GN8JWQE(async, async);
+}
+
+event_handle event_loop::async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                                    ev_tstamp timeout, xx_impl::async_simple_func&& callback)
+{
+    START_ASYNC_P0Y4GN8JWQE(async_simple, async_simple);
+}
+
+#undef START_ASYNC_P0Y4GN8JWQE
 #undef STORE_EVENT_EEBHGKGNTWN
 
 //}}}
 
 //{{{ Invocation
 
-void event_loop::call(event_handle handle, void* watcher, int watcher_type)
+void event_loop::call_entry(xx_impl::event_entry& entry, int revents)
 {
-    auto map_it = _map.find(handle);
-    if (map_it != _map.end())
-    {
-        call_entry(handle, map_it);
-        return;
-    }
+    auto handle = entry.handle();
+    auto type = entry.type;
+    bool keep = true;
+    auto start = _instrument.now();
 
-    switch (watcher_type)
+    entry.is_calling = true;
+    switch (type)
     {
-        case xx_impl::watcher_type_io:
-            ev_io_stop(_loop, static_cast<ev_io*>(watcher));
+        case xx_impl::event_type::io:
+            entry.io_callback(entry.io_watcher.fd, *this, handle);
             break;
 
-        case xx_impl::watcher_type_signal:
-            ev_signal_stop(_loop, static_cast<ev_signal*>(watcher));
+        case xx_impl::event_type::signal:
+            entry.io_callback(entry.signal_watcher.signum, *this, handle);
             break;
 
-        case xx_impl::watcher_type_timer:
-            ev_timer_stop(_loop, static_cast<ev_timer*>(watcher));
+        case xx_impl::event_type::io_simple:
+            entry.io_simple_callback(entry.io_watcher.fd);
             break;
 
-        default:
+        case xx_impl::event_type::signal_simple:
+            entry.io_simple_callback(entry.signal_watcher.signum);
             break;
-    }
-}
-
-void event_loop::call_entry(event_handle handle, decltype(_map.begin()) map_it)
-{
-    auto& entry = *(map_it->second);
-    switch (entry.type)
-    {
-        case xx_impl::event_type::io:
-        case xx_impl::event_type::signal:
-        {
-            int param;
-            if (entry.type == xx_impl::event_type::io)
-                param = entry.io_watcher.fd;
-            else
-                param = entry.signal_watcher.signum;
 
-            entry.io_callback(param, *this, handle);
+        case xx_impl::event_type::io_mask:
+            entry.io_mask_callback(entry.io_watcher.fd, revents & io_read_write, *this, handle);
             break;
-        }
-
-        case xx_impl::event_type::io_simple:
-        case xx_impl::event_type::signal_simple:
-        {
-            int param;
-            if (entry.type == xx_impl::event_type::io_simple)
-                param = entry.io_watcher.fd;
-            else
-                param = entry.signal_watcher.signum;
 
-            entry.io_simple_callback(param);
+        case xx_impl::event_type::io_mask_simple:
+            entry.io_mask_simple_callback(entry.io_watcher.fd, revents & io_read_write);
             break;
-        }
 
         case xx_impl::event_type::delay:
         case xx_impl::event_type::delay_imm:
-        {
-            bool keep = false;
+        case xx_impl::event_type::delay_wheel:
+            keep = false;
             entry.delay_callback(keep, *this, handle);
-            if (keep)
-                break;
-            else if (entry.type == xx_impl::event_type::delay)
-                goto erase_delay_handle;
-            else
-                goto erase_delay_imm_handle;
-        }
-
-        case xx_impl::event_type::delay_simple:
-            entry.timer_simple_callback();
-    erase_delay_handle:
-            if (_map.find(handle) == map_it)
-            {
-                ev_timer_stop(_loop, &(entry.timer_watcher));
-                _events.erase(map_it->second);
-                _map.erase(map_it);
-            }
             break;
 
+        case xx_impl::event_type::delay_simple:
         case xx_impl::event_type::delay_imm_simple:
+        case xx_impl::event_type::delay_wheel_simple:
+            keep = false;
             entry.timer_simple_callback();
-    erase_delay_imm_handle:
-            if (_map.find(handle) == map_it)
-            {
-                _events.erase(map_it->second);
-                _map.erase(map_it);
-            }
             break;
 
         case xx_impl::event_type::repeat:
         case xx_impl::event_type::repeat_imm:
+        case xx_impl::event_type::repeat_wheel:
             entry.repeat_callback(*this, handle);
             break;
 
         case xx_impl::event_type::repeat_simple:
         case xx_impl::event_type::repeat_imm_simple:
+        case xx_impl::event_type::repeat_wheel_simple:
+            entry.timer_simple_callback();
+            break;
+
+        case xx_impl::event_type::at:
+            keep = false;
+            entry.repeat_callback(*this, handle);
+            break;
+
+        case xx_impl::event_type::at_simple:
+            keep = false;
             entry.timer_simple_callback();
             break;
 
+        case xx_impl::event_type::periodic:
+            // An absolute periodic has no interval, and expires only once.
+            keep = entry.periodic_watcher.interval != 0;
+            entry.repeat_callback(*this, handle);
+            break;
+
+        case xx_impl::event_type::periodic_simple:
+            keep = entry.periodic_watcher.interval != 0;
+            entry.timer_simple_callback();
+            break;
+
+        case xx_impl::event_type::async:
+            keep = false;
+            entry.async_callback(revents, *this, handle);
+            break;
+
+        case xx_impl::event_type::async_simple:
+            keep = false;
+            entry.async_simple_callback(revents);
+            break;
+
+        case xx_impl::event_type::idle:
+            keep = false;
+            entry.delay_callback(keep, *this, handle);
+            break;
+
+        case xx_impl::event_type::idle_simple:
+            keep = entry.idle_simple_callback();
+            break;
+
+        case xx_impl::event_type::path:
+            entry.path_callback(*_paths.current, *this, handle);
+            break;
+
+        case xx_impl::event_type::path_simple:
+            entry.path_simple_callback(*_paths.current);
+            break;
+
         default:
             break;
     }
+    entry.is_calling = false;
+    _instrument.record_call(entry, start);
+
+    if (entry.handle() != handle)
+        // The event was cancelled inside its own callback.
+        _events.release(entry);
+    else if (!keep)
+        cancel(handle);
+}
+
+void event_loop::start_timer(xx_impl::event_entry& entry, ev_tstamp after, ev_tstamp slack)
+{
+    auto watcher = &(entry.timer_watcher);
+    ev_init(watcher, [](struct ev_loop* loop, ev_timer* watcher, int revents)
+    {
+        auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+        this_->call_timer(*static_cast<xx_impl::event_entry*>(watcher->data), revents);
+    });
+    watcher->data = &entry;
+    watcher->interval = after;
+    watcher->slack = slack;
+    ev_set_priority(watcher, entry.priority);
+
+    if (slack > 0)
+    {
+        watcher->due = ev_now(_loop) + after;
+        arm_slack_timer(*watcher);
+    }
+    else
+    {
+        ev_timer_set(watcher, after, after);
+        ev_timer_start(_loop, watcher);
+    }
+}
+
+void event_loop::start_deadline(xx_impl::event_entry& entry, ev_tstamp after)
+{
+    // *after* was measured from the current time, while libev timers start
+    // at the time of the current iteration.
+    start_timer(entry, after + (ev_time() - ev_now(_loop)), 0);
+    entry.timer_watcher.repeat = 0;
+}
+
+void event_loop::arm_slack_timer(xx_impl::libev_timer_watcher& watcher)
+{
+    ev_timer_set(&watcher, xx_impl::apply_slack(watcher.due, watcher.slack) - ev_now(_loop), 0.);
+    ev_timer_start(_loop, &watcher);
+}
+
+void event_loop::call_timer(xx_impl::event_entry& entry, int revents)
+{
+    auto& watcher = entry.timer_watcher;
+    auto iteration = ev_iteration(_loop);
+    _timer_stats.expired(iteration != _timer_iteration, watcher.slack);
+    _timer_iteration = iteration;
+
+    if (watcher.slack > 0)
+    {
+        // Reschedule before calling, like libev does for repeating timers.
+        // The period is kept on the unrounded deadlines.
+        watcher.due += watcher.interval;
+        if (watcher.due < ev_now(_loop))
+            watcher.due = ev_now(_loop);
+        arm_slack_timer(watcher);
+    }
+
+    dispatch(entry, revents);
+}
+
+void event_loop::dispatch(xx_impl::event_entry& entry, int revents)
+{
+    if (entry.priority >= priority_normal)
+    {
+        call_entry(entry, revents);
+        return;
+    }
+
+    if (_low_ready.empty())
+        ev_idle_start(_loop, &_low_idle);
+    _low_ready.push(entry, revents);
+}
+
+void event_loop::init_ready_watchers()
+{
+    // The check watcher is started with the first low-priority event, so
+    // that it is already queued in the iteration in which the events become
+    // ready. It does not keep the loop alive by itself.
+    ev_check_init(&_low_check, [](struct ev_loop* loop, ev_check*, int)
+    {
+        static_cast<event_loop*>(ev_userdata(loop))->call_ready();
+    });
+    ev_set_priority(&_low_check, EV_MINPRI);
+
+    // Keeps the loop running without blocking while events are left in the
+    // queue.
+    ev_idle_init(&_low_idle, [](struct ev_loop*, ev_idle*, int) {});
+    ev_set_priority(&_low_idle, EV_MINPRI);
+}
+
+void event_loop::start_low_check()
+{
+    ev_check_start(_loop, &_low_check);
+    ev_unref(_loop);
+}
+
+void event_loop::call_ready()
+{
+    if (_low_ready.empty())
+        return;
+
+    _low_ready.run(_events, _low_priority_budget, [this](xx_impl::event_entry& entry, int revents)
+    {
+        this->call_entry(entry, revents);
+    });
+
+    if (_low_ready.empty())
+        ev_idle_stop(_loop, &_low_idle);
 }
 
 //}}}
@@ -335,42 +534,29 @@ void event_loop::init_imm_watcher()
     });
 }
 
-void event_loop::start_imm_watcher()
+void event_loop::start_imm_watcher(xx_impl::event_entry& entry)
 {
+    _imms.push_back(_events, entry);
+
     auto& watcher = _imm_watcher;
     if (ev_is_active(&watcher))
         return;
     ev_idle_start(_loop, &watcher);
 }
 
-static inline bool is_imm(const xx_impl::event_entry& entry) noexcept
-{
-    auto type = entry.type;
-    return type == xx_impl::event_type::delay_imm
-        || type == xx_impl::event_type::repeat_imm
-        || type == xx_impl::event_type::delay_imm_simple
-        || type == xx_impl::event_type::repeat_imm_simple;
-}
-
 void event_loop::call_imms()
 {
-    auto cur = _map.begin();
-    auto end = _map.end();
-    while (cur != end)
+    _imms.walk(_events, [this](xx_impl::event_entry& entry)
     {
-        auto prev = cur;
-        ++ cur;
-
-        if (is_imm(*prev->second))
-            call_entry(prev->first, prev);
-    }
+        this->call_entry(entry, 0);
+    });
 
     try_stop_imm_watcher();
 }
 
 void event_loop::try_stop_imm_watcher()
 {
-    if (std::none_of(_events.begin(), _events.end(), is_imm))
+    if (_imms.empty())
     {
         auto& watcher = _imm_watcher;
         ev_idle_stop(_loop, &watcher);
@@ -379,48 +565,554 @@ void event_loop::try_stop_imm_watcher()
 
 //}}}
 
+//{{{ Idle work
+
+void event_loop::init_idle_watcher()
+{
+    auto& watcher = _idle_watcher;
+    ev_idle_init(&watcher, [](struct ev_loop* loop, ev_idle*, int)
+    {
+        auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+        this_->call_idles();
+    });
+    ev_set_priority(&watcher, EV_MINPRI);
+}
+
+void event_loop::start_idle_watcher(xx_impl::event_entry& entry)
+{
+    _idles.push_back(_events, entry);
+
+    auto& watcher = _idle_watcher;
+    if (ev_is_active(&watcher))
+        return;
+    ev_idle_start(_loop, &watcher);
+}
+
+void event_loop::call_idles()
+{
+    // Ready low-priority events share the lowest libev priority, and still
+    // come first.
+    if (!_low_ready.empty())
+        return;
+
+    // Budgets count from the start of the idle work, so the tasks share it
+    // instead of each taking its full budget in turn. A task which finds its
+    // budget spent waits with those behind it for the next idle iteration,
+    // and a task which had its turn moves to the back, so that they take
+    // turns.
+    auto start = ev_time();
+    bool is_first = true;
+    _idles.walk(_events, [&](xx_impl::event_entry& entry)
+    {
+        auto deadline = start + entry.idle_task.budget;
+        if (!is_first && ev_time() >= deadline)
+        {
+            _idles.stop_walk();
+            return;
+        }
+        is_first = false;
+
+        auto handle = entry.handle();
+        do
+            this->call_entry(entry, 0);
+        while (_events.find(handle) == &entry && ev_time() < deadline);
+
+        if (_events.find(handle) == &entry)
+        {
+            _idles.erase(_events, entry);
+            _idles.push_back(_events, entry);
+        }
+    });
+
+    try_stop_idle_watcher();
+}
+
+void event_loop::try_stop_idle_watcher()
+{
+    if (_idles.empty())
+    {
+        auto& watcher = _idle_watcher;
+        ev_idle_stop(_loop, &watcher);
+    }
+}
+
+//}}}
+
+//{{{ Timer wheel
+
+void event_loop::enable_timer_wheel_impl(ev_tstamp resolution)
+{
+    if (resolution <= 0)
+        throw std::invalid_argument("utils::event_loop: timer wheel resolution must be positive");
+
+    if (_wheel)
+    {
+        if (_wheel->count != 0 && _wheel->resolution != resolution)
+            throw std::logic_error("utils::event_loop: cannot change the resolution of a busy timer wheel");
+        ev_timer_stop(_loop, &_wheel_watcher);
+        _wheel->resolution = resolution;
+    }
+    else
+    {
+        _wheel.reset(new xx_impl::timer_wheel<xx_impl::event_entry>(resolution));
+        ev_init(&_wheel_watcher, [](struct ev_loop* loop, ev_timer*, int)
+        {
+            auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+            this_->call_wheel();
+        });
+    }
+
+    _is_wheel_enabled = true;
+}
+
+xx_impl::event_entry& event_loop::arm_wheel_timer(xx_impl::event_entry& entry, ev_tstamp interval)
+{
+    auto& wheel = *_wheel;
+    if (!ev_is_active(&_wheel_watcher))
+    {
+        // The wheel stops turning when it is empty, so catch up with the
+        // current time before using it again.
+        wheel.epoch = ev_now(_loop);
+        wheel.now = 0;
+        ev_timer_set(&_wheel_watcher, wheel.resolution, wheel.resolution);
+        ev_timer_start(_loop, &_wheel_watcher);
+    }
+
+    auto& timer = entry.wheel_watcher;
+    timer.interval = wheel.ticks_for(interval);
+    timer.expires = wheel.now + timer.interval;
+    wheel.insert(_events, entry);
+    return entry;
+}
+
+void event_loop::call_wheel()
+{
+    auto& wheel = *_wheel;
+    auto target = wheel.ticks_at(ev_now(_loop));
+    if (target <= wheel.now)
+        target = wheel.now + 1;
+
+    while (wheel.now < target && wheel.count != 0)
+    {
+        wheel.tick(_events).walk(_events, [&](xx_impl::event_entry& entry)
+        {
+            wheel.erase(_events, entry);
+
+            auto handle = entry.handle();
+            this->dispatch(entry, 0);
+
+            // Re-arm repeating timers, unless the callback has cancelled or
+            // restarted the timer itself.
+            if (_events.find(handle) == &entry && entry.wheel_watcher.slot == xx_impl::npos)
+            {
+                entry.wheel_watcher.expires = wheel.now + entry.wheel_watcher.interval;
+                wheel.insert(_events, entry);
+            }
+        });
+    }
+
+    if (wheel.count == 0)
+        ev_timer_stop(_loop, &_wheel_watcher);
+}
+
+//}}}
+
+//{{{ Cross-thread posts
+
+void event_loop::init_post_watcher()
+{
+    auto& watcher = _post_watcher;
+    ev_async_init(&watcher, [](struct ev_loop* loop, ev_async*, int)
+    {
+        auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+        try
+        {
+            this_->_posts.run(*this_);
+        }
+        catch (...)
+        {
+            // Come back for the rest of the batch.
+            ev_async_send(loop, &this_->_post_watcher);
+            throw;
+        }
+    });
+    ev_async_start(_loop, &watcher);
+    // Pending posts should not keep the loop running on their own.
+    ev_unref(_loop);
+}
+
+void event_loop::post_impl(xx_impl::post_func&& callback)
+{
+    if (_posts.push(std::move(callback)))
+        ev_async_send(_loop, &_post_watcher);
+}
+
+void event_loop::post_impl(xx_impl::post_simple_func&& callback)
+{
+    post_impl(xx_impl::post_func([callback](event_loop&) { callback(); }));
+}
+
+//}}}
+
+//{{{ Asynchronous I/O
+
+void event_loop::start_async(xx_impl::event_entry& entry, xx_impl::async_kind kind, int fd, void* buffer,
+                             std::size_t size, ev_tstamp timeout)
+{
+    auto& watcher = entry.async_watcher;
+    xx_impl::prepare_async(watcher.op, kind, fd, buffer, size, timeout);
+
+    if (_uring.enabled())
+    {
+        _uring.start(entry.handle(), watcher.op);
+        // The kernel holds on to the entry until the operation completes,
+        // just like a running callback would.
+        entry.is_calling = true;
+        update_uring_watchers();
+        return;
+    }
+
+    // Without io_uring, wait for readiness and perform the operation then.
+    ev_io_init(&watcher.io, [](struct ev_loop* loop, ev_io* w, int)
+    {
+        auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+        this_->call_async(*static_cast<xx_impl::event_entry*>(w->data));
+    }, fd, kind == xx_impl::async_kind::write ? EV_WRITE : EV_READ);
+    watcher.io.data = &entry;
+    ev_io_start(_loop, &watcher.io);
+    watcher.op.is_waiting = true;
+
+    if (timeout >= 0)
+    {
+        auto handle = entry.handle();
+        watcher.op.timer = delay(std::chrono::duration<ev_tstamp>(timeout), [handle](bool&, event_loop& loop, event_handle)
+        {
+            loop.expire_async(handle);
+        });
+    }
+}
+
+void event_loop::stop_async(xx_impl::event_entry& entry) noexcept
+{
+    auto& watcher = entry.async_watcher;
+    auto& op = watcher.op;
+
+    if (op.is_waiting)
+    {
+        ev_io_stop(_loop, &watcher.io);
+        op.is_waiting = false;
+    }
+
+    if (op.timer)
+    {
+        auto timer = op.timer;
+        op.timer = 0;
+        cancel(timer);
+    }
+
+    if (op.is_in_kernel)
+    {
+        // The entry is released when the cancelled operation completes. If
+        // the cancellation cannot be queued, the operation simply runs to
+        // completion instead.
+        try
+        {
+            _uring.cancel(entry.handle());
+            update_uring_watchers();
+        }
+        catch (...)
+        {
+        }
+    }
+}
+
+void event_loop::call_async(xx_impl::event_entry& entry)
+{
+    auto res = xx_impl::perform_async(entry.async_watcher.op);
+    if (res == -EAGAIN || res == -EWOULDBLOCK || res == -EINTR)
+        return;
+
+    stop_async(entry);
+    call_entry(entry, static_cast<int>(res));
+}
+
+void event_loop::expire_async(event_handle handle)
+{
+    auto entry = _events.find(handle);
+    if (!entry)
+        return;
+
+    // The timer is being called and finishes by itself.
+    entry->async_watcher.op.timer = 0;
+    stop_async(*entry);
+    call_entry(*entry, -ETIMEDOUT);
+}
+
+void event_loop::complete_async(event_handle user_data, int res)
+{
+    auto& entry = _events.at(static_cast<std::uint32_t>(user_data));
+    auto& op = entry.async_watcher.op;
+    op.is_in_kernel = false;
+    entry.is_calling = false;
+
+    if (entry.handle() != user_data)
+    {
+        // The operation was cancelled while in the kernel.
+        _events.release(entry);
+        return;
+    }
+
+    if (res == -ECANCELED && op.has_timeout())
+        res = -ETIMEDOUT;
+    call_entry(entry, res);
+}
+
+void event_loop::init_uring_watchers()
+{
+    if (!_uring.enabled())
+        return;
+
+    // Submissions are batched and flushed once per iteration, right before
+    // the loop blocks.
+    ev_prepare_init(&_uring_prepare, [](struct ev_loop* loop, ev_prepare* w, int)
+    {
+        auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+        this_->_uring.submit();
+        if (!this_->_uring.has_unsubmitted())
+            ev_prepare_stop(loop, w);
+    });
+
+    ev_io_init(&_uring_watcher, [](struct ev_loop* loop, ev_io*, int)
+    {
+        auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+        this_->_uring.reap([this_](event_handle user_data, int res)
+        {
+            this_->complete_async(user_data, res);
+        });
+        this_->update_uring_watchers();
+    }, _uring.fd(), EV_READ);
+}
+
+void event_loop::update_uring_watchers()
+{
+    if (_uring.has_unsubmitted() && !ev_is_active(&_uring_prepare))
+        ev_prepare_start(_loop, &_uring_prepare);
+
+    if (_uring.in_flight() != 0)
+    {
+        if (!ev_is_active(&_uring_watcher))
+            ev_io_start(_loop, &_uring_watcher);
+    }
+    else if (ev_is_active(&_uring_watcher))
+    {
+        ev_io_stop(_loop, &_uring_watcher);
+    }
+}
+
+//}}}
+
+//{{{ Instrumentation
+
+void event_loop::init_instrument_watchers()
+{
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+    // An iteration is busy from the return of the backend poll (check
+    // watchers) until the loop is about to poll again (prepare watchers).
+    ev_check_init(&_instrument_check, [](struct ev_loop* loop, ev_check*, int)
+    {
+        static_cast<event_loop*>(ev_userdata(loop))->_instrument.iteration_begin();
+    });
+    ev_prepare_init(&_instrument_prepare, [](struct ev_loop* loop, ev_prepare*, int)
+    {
+        auto this_ = static_cast<event_loop*>(ev_userdata(loop));
+        this_->_instrument.iteration_end(this_->_imms.size());
+    });
+    ev_set_priority(&_instrument_check, EV_MAXPRI);
+    ev_check_start(_loop, &_instrument_check);
+    ev_prepare_start(_loop, &_instrument_prepare);
+    ev_unref(_loop);
+    ev_unref(_loop);
+#endif
+}
+
+//}}}
+
+event_loop::~event_loop()
+{
+    // Callbacks destroyed with the registry must not schedule anything.
+    _is_closing = true;
+    ev_ref(_loop);
+    ev_async_stop(_loop, &_post_watcher);
+    if (ev_is_active(&_low_check))
+    {
+        ev_ref(_loop);
+        ev_check_stop(_loop, &_low_check);
+    }
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+    ev_ref(_loop);
+    ev_ref(_loop);
+    ev_check_stop(_loop, &_instrument_check);
+    ev_prepare_stop(_loop, &_instrument_prepare);
+#endif
+    ev_loop_destroy(_loop);
+}
+
+void event_loop::stop_watcher(xx_impl::event_entry& entry) noexcept
+{
+    switch (entry.type)
+    {
+        case xx_impl::event_type::io:
+        case xx_impl::event_type::io_simple:
+        case xx_impl::event_type::io_mask:
+        case xx_impl::event_type::io_mask_simple:
+            ev_io_stop(_loop, &(entry.io_watcher));
+            break;
+
+        case xx_impl::event_type::signal:
+        case xx_impl::event_type::signal_simple:
+            ev_signal_stop(_loop, &(entry.signal_watcher));
+            break;
+
+        case xx_impl::event_type::delay:
+        case xx_impl::event_type::delay_simple:
+        case xx_impl::event_type::repeat:
+        case xx_impl::event_type::repeat_simple:
+        case xx_impl::event_type::at:
+        case xx_impl::event_type::at_simple:
+            ev_timer_stop(_loop, &(entry.timer_watcher));
+            break;
+
+        case xx_impl::event_type::periodic:
+        case xx_impl::event_type::periodic_simple:
+            ev_periodic_stop(_loop, &(entry.periodic_watcher));
+            break;
+
+        case xx_impl::event_type::delay_wheel:
+        case xx_impl::event_type::delay_wheel_simple:
+        case xx_impl::event_type::repeat_wheel:
+        case xx_impl::event_type::repeat_wheel_simple:
+            // The wheel watcher stops by itself on the next tick if this was
+            // the last timer.
+            _wheel->erase(_events, entry);
+            break;
+
+        case xx_impl::event_type::async:
+        case xx_impl::event_type::async_simple:
+            stop_async(entry);
+            break;
+
+        case xx_impl::event_type::path:
+        case xx_impl::event_type::path_simple:
+            stop_path(entry);
+            break;
+
+        default:
+            break;
+    }
+}
+
+void event_loop::restart(event_handle handle)
+{
+    auto entry = _events.find(handle);
+    if (!entry)
+        return;
+
+    switch (entry->type)
+    {
+        case xx_impl::event_type::delay:
+        case xx_impl::event_type::delay_simple:
+        case xx_impl::event_type::repeat:
+        case xx_impl::event_type::repeat_simple:
+        {
+            auto& watcher = entry->timer_watcher;
+            if (watcher.slack > 0)
+            {
+                ev_timer_stop(_loop, &watcher);
+                watcher.due = ev_now(_loop) + watcher.interval;
+                arm_slack_timer(watcher);
+            }
+            else
+            {
+                ev_timer_again(_loop, &watcher);
+            }
+            break;
+        }
+
+        case xx_impl::event_type::delay_wheel:
+        case xx_impl::event_type::delay_wheel_simple:
+        case xx_impl::event_type::repeat_wheel:
+        case xx_impl::event_type::repeat_wheel_simple:
+        {
+            auto& timer = entry->wheel_watcher;
+            _wheel->erase(_events, *entry);
+            timer.expires = _wheel->now + timer.interval;
+            _wheel->insert(_events, *entry);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void event_loop::cancel_entry(xx_impl::event_entry& entry) noexcept
+{
+    if (xx_impl::is_imm(entry))
+    {
+        _imms.erase(_events, entry);
+        try_stop_imm_watcher();
+    }
+    else if (xx_impl::is_idle(entry))
+    {
+        _idles.erase(_events, entry);
+        try_stop_idle_watcher();
+    }
+    else
+    {
+        stop_watcher(entry);
+    }
+    _groups.leave(_events, entry);
+    _events.retire(entry);
+}
+
 void event_loop::cancel(event_handle handle)
 {
-    bool do_try_stop_imm = false;
+    auto entry = _events.find(handle);
+    if (entry)
+        cancel_entry(*entry);
+}
+
+void event_loop::cancel_group(event_group group)
+{
+    _groups.cancel(_events, group, [this](xx_impl::event_entry& entry)
+    {
+        this->cancel_entry(entry);
+    });
+}
+
+void event_loop::modify(event_handle handle, int events)
+{
+    auto entry = _events.find(handle);
+    if (!entry)
+        return;
 
-    auto map_it = _map.find(handle);
-    if (map_it != _map.end())
+    switch (entry->type)
     {
-        auto& entry = *(map_it->second);
-        switch (entry.type)
+        case xx_impl::event_type::io:
+        case xx_impl::event_type::io_simple:
+        case xx_impl::event_type::io_mask:
+        case xx_impl::event_type::io_mask_simple:
         {
-            case xx_impl::event_type::io:
-            case xx_impl::event_type::io_simple:
-                ev_io_stop(_loop, &(entry.io_watcher));
-                break;
-
-            case xx_impl::event_type::signal:
-            case xx_impl::event_type::signal_simple:
-                ev_signal_stop(_loop, &(entry.signal_watcher));
-                break;
-
-            case xx_impl::event_type::delay:
-            case xx_impl::event_type::delay_simple:
-            case xx_impl::event_type::repeat:
-            case xx_impl::event_type::repeat_simple:
-                ev_timer_stop(_loop, &(entry.timer_watcher));
-                break;
-
-            case xx_impl::event_type::delay_imm:
-            case xx_impl::event_type::delay_imm_simple:
-            case xx_impl::event_type::repeat_imm:
-            case xx_impl::event_type::repeat_imm_simple:
-                do_try_stop_imm = true;
-                break;
-
-            default:
-                break;
+            auto watcher = &(entry->io_watcher);
+            ev_io_stop(_loop, watcher);
+            ev_io_set(watcher, watcher->fd, events & io_read_write);
+            if (events & io_read_write)
+                ev_io_start(_loop, watcher);
+            break;
         }
 
-        _events.erase(map_it->second);
-        _map.erase(map_it);
-        if (do_try_stop_imm)
-            try_stop_imm_watcher();
+        default:
+            break;
     }
 }
 
@@ -1,78 +1,47 @@
 #ifndef EVENT_LOOP_LIBEV_HPP_U7KG92FBR1M
 #define EVENT_LOOP_LIBEV_HPP_U7KG92FBR1M
 
-#include <list>
-#include <functional>
-#include <unordered_map>
-#include <tuple>
+#include <chrono>
 #include <ev.h>
-#include "traits.hpp"
 #include "event_loop.hpp"
+#include "event_loop-common.hpp"
+#include "event_loop-uring.hpp"
+#include "event_loop-inotify.hpp"
+#include "event_loop-instrument.hpp"
 
 namespace utils {
 
-typedef uintptr_t event_handle;
-
 namespace xx_impl
 {
-    enum class event_type
-    {
-        io,
-        io_simple,
-        signal,
-        signal_simple,
-        delay,
-        delay_simple,
-        delay_imm,
-        delay_imm_simple,
-        repeat,
-        repeat_simple,
-        repeat_imm,
-        repeat_imm_simple
+    // The io watcher is only used when io_uring is unavailable.
+    struct libev_async_watcher
+    {
+        ev_io io;
+        async_op op;
     };
 
-    typedef std::function<void(int, event_loop&, event_handle)> io_func;
-    typedef std::function<void(bool& keep, event_loop&, event_handle)> delay_func;
-    typedef std::function<void(event_loop&, event_handle)> repeat_func;
-
-    typedef std::function<void(int)> io_simple_func;
-    typedef std::function<void()> timer_simple_func;
+    // Timers with slack are one-shot libev timers, re-armed on the rounded
+    // deadline every time they expire.
+    struct libev_timer_watcher : ev_timer
+    {
+        ev_tstamp due;
+        ev_tstamp interval;
+        ev_tstamp slack;
+    };
 
-    struct event_entry
+    struct event_entry : event_entry_base
     {
         union
         {
             ev_io io_watcher;
             ev_signal signal_watcher;
-            ev_timer timer_watcher;
+            libev_timer_watcher timer_watcher;
+            ev_periodic periodic_watcher;
+            wheel_timer wheel_watcher;
+            libev_async_watcher async_watcher;
+            idle_budget idle_task;
+            inotify_watcher path_watcher;
         };
-
-        union
-        {
-            io_func io_callback;
-            delay_func delay_callback;
-            repeat_func repeat_callback;
-            io_simple_func io_simple_callback;
-            timer_simple_func timer_simple_callback;
-        };
-
-        event_type type;
-
-        ~event_entry();
-        event_entry();
-        event_entry(event_entry&&);
-    };
-
-    template <typename F, typename A, typename B>
-    struct pick_event_func
-    {
-        typedef typename function_traits<F>::function_type FFType;
-        typedef typename function_traits<A>::function_type AFType;
-        typedef typename function_traits<B>::function_type BFType;
-        enum { isA = std::is_same<FFType, AFType>::value,
-               isB = std::is_same<FFType, BFType>::value };
-        static_assert(isA || isB, "Function types for event_loop callbacks mismatch");
-        typedef typename std::conditional<isA, A, B>::type type;
     };
 }
 
@@ -82,25 +51,82 @@ class event_loop final
 public:
     event_loop()
         : _loop(ev_loop_new(0)),
-          _event_counter(0)
+          _is_closing(false),
+          _low_priority_budget(0),
+          _next_priority(priority_normal),
+          _timer_iteration(~0u),
+          _is_wheel_enabled(false)
     {
         ev_set_userdata(_loop, this);
         init_imm_watcher();
+        init_idle_watcher();
+        init_ready_watchers();
+        init_post_watcher();
+        init_uring_watchers();
+        init_instrument_watchers();
+    }
+
+    event_loop& with_tag(const char* tag) noexcept
+    {
+        _instrument.tag_next(tag);
+        return *this;
+    }
+
+    event_group create_group() { return _groups.create(); }
+
+    event_loop& with_group(event_group group) noexcept
+    {
+        _groups.select(group);
+        return *this;
+    }
+
+    event_loop& with_priority(event_priority priority) noexcept
+    {
+        _next_priority = priority;
+        return *this;
+    }
+
+    void set_low_priority_budget(std::size_t budget) noexcept { _low_priority_budget = budget; }
+
+    std::size_t live_events() const noexcept { return _events.live(); }
+
+    event_loop_snapshot snapshot() const
+    {
+        auto result = _instrument.snapshot(_events.live(), _imms.size());
+        result.timer_wakeups = _timer_stats.wakeups;
+        result.coalesced_timers = _timer_stats.coalesced;
+        return result;
+    }
+
+    void reset_snapshot() noexcept
+    {
+        _instrument.reset();
+        _timer_stats = xx_impl::timer_stats();
     }
 
     template <typename F>
     event_handle listen(int fd, F&& gen_callback)
     {
         typename xx_impl::pick_event_func<F, xx_impl::io_func, xx_impl::io_simple_func>::type
-            callback (std::forward<F>(gen_callback));
+            callback (std::forward<F>(gen_callback), _callback_pool);
         return listen_impl(fd, std::move(callback));
     }
 
+    template <typename F>
+    event_handle listen(int fd, int events, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::io_mask_func, xx_impl::io_mask_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return listen_impl(fd, events, std::move(callback));
+    }
+
+    void modify(event_handle handle, int events);
+
     template <typename F>
     event_handle signal(int signum, F&& gen_callback)
     {
         typename xx_impl::pick_event_func<F, xx_impl::io_func, xx_impl::io_simple_func>::type
-            callback (std::forward<F>(gen_callback));
+            callback (std::forward<F>(gen_callback), _callback_pool);
         return signal_impl(signum, std::move(callback));
     }
 
@@ -110,8 +136,18 @@ public:
         using namespace std::chrono;
         auto seconds = duration_cast<duration<ev_tstamp>>(after).count();
         typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::timer_simple_func>::type
-            callback (std::forward<F>(gen_callback));
-        return delay_impl(seconds, std::move(callback));
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return delay_impl(seconds, 0, std::move(callback));
+    }
+
+    template <typename R, typename P, typename R2, typename P2, typename F>
+    event_handle delay(std::chrono::duration<R, P> after, std::chrono::duration<R2, P2> slack, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<ev_tstamp>>(after).count();
+        typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return delay_impl(seconds, to_timeout(slack), std::move(callback));
     }
 
     template <typename R, typename P, typename F>
@@ -120,15 +156,25 @@ public:
         using namespace std::chrono;
         auto seconds = duration_cast<duration<ev_tstamp>>(interval).count();
         typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
-            callback (std::forward<F>(gen_callback));
-        return repeat_impl(seconds, std::move(callback));
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return repeat_impl(seconds, 0, std::move(callback));
+    }
+
+    template <typename R, typename P, typename R2, typename P2, typename F>
+    event_handle repeat(std::chrono::duration<R, P> interval, std::chrono::duration<R2, P2> slack, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<ev_tstamp>>(interval).count();
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return repeat_impl(seconds, to_timeout(slack), std::move(callback));
     }
 
     template <typename F>
     event_handle delay(F&& gen_callback)
     {
         typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::timer_simple_func>::type
-            callback (std::forward<F>(gen_callback));
+            callback (std::forward<F>(gen_callback), _callback_pool);
         return delay_imm_impl(std::move(callback));
     }
 
@@ -136,12 +182,192 @@ public:
     event_handle repeat(F&& gen_callback)
     {
         typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
-            callback (std::forward<F>(gen_callback));
+            callback (std::forward<F>(gen_callback), _callback_pool);
         return repeat_imm_impl(std::move(callback));
     }
 
+    template <typename C, typename D, typename F>
+    event_handle at(std::chrono::time_point<C, D> when, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return at_impl(to_timeout(when - C::now()), !C::is_steady, std::move(callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle every(std::chrono::duration<R, P> interval, F&& gen_callback)
+    {
+        return every(interval, std::chrono::seconds(0), std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename R2, typename P2, typename F>
+    event_handle every(std::chrono::duration<R, P> interval, std::chrono::duration<R2, P2> offset, F&& gen_callback)
+    {
+        using namespace std::chrono;
+        typename xx_impl::pick_event_func<F, xx_impl::repeat_func, xx_impl::timer_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return every_impl(duration_cast<duration<ev_tstamp>>(interval).count(),
+                          duration_cast<duration<ev_tstamp>>(offset).count(), std::move(callback));
+    }
+
+    // Raw function pointers with a context, stored inline and called directly.
+
+    event_handle listen(int fd, xx_impl::io_func::raw_type function, void* ctx)
+    {
+        return listen_impl(fd, xx_impl::io_func(function, ctx));
+    }
+
+    event_handle listen(int fd, int events, xx_impl::io_mask_func::raw_type function, void* ctx)
+    {
+        return listen_impl(fd, events, xx_impl::io_mask_func(function, ctx));
+    }
+
+    event_handle signal(int signum, xx_impl::io_func::raw_type function, void* ctx)
+    {
+        return signal_impl(signum, xx_impl::io_func(function, ctx));
+    }
+
+    template <typename R, typename P>
+    event_handle delay(std::chrono::duration<R, P> after, xx_impl::delay_func::raw_type function, void* ctx)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<ev_tstamp>>(after).count();
+        return delay_impl(seconds, 0, xx_impl::delay_func(function, ctx));
+    }
+
+    template <typename R, typename P>
+    event_handle repeat(std::chrono::duration<R, P> interval, xx_impl::repeat_func::raw_type function, void* ctx)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<ev_tstamp>>(interval).count();
+        return repeat_impl(seconds, 0, xx_impl::repeat_func(function, ctx));
+    }
+
+    event_handle delay(xx_impl::delay_func::raw_type function, void* ctx)
+    {
+        return delay_imm_impl(xx_impl::delay_func(function, ctx));
+    }
+
+    event_handle repeat(xx_impl::repeat_func::raw_type function, void* ctx)
+    {
+        return repeat_imm_impl(xx_impl::repeat_func(function, ctx));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle when_idle(std::chrono::duration<R, P> budget, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::delay_func, xx_impl::idle_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return idle_impl(to_timeout(budget), std::move(callback));
+    }
+
+    template <typename F>
+    void post(F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::post_func, xx_impl::post_simple_func>::type
+            callback (std::forward<F>(gen_callback));
+        post_impl(std::move(callback));
+    }
+
+    template <typename F>
+    event_handle async_read(int fd, void* buffer, std::size_t size, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::read, fd, buffer, size, -1, std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle async_read(int fd, void* buffer, std::size_t size, std::chrono::duration<R, P> timeout, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::read, fd, buffer, size, to_timeout(timeout), std::forward<F>(gen_callback));
+    }
+
+    template <typename F>
+    event_handle async_write(int fd, const void* buffer, std::size_t size, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::write, fd, buffer, size, -1, std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle async_write(int fd, const void* buffer, std::size_t size, std::chrono::duration<R, P> timeout, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::write, fd, buffer, size, to_timeout(timeout), std::forward<F>(gen_callback));
+    }
+
+    template <typename F>
+    event_handle async_accept(int fd, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::accept, fd, nullptr, 0, -1, std::forward<F>(gen_callback));
+    }
+
+    template <typename R, typename P, typename F>
+    event_handle async_accept(int fd, std::chrono::duration<R, P> timeout, F&& gen_callback)
+    {
+        return make_async(xx_impl::async_kind::accept, fd, nullptr, 0, to_timeout(timeout), std::forward<F>(gen_callback));
+    }
+
+    bool register_buffers(const struct iovec* buffers, unsigned count)
+    {
+        return _uring.register_buffers(buffers, count);
+    }
+
+    void unregister_buffers() noexcept { _uring.unregister_buffers(); }
+
+    bool is_io_uring_enabled() const noexcept { return _uring.enabled(); }
+
+    template <typename R, typename P>
+    void enable_timer_wheel(std::chrono::duration<R, P> resolution)
+    {
+        using namespace std::chrono;
+        enable_timer_wheel_impl(duration_cast<duration<ev_tstamp>>(resolution).count());
+    }
+
+    void disable_timer_wheel() noexcept { _is_wheel_enabled = false; }
+
+    template <typename R, typename P>
+    xx_impl::sleep_awaiter sleep(std::chrono::duration<R, P> after);
+    xx_impl::io_awaiter readable(int fd);
+    xx_impl::io_awaiter writable(int fd);
+    xx_impl::signal_awaiter signal(int signum);
+
+    template <typename F>
+    event_group forward(int src_fd, int dst_fd, const forward_options& options, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::forward_func, xx_impl::forward_simple_func>::type
+            callback (std::forward<F>(gen_callback));
+        return forward_impl(src_fd, dst_fd, options, std::move(callback));
+    }
+
+    template <typename F>
+    event_group forward(int src_fd, int dst_fd, F&& gen_callback)
+    {
+        return forward(src_fd, dst_fd, forward_options(), std::forward<F>(gen_callback));
+    }
+
+    template <typename F>
+    event_handle watch_path(const std::string& path, std::uint32_t mask, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::path_func, xx_impl::path_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return watch_path_impl(path.c_str(), mask, std::move(callback));
+    }
+
+    template <typename R, typename P>
+    void set_path_coalescing(std::chrono::duration<R, P> window)
+    {
+        using namespace std::chrono;
+        _paths.window = duration_cast<duration<double>>(window).count();
+    }
+
+    // Defined in offload_pool.hpp.
+    template <typename F, typename G>
+    bool offload(F&& work, G&& then);
+
+    void restart(event_handle handle);
+
     void cancel(event_handle handle);
 
+    void cancel_group(event_group group);
+
     void run()
     {
         ev_run(_loop, 0);
@@ -152,41 +378,164 @@ public:
         ev_break(_loop, EVBREAK_ONE);
     }
 
+    void hold() noexcept { ev_ref(_loop); }
+    void release() noexcept { ev_unref(_loop); }
+
     struct ev_loop* get_libev_loop() const noexcept { return _loop; }
 
-    ~event_loop()
-    {
-        ev_loop_destroy(_loop);
-    }
+    ~event_loop();
 
 private:
+    friend struct xx_impl::loop_access;
+
     struct ev_loop* _loop;
+    bool _is_closing;
     ev_idle _imm_watcher;
-
-    event_handle _event_counter;
-    std::list<xx_impl::event_entry> _events;
-    std::unordered_map<event_handle, decltype(_events.begin())> _map;
+    xx_impl::event_queue<xx_impl::event_entry> _imms;
+
+    // Idle work runs from an idle watcher of the lowest libev priority,
+    // which libev only invokes when nothing else is pending.
+    ev_idle _idle_watcher;
+    xx_impl::event_queue<xx_impl::event_entry> _idles;
+
+    // The pool must outlive the entries holding callbacks allocated from it.
+    xx_impl::callback_pool _callback_pool;
+    xx_impl::event_registry<xx_impl::event_entry> _events;
+    xx_impl::event_groups<xx_impl::event_entry> _groups;
+
+    ev_async _post_watcher;
+    xx_impl::post_queue _posts;
+
+    // libev orders the high- and normal-priority watchers by itself. Ready
+    // low-priority events are queued, and run by a check watcher of the
+    // lowest libev priority, after everything else of the iteration.
+    xx_impl::ready_queue<xx_impl::event_entry> _low_ready;
+    ev_check _low_check;
+    ev_idle _low_idle;
+    std::size_t _low_priority_budget;
+    event_priority _next_priority;
+
+    xx_impl::timer_stats _timer_stats;
+    unsigned _timer_iteration;
+
+    ev_timer _wheel_watcher;
+    std::unique_ptr<xx_impl::timer_wheel<xx_impl::event_entry>> _wheel;
+    bool _is_wheel_enabled;
+
+    xx_impl::uring _uring;
+    xx_impl::path_table _paths;
+    ev_io _uring_watcher;
+    ev_prepare _uring_prepare;
+
+    xx_impl::instrument _instrument;
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+    ev_check _instrument_check;
+    ev_prepare _instrument_prepare;
+#endif
 
     event_handle listen_impl(int fd, xx_impl::io_func&& callback);
     event_handle listen_impl(int fd, xx_impl::io_simple_func&& callback);
+    event_handle listen_impl(int fd, int events, xx_impl::io_mask_func&& callback);
+    event_handle listen_impl(int fd, int events, xx_impl::io_mask_simple_func&& callback);
     event_handle signal_impl(int signum, xx_impl::io_func&& callback);
     event_handle signal_impl(int signum, xx_impl::io_simple_func&& callback);
-    event_handle delay_impl(ev_tstamp after, xx_impl::delay_func&& callback);
-    event_handle delay_impl(ev_tstamp after, xx_impl::timer_simple_func&& callback);
-    event_handle repeat_impl(ev_tstamp rep, xx_impl::repeat_func&& callback);
-    event_handle repeat_impl(ev_tstamp rep, xx_impl::timer_simple_func&& callback);
+    event_handle delay_impl(ev_tstamp after, ev_tstamp slack, xx_impl::delay_func&& callback);
+    event_handle delay_impl(ev_tstamp after, ev_tstamp slack, xx_impl::timer_simple_func&& callback);
+    event_handle repeat_impl(ev_tstamp rep, ev_tstamp slack, xx_impl::repeat_func&& callback);
+    event_handle repeat_impl(ev_tstamp rep, ev_tstamp slack, xx_impl::timer_simple_func&& callback);
     event_handle delay_imm_impl(xx_impl::delay_func&& callback);
     event_handle delay_imm_impl(xx_impl::timer_simple_func&& callback);
     event_handle repeat_imm_impl(xx_impl::repeat_func&& callback);
     event_handle repeat_imm_impl(xx_impl::timer_simple_func&& callback);
+    event_handle at_impl(ev_tstamp after, bool is_wall_clock, xx_impl::repeat_func&& callback);
+    event_handle at_impl(ev_tstamp after, bool is_wall_clock, xx_impl::timer_simple_func&& callback);
+    event_handle every_impl(ev_tstamp interval, ev_tstamp offset, xx_impl::repeat_func&& callback);
+    event_handle every_impl(ev_tstamp interval, ev_tstamp offset, xx_impl::timer_simple_func&& callback);
+    event_handle idle_impl(ev_tstamp budget, xx_impl::delay_func&& callback);
+    event_handle idle_impl(ev_tstamp budget, xx_impl::idle_simple_func&& callback);
+
+    event_handle watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_func&& callback);
+    event_handle watch_path_impl(const char* path, std::uint32_t mask, xx_impl::path_simple_func&& callback);
+    // Defined in event_loop-inotify.cpp.
+    void start_path(xx_impl::event_entry& entry, const char* path, std::uint32_t mask);
+    void stop_path(xx_impl::event_entry& entry) noexcept;
+    void read_paths();
+    void flush_paths();
+
+    template <typename R, typename P>
+    static ev_tstamp to_timeout(std::chrono::duration<R, P> timeout)
+    {
+        using namespace std::chrono;
+        auto seconds = duration_cast<duration<ev_tstamp>>(timeout).count();
+        return seconds < 0 ? 0 : seconds;
+    }
+
+    template <typename F>
+    event_handle make_async(xx_impl::async_kind kind, int fd, const void* buffer, std::size_t size,
+                            ev_tstamp timeout, F&& gen_callback)
+    {
+        typename xx_impl::pick_event_func<F, xx_impl::async_func, xx_impl::async_simple_func>::type
+            callback (std::forward<F>(gen_callback), _callback_pool);
+        return async_impl(kind, fd, const_cast<void*>(buffer), size, timeout, std::move(callback));
+    }
 
-    void call(event_handle handle, void* watcher, int watcher_type);
-    void call_entry(event_handle handle, decltype(_map.begin()) map_it);
+    event_handle async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                            ev_tstamp timeout, xx_impl::async_func&& callback);
+    event_handle async_impl(xx_impl::async_kind kind, int fd, void* buffer, std::size_t size,
+                            ev_tstamp timeout, xx_impl::async_simple_func&& callback);
+
+    void call_entry(xx_impl::event_entry& entry, int revents);
+    void start_timer(xx_impl::event_entry& entry, ev_tstamp after, ev_tstamp slack);
+    void start_deadline(xx_impl::event_entry& entry, ev_tstamp after);
+    void arm_slack_timer(xx_impl::libev_timer_watcher& watcher);
+    void call_timer(xx_impl::event_entry& entry, int revents);
+    void dispatch(xx_impl::event_entry& entry, int revents);
+    void call_ready();
+    void init_ready_watchers();
+    void start_low_check();
+    void stop_watcher(xx_impl::event_entry& entry) noexcept;
+    void cancel_entry(xx_impl::event_entry& entry) noexcept;
+
+    void assign_priority(xx_impl::event_entry& entry) noexcept
+    {
+        entry.priority = static_cast<signed char>(_next_priority);
+        entry.is_ready = false;
+        if (_next_priority == priority_low && !ev_is_active(&_low_check))
+            start_low_check();
+        _next_priority = priority_normal;
+    }
 
     void call_imms();
-    void start_imm_watcher();
+    void start_imm_watcher(xx_impl::event_entry& entry);
     void try_stop_imm_watcher();
     void init_imm_watcher();
+
+    void call_idles();
+    void start_idle_watcher(xx_impl::event_entry& entry);
+    void try_stop_idle_watcher();
+    void init_idle_watcher();
+
+    void post_impl(xx_impl::post_func&& callback);
+    void post_impl(xx_impl::post_simple_func&& callback);
+
+    // Defined in event_loop-forward.cpp, on top of the public interface.
+    event_group forward_impl(int src_fd, int dst_fd, const forward_options& options, xx_impl::forward_func&& callback);
+    event_group forward_impl(int src_fd, int dst_fd, const forward_options& options, xx_impl::forward_simple_func&& callback);
+    void init_post_watcher();
+
+    void start_async(xx_impl::event_entry& entry, xx_impl::async_kind kind, int fd, void* buffer,
+                     std::size_t size, ev_tstamp timeout);
+    void stop_async(xx_impl::event_entry& entry) noexcept;
+    void call_async(xx_impl::event_entry& entry);
+    void expire_async(event_handle handle);
+    void complete_async(event_handle user_data, int res);
+    void init_uring_watchers();
+    void init_instrument_watchers();
+    void update_uring_watchers();
+
+    void enable_timer_wheel_impl(ev_tstamp resolution);
+    xx_impl::event_entry& arm_wheel_timer(xx_impl::event_entry& entry, ev_tstamp interval);
+    void call_wheel();
 };
 
 }
@@ -0,0 +1,337 @@
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "event_loop-uring.hpp"
+
+// The simulated backend emulates asynchronous operations, so their timeouts
+// follow the virtual clock.
+#if defined(__linux__) && !defined(UTILS_EVENT_LOOP_NO_IO_URING) \
+    && !defined(UTILS_EVENT_LOOP_BACKEND_SIMULATED) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define UTILS_EVENT_LOOP_IO_URING_R4TQ0VK2MZB 1
+#endif
+#endif
+
+#ifdef UTILS_EVENT_LOOP_IO_URING_R4TQ0VK2MZB
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+namespace utils {
+
+namespace xx_impl
+{
+    // Linux never transfers more than this in a single read() or write().
+    static constexpr std::uint32_t max_transfer = 0x7ffff000;
+
+    // Accepted sockets are non-blocking, so they can be used with the
+    // emulated operations as well.
+    static constexpr int accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+
+    void prepare_async(async_op& op, async_kind kind, int fd, void* buffer, std::size_t size, double timeout) noexcept
+    {
+        op.buffer = buffer;
+        op.size = size > max_transfer ? max_transfer : static_cast<std::uint32_t>(size);
+        op.fd = fd;
+        op.kind = kind;
+        op.is_in_kernel = false;
+        op.is_waiting = false;
+        op.timer = 0;
+        if (timeout < 0)
+        {
+            op.timeout[0] = -1;
+            op.timeout[1] = 0;
+        }
+        else
+        {
+            op.timeout[0] = static_cast<std::int64_t>(timeout);
+            op.timeout[1] = static_cast<std::int64_t>((timeout - op.timeout[0]) * 1e9);
+        }
+    }
+
+    ssize_t perform_async(const async_op& op) noexcept
+    {
+        ssize_t res;
+        switch (op.kind)
+        {
+            case async_kind::read:
+                res = read(op.fd, op.buffer, op.size);
+                break;
+            case async_kind::write:
+                res = write(op.fd, op.buffer, op.size);
+                break;
+            case async_kind::accept:
+                res = accept4(op.fd, nullptr, nullptr, accept_flags);
+                break;
+            default:
+                return -EINVAL;
+        }
+        return res < 0 ? -errno : res;
+    }
+
+#ifdef UTILS_EVENT_LOOP_IO_URING_R4TQ0VK2MZB
+
+    static_assert(sizeof(uring_cqe) == sizeof(io_uring_cqe), "uring_cqe must mirror io_uring_cqe");
+    static_assert(sizeof(async_op::timeout) == sizeof(__kernel_timespec),
+                  "async_op::timeout must mirror __kernel_timespec");
+
+    static constexpr unsigned ring_entries = 256;
+
+    // Every feature used here: IORING_OP_READ/WRITE with the current file
+    // position (5.6), and poll-driven retries of sockets and pipes (5.7).
+    static constexpr unsigned required_features =
+        IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS | IORING_FEAT_FAST_POLL;
+
+    static void* map_ring(int fd, std::size_t size, off_t offset) noexcept
+    {
+        auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    uring::uring() noexcept
+        : _fd(-1), _in_flight(0),
+          _sq_ring(nullptr), _sq_ring_size(0),
+          _cq_ring(nullptr), _cq_ring_size(0),
+          _sqes(nullptr), _sqes_size(0),
+          _sq_tail(0), _sq_submitted(0)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = static_cast<int>(syscall(__NR_io_uring_setup, ring_entries, &params));
+        if (fd < 0)
+            return;
+
+        if ((params.features & required_features) != required_features)
+        {
+            close(fd);
+            return;
+        }
+
+        _sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        _cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            if (_cq_ring_size > _sq_ring_size)
+                _sq_ring_size = _cq_ring_size;
+            _cq_ring_size = 0;
+        }
+
+        _sq_ring = map_ring(fd, _sq_ring_size, IORING_OFF_SQ_RING);
+        _cq_ring = _cq_ring_size ? map_ring(fd, _cq_ring_size, IORING_OFF_CQ_RING) : _sq_ring;
+        _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        _sqes = map_ring(fd, _sqes_size, IORING_OFF_SQES);
+
+        _fd = fd;
+        if (!_sq_ring || !_cq_ring || !_sqes)
+        {
+            reset();
+            return;
+        }
+
+        auto sq = static_cast<unsigned char*>(_sq_ring);
+        _sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        _sq_tail_ptr = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        _sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        _sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        _sq_entries = params.sq_entries;
+        _sq_tail = _sq_submitted = *_sq_tail_ptr;
+
+        auto cq = static_cast<unsigned char*>(_cq_ring);
+        _cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        _cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        _cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    uring::~uring()
+    {
+        reset();
+    }
+
+    void uring::reset() noexcept
+    {
+        if (_sqes)
+            munmap(_sqes, _sqes_size);
+        if (_cq_ring && _cq_ring != _sq_ring)
+            munmap(_cq_ring, _cq_ring_size);
+        if (_sq_ring)
+            munmap(_sq_ring, _sq_ring_size);
+        if (_fd >= 0)
+            close(_fd);
+        _sqes = _cq_ring = _sq_ring = nullptr;
+        _fd = -1;
+    }
+
+    void uring::submit()
+    {
+        __atomic_store_n(_sq_tail_ptr, _sq_tail, __ATOMIC_RELEASE);
+        auto count = _sq_tail - _sq_submitted;
+        while (count != 0)
+        {
+            auto res = syscall(__NR_io_uring_enter, _fd, count, 0, 0, nullptr, 0);
+            if (res < 0)
+            {
+                // The kernel is short of memory or has a backlog of
+                // completions; retry on the next iteration of the loop.
+                if (errno == EAGAIN || errno == EBUSY)
+                    return;
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category());
+            }
+            _sq_submitted += static_cast<unsigned>(res);
+            count -= static_cast<unsigned>(res);
+        }
+    }
+
+    void* uring::get_sqes(unsigned count)
+    {
+        // Entries which must be submitted together (a linked timeout and its
+        // operation) are reserved in one go.
+        if (_sq_tail + count - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) > _sq_entries)
+        {
+            submit();
+            if (_sq_tail + count - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) > _sq_entries)
+                throw std::system_error(EBUSY, std::generic_category());
+        }
+
+        auto sqes = static_cast<io_uring_sqe*>(_sqes);
+        auto first = _sq_tail & _sq_mask;
+        for (unsigned i = 0; i < count; ++ i)
+        {
+            auto index = (_sq_tail + i) & _sq_mask;
+            _sq_array[index] = index;
+            memset(&sqes[index], 0, sizeof(io_uring_sqe));
+        }
+        _sq_tail += count;
+        return &sqes[first];
+    }
+
+    int uring::find_buffer(const void* buffer, std::size_t size) const noexcept
+    {
+        auto begin = static_cast<const char*>(buffer);
+        for (std::size_t i = 0; i < _buffers.size(); ++ i)
+        {
+            auto base = static_cast<const char*>(_buffers[i].iov_base);
+            if (begin >= base && begin + size <= base + _buffers[i].iov_len)
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    void uring::start(event_handle user_data, async_op& op)
+    {
+        auto with_timeout = op.has_timeout();
+        auto sqes = static_cast<io_uring_sqe*>(_sqes);
+        auto sqe = static_cast<io_uring_sqe*>(get_sqes(with_timeout ? 2 : 1));
+
+        sqe->fd = op.fd;
+        sqe->user_data = user_data;
+        switch (op.kind)
+        {
+            case async_kind::read:
+            case async_kind::write:
+            {
+                auto is_read = op.kind == async_kind::read;
+                auto buf_index = find_buffer(op.buffer, op.size);
+                if (buf_index >= 0)
+                {
+                    sqe->opcode = is_read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                    sqe->buf_index = static_cast<__u16>(buf_index);
+                }
+                else
+                {
+                    sqe->opcode = is_read ? IORING_OP_READ : IORING_OP_WRITE;
+                }
+                sqe->addr = reinterpret_cast<std::uintptr_t>(op.buffer);
+                sqe->len = op.size;
+                sqe->off = static_cast<__u64>(-1);
+                break;
+            }
+
+            case async_kind::accept:
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->accept_flags = accept_flags;
+                break;
+        }
+
+        if (with_timeout)
+        {
+            sqe->flags |= IOSQE_IO_LINK;
+
+            // The ring may have wrapped around between the two entries.
+            auto timeout_sqe = &sqes[(_sq_tail - 1) & _sq_mask];
+            timeout_sqe->opcode = IORING_OP_LINK_TIMEOUT;
+            timeout_sqe->fd = -1;
+            timeout_sqe->addr = reinterpret_cast<std::uintptr_t>(op.timeout);
+            timeout_sqe->len = 1;
+        }
+
+        op.is_in_kernel = true;
+        ++ _in_flight;
+    }
+
+    void uring::cancel(event_handle user_data)
+    {
+        auto sqe = static_cast<io_uring_sqe*>(get_sqes(1));
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = user_data;
+    }
+
+    bool uring::register_buffers(const struct iovec* buffers, unsigned count)
+    {
+        if (_fd < 0)
+            return false;
+
+        unregister_buffers();
+        if (count == 0)
+            return true;
+
+        if (syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, buffers, count) < 0)
+            return false;
+        _buffers.assign(buffers, buffers + count);
+        return true;
+    }
+
+    void uring::unregister_buffers() noexcept
+    {
+        if (_buffers.empty())
+            return;
+        syscall(__NR_io_uring_register, _fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        _buffers.clear();
+    }
+
+#else
+
+    uring::uring() noexcept
+        : _fd(-1), _in_flight(0),
+          _sq_ring(nullptr), _sq_ring_size(0),
+          _cq_ring(nullptr), _cq_ring_size(0),
+          _sqes(nullptr), _sqes_size(0),
+          _sq_tail(0), _sq_submitted(0)
+    {}
+
+    uring::~uring() {}
+
+    void uring::submit() {}
+
+    void uring::start(event_handle, async_op&)
+    {
+        throw std::system_error(ENOSYS, std::generic_category());
+    }
+
+    void uring::cancel(event_handle) {}
+
+    bool uring::register_buffers(const struct iovec*, unsigned) { return false; }
+
+    void uring::unregister_buffers() noexcept {}
+
+#endif
+}
+
+}
+
@@ -0,0 +1,148 @@
+
+#ifndef EVENT_LOOP_URING_HPP_Q2WF6HX9ZC4
+#define EVENT_LOOP_URING_HPP_Q2WF6HX9ZC4
+
+// Completion-based asynchronous I/O shared by all event_loop backends. When
+// the kernel supports io_uring, operations are submitted to a ring owned by
+// the loop; otherwise the backend emulates them with readiness watchers and
+// perform_async().
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "event_loop-common.hpp"
+
+namespace utils {
+
+namespace xx_impl
+{
+    enum class async_kind : std::uint8_t
+    {
+        read,
+        write,
+        accept
+    };
+
+    struct async_op
+    {
+        void* buffer;
+        std::uint32_t size;
+        int fd;
+        async_kind kind;
+
+        // The operation has been queued to the ring and not completed yet.
+        bool is_in_kernel;
+        // Emulation only: the readiness watcher has been started.
+        bool is_waiting;
+        // Emulation only: the timer which expires the operation, or 0.
+        event_handle timer;
+        // Laid out as a __kernel_timespec; a negative tv_sec means no timeout.
+        // The kernel reads it during submission, so it must live in the entry.
+        std::int64_t timeout[2];
+
+        bool has_timeout() const noexcept { return timeout[0] >= 0; }
+    };
+
+    // Fill in a new operation. A negative *timeout* (in seconds) means none.
+    void prepare_async(async_op& op, async_kind kind, int fd, void* buffer, std::size_t size, double timeout) noexcept;
+
+    // Try the operation once without blocking. Returns the result of the
+    // syscall, or -errno on failure.
+    ssize_t perform_async(const async_op& op) noexcept;
+
+    // Mirror of struct io_uring_cqe, so this header does not need the kernel
+    // headers.
+    struct uring_cqe
+    {
+        std::uint64_t user_data;
+        std::int32_t res;
+        std::uint32_t flags;
+    };
+
+    // A minimal io_uring driven by raw syscalls. Submissions are queued and
+    // handed to the kernel in one io_uring_enter() per loop iteration; the
+    // completions are reaped when the ring's fd polls readable. The user_data
+    // of an operation is the handle of its event, and 0 marks the completions
+    // of internal requests (link timeouts and cancellations).
+    class uring
+    {
+    public:
+        // Sets up the ring if the kernel supports it, and stays disabled
+        // otherwise.
+        uring() noexcept;
+        ~uring();
+
+        uring(const uring&) = delete;
+        uring& operator=(const uring&) = delete;
+
+        bool enabled() const noexcept { return _fd >= 0; }
+        int fd() const noexcept { return _fd; }
+
+        // Number of operations in the kernel, including cancelled ones whose
+        // completion has not been reaped yet.
+        std::size_t in_flight() const noexcept { return _in_flight; }
+
+        bool has_unsubmitted() const noexcept { return _sq_tail != _sq_submitted; }
+
+        void submit();
+        void start(event_handle user_data, async_op& op);
+        void cancel(event_handle user_data);
+
+        bool register_buffers(const struct iovec* buffers, unsigned count);
+        void unregister_buffers() noexcept;
+
+        // Calls f(user_data, res) for every completed operation.
+        template <typename F>
+        void reap(F&& f)
+        {
+            auto head = *_cq_head;
+            while (head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+            {
+                auto cqe = _cqes[head & _cq_mask];
+                __atomic_store_n(_cq_head, ++ head, __ATOMIC_RELEASE);
+                if (cqe.user_data)
+                {
+                    -- _in_flight;
+                    f(cqe.user_data, static_cast<int>(cqe.res));
+                }
+            }
+        }
+
+    private:
+        int _fd;
+        std::size_t _in_flight;
+
+        void* _sq_ring;
+        std::size_t _sq_ring_size;
+        void* _cq_ring;
+        std::size_t _cq_ring_size;
+        void* _sqes;
+        std::size_t _sqes_size;
+
+        unsigned* _sq_head;
+        unsigned* _sq_tail_ptr;
+        unsigned* _sq_array;
+        unsigned _sq_mask;
+        unsigned _sq_entries;
+        unsigned _sq_tail;
+        unsigned _sq_submitted;
+
+        unsigned* _cq_head;
+        unsigned* _cq_tail;
+        unsigned _cq_mask;
+        uring_cqe* _cqes;
+
+        std::vector<struct iovec> _buffers;
+
+        void reset() noexcept;
+        void* get_sqes(unsigned count);
+        int find_buffer(const void* buffer, std::size_t size) const noexcept;
+    };
+}
+
+}
+
+#endif
+
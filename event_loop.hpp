@@ -23,6 +23,27 @@ including the header:
 
     * Use `libev <http://software.schmorp.de/pkg/libev.html>` as backend
 
+* ``#define UTILS_EVENT_LOOP_BACKEND_EPOLL``
+
+    * Use Linux's ``epoll``, ``timerfd``, ``signalfd`` and ``eventfd``
+      directly, without any external dependency. File descriptors may be
+      watched in edge-triggered mode (see :data:`~utils::io_edge`). Signals
+      watched by this backend are blocked in the calling thread, so they
+      should be watched before other threads are spawned.
+
+* ``#define UTILS_EVENT_LOOP_BACKEND_SIMULATED``
+
+    * The epoll backend running on a virtual clock, for deterministic tests
+      and repeatable benchmarks of timer-heavy code. The clock starts at zero
+      and jumps straight to the next timer deadline whenever nothing else is
+      ready, so timers never sleep. Readiness of file descriptors can be
+      injected (see :func:`~utils::event_loop::inject`), and asynchronous
+      operations never use io_uring, so their timeouts run on the virtual
+      clock as well. Idle work (see :func:`~utils::event_loop::when_idle`)
+      takes no virtual time, and the clock only skips ahead once it is
+      finished. Since the budget of idle work cannot be measured on that
+      clock, each idle iteration runs exactly one chunk of it.
+
 Synopsis
 --------
 
@@ -63,6 +84,8 @@ Delay an operation::
 */
 
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <utils/memory.hpp>
 
 /**
@@ -80,10 +103,18 @@ namespace utils
     :pod:
 
     An opaque POD type which can identify an event. It is guaranteed to be
-    cheaply copyable.
+    cheaply copyable. A handle becomes stale once its event is cancelled or
+    finished, and a stale handle never refers to an event registered later.
 
     The handle is not usable across threads.
 
+.. type:: type utils::event_group
+    :pod:
+
+    An opaque POD type which identifies a group of events on one loop (see
+    :func:`~utils::event_loop::create_group`). Like event handles, group
+    handles become stale once the group is cancelled.
+
 .. type:: class utils::event_loop final
     :noncopyable:
     :nonmovable:
@@ -105,6 +136,14 @@ namespace utils
 
     An event loop is **not** thread-safe (even if it may use threads in the
     implementation). An instance of event_loop should stay in a single thread.
+    The only exception is :func:`~utils::event_loop::post`, which other threads
+    can use to hand work back to the loop.
+
+    Callbacks are type-erased without ``std::function``. A functor of up to
+    48 bytes is stored inline in the event itself; a larger one is stored in
+    a memory pool owned by the loop. Either way, registering an event in the
+    steady state does not allocate. The ``std::function`` types below only
+    describe the accepted call signatures.
 
     .. function:: event_loop()
 
@@ -116,6 +155,21 @@ namespace utils
         Listen to the UNIX file descriptor *fd*. Calls the functor when *fd* has
         data to read.
 
+    .. function:: utils::event_handle listen(int fd, int events, const std::function<void(int fd, int revents, utils::event_loop&, utils::event_handle)>& callback)
+                  utils::event_handle listen(int fd, int events, const std::function<void(int fd, int revents)>& callback)
+
+        Listen to the UNIX file descriptor *fd* for the readiness in *events*,
+        which is a combination of :data:`~utils::io_read` and
+        :data:`~utils::io_write`. The functor receives the subset of *events*
+        that is ready in *revents*.
+
+    .. function:: void modify(utils::event_handle handle, int events)
+
+        Change the interest mask of a file descriptor event in place, without
+        re-registering it. If *events* is 0, the event is suspended until it is
+        modified again. Stale handles and handles of other kinds of events are
+        ignored.
+
     .. function:: utils::event_handle delay(std::chrono::duration<...> after, const std::function<void(bool& keep, utils::event_loop&, utils::event_handle)>& callback)
                   utils::event_handle delay(std::chrono::duration<...> after, const std::function<void()>& callback)
                   utils::event_handle delay(const std::function<void(bool& keep, utils::event_loop&, utils::event_handle)>& callback)
@@ -124,7 +178,8 @@ namespace utils
         Schedule a timer in the event loop. After a certain time interval, the
         *callback* will be called and the event will be removed. If *after* is
         not supplied, the functor will be called as soon as possible (but after
-        this function has completed).
+        this function has completed). Immediate callbacks are called in the
+        order they are scheduled.
 
         In the callback, the *keep* parameter can be set to ``true`` to
         reschedule the time-out event one more time.
@@ -137,12 +192,277 @@ namespace utils
         Schedule a repeated timer in the event loop. The function will be called
         repeatedly with the given interval.
 
+    .. function:: utils::event_handle listen(int fd, void (*function)(void* ctx, int fd, utils::event_loop&, utils::event_handle), void* ctx)
+                  utils::event_handle listen(int fd, int events, void (*function)(void* ctx, int fd, int revents, utils::event_loop&, utils::event_handle), void* ctx)
+                  utils::event_handle signal(int signum, void (*function)(void* ctx, int signum, utils::event_loop&, utils::event_handle), void* ctx)
+                  utils::event_handle delay([std::chrono::duration<...> after,] void (*function)(void* ctx, bool& keep, utils::event_loop&, utils::event_handle), void* ctx)
+                  utils::event_handle repeat([std::chrono::duration<...> interval,] void (*function)(void* ctx, utils::event_loop&, utils::event_handle), void* ctx)
+
+        The same registrations with a plain function pointer and a context
+        pointer, which is passed back as the first argument. For the hottest
+        events: the pair is stored in the event itself, and dispatching is a
+        single indirect call to *function*, with neither type erasure nor
+        allocation. Captureless lambdas convert to the function pointer::
+
+            loop.listen(fd, [](void* ctx, int fd, utils::event_loop&, utils::event_handle)
+            {
+                static_cast<connection*>(ctx)->on_readable(fd);
+            }, conn);
+
+        *function* must not be null, and *ctx* must stay valid while the event
+        is registered.
+
+    .. function:: utils::event_handle when_idle(std::chrono::duration<...> budget, const std::function<void(bool& more, utils::event_loop&, utils::event_handle)>& callback)
+                  utils::event_handle when_idle(std::chrono::duration<...> budget, const std::function<bool()>& callback)
+
+        Schedule background work, such as trimming caches or flushing
+        statistics, which only runs when the loop is otherwise idle: in
+        iterations where no file descriptor, signal, timer or immediate
+        callback was ready. The *callback* should do one small chunk of the
+        work per call. It is called again and again until it reports that
+        no work is left (by leaving *more* as ``false``, or returning
+        ``false``), which removes the event, or until *budget* has passed
+        since the loop started on idle work in this iteration, after which
+        the loop polls for other events again and resumes the work in the
+        next idle iteration. The budget is counted from the start of the idle
+        work rather than from the task's own turn, so several tasks share
+        it: a task whose budget is already spent when its turn comes waits,
+        with the tasks behind it, for the next idle iteration, and tasks take
+        turns going first. At least one chunk of idle work runs in every idle
+        iteration. A single chunk is not interrupted, so the chunks should be
+        short compared to the budget. Pending idle work keeps the loop from
+        blocking, so the loop spins until it is finished.
+
+    .. function:: utils::event_handle delay(std::chrono::duration<...> after, std::chrono::duration<...> slack, ...)
+                  utils::event_handle repeat(std::chrono::duration<...> interval, std::chrono::duration<...> slack, ...)
+
+        Same as the timed ``delay`` and ``repeat`` above, but the timer may
+        expire up to *slack* late. Like the timer slack of Linux, the deadline
+        is rounded up to a multiple of the largest power of two seconds not
+        exceeding *slack* (e.g. 1/64 s for 20 ms), so that thousands of timers
+        with similar deadlines, such as per-connection keepalives, expire
+        together in one wakeup of the loop instead of one each. A repeating
+        timer keeps its *interval* on average. The slack is ignored for timers
+        in the timer wheel, which are rounded to its ticks anyway. See
+        ``timer_wakeups`` and ``coalesced_timers`` in
+        :func:`~utils::event_loop::snapshot` for the effect.
+
+    .. function:: utils::event_handle at(std::chrono::time_point<...> when, const std::function<void(utils::event_loop&, utils::event_handle)>& callback)
+                  utils::event_handle at(std::chrono::time_point<...> when, const std::function<void()>& callback)
+
+        Call *callback* once at the absolute time *when*, or as soon as
+        possible if it has passed. Time points of a steady clock are deadlines
+        on the monotonic clock. Time points of other clocks, such as
+        ``std::chrono::system_clock``, are on the wall clock: with libev, the
+        event follows changes of the wall clock; the epoll backend converts
+        the deadline to the monotonic clock when the event is registered.
+
+    .. function:: utils::event_handle every(std::chrono::duration<...> interval, std::chrono::duration<...> offset, const std::function<void(utils::event_loop&, utils::event_handle)>& callback)
+                  utils::event_handle every(std::chrono::duration<...> interval, const std::function<void()>& callback)
+
+        Call *callback* at every wall-clock time which is *offset* (default
+        0) past a multiple of *interval* since the Unix epoch, e.g. every
+        minute on the minute for ``every(std::chrono::minutes(1), ...)``, so
+        that processes on different machines fire together. Each deadline is
+        computed from the wall clock rather than from the previous one, so
+        the schedule does not drift however late the callbacks run: a
+        deadline missed while the loop was busy fires once, late, and the
+        next one is back on the grid. With libev the
+        event is an ``ev_periodic``; the epoll backend aligns to the wall
+        clock again every time the event expires, so a change of the clock
+        is caught up after at most one expiry. The simulated backend uses its
+        virtual clock as the wall clock. A non-positive *interval* throws
+        ``std::invalid_argument``.
+
+        Neither function is affected by the timer wheel or by
+        :func:`~utils::event_loop::restart`.
+
+    .. function:: void restart(utils::event_handle handle)
+
+        Restart the countdown of a timed ``delay`` or ``repeat`` event from
+        now, using its original interval. This is the cheap way to push back
+        an idle timeout. Other kinds of events are not affected.
+
+    .. function:: void enable_timer_wheel(std::chrono::duration<...> resolution)
+                  void disable_timer_wheel()
+
+        Schedule timed ``delay`` and ``repeat`` events registered from now on
+        in a hierarchical timer wheel instead of the backend's timer heap. The
+        wheel is driven by a single backend timer ticking every *resolution*,
+        and arming, cancelling and restarting a timer in it are O(1), which
+        suits large numbers of timeouts that rarely fire. Expiry times are
+        rounded up to whole ticks. The resolution cannot be changed while the
+        wheel has pending timers.
+
     .. function:: utils::event_handle signal(int signum, const std::function<void(int signum, utils::event_loop&, utils::event_handle)>& callback)
                   utils::event_handle signal(int signum, const std::function<void(int signum)>& callback)
 
         Watch for the specified signal (if it can be trapped). Calls the
         callback functor when the signal is raised.
 
+    .. function:: sleep_awaiter sleep(std::chrono::duration<...> after)
+                  io_awaiter readable(int fd)
+                  io_awaiter writable(int fd)
+                  signal_awaiter signal(int signum)
+
+        Awaitables for C++20 coroutines. They are only declared here; include
+        ``<utils/event_loop-coro.hpp>`` to use them.
+
+    .. function:: bool offload(F&& work, G&& then)
+
+        Run CPU-bound *work* on a thread pool and call *then* with its result
+        on this loop. Declared here; include ``<utils/offload_pool.hpp>`` to
+        use it.
+
+    .. function:: void post(const std::function<void(utils::event_loop&)>& callback)
+                  void post(const std::function<void()>& callback)
+
+        Schedule *callback* to be called on the thread running this event loop.
+        Unlike every other method, this function may be called from any thread.
+        Posted callbacks are called in the order they are posted. Posts are
+        collected in a lock-free queue and the loop is woken up once for every
+        batch, so posting is cheap even at high rates. Pending posts alone do
+        not keep :func:`~utils::event_loop::run` from returning.
+
+    .. function:: utils::event_handle watch_path(const std::string& path, std::uint32_t mask, const std::function<void(const utils::path_event& event, utils::event_loop&, utils::event_handle)>& callback)
+                  utils::event_handle watch_path(const std::string& path, std::uint32_t mask, const std::function<void(const utils::path_event& event)>& callback)
+
+        Watch a file or directory for the inotify events in *mask* (e.g.
+        ``IN_CLOSE_WRITE | IN_MOVED_TO``; flags such as ``IN_ONLYDIR`` are
+        allowed too), and call *callback* with each :type:`utils::path_event`.
+        All watches of a loop share one inotify descriptor, which is read with
+        one ``read()`` per wakeup however many events are queued. Events on
+        the same path (the watched file, or one name in a watched directory)
+        are merged until they are delivered, so an editor saving a file in
+        several steps produces a single event. ``IN_IGNORED``,
+        ``IN_Q_OVERFLOW`` and ``IN_UNMOUNT`` are always reported. When the
+        kernel drops the watch, e.g. because the file was deleted, the event
+        is cancelled after its callback. Throws ``std::system_error`` if the
+        path cannot be watched. Cancel the event, or hold it in a
+        :type:`~utils::unique_event`, to stop watching.
+
+        Callbacks of these events are called as soon as their batch is
+        delivered, regardless of :func:`~utils::event_loop::with_priority`.
+
+    .. function:: void set_path_coalescing(std::chrono::duration<...> window)
+
+        Deliver filesystem events *window* after the first of a batch
+        arrives, instead of right after reading them, so that events over
+        that period are merged too. The default is 0.
+
+    .. function:: utils::event_group forward(int src_fd, int dst_fd, const utils::forward_options& options, const std::function<void(std::uint64_t bytes, int error, utils::event_loop&)>& callback)
+                  utils::event_group forward(int src_fd, int dst_fd, const std::function<void(std::uint64_t bytes, int error)>& callback)
+
+        Copy everything readable from *src_fd* to *dst_fd* without passing
+        the data through user space, and call the functor once when done
+        with the number of *bytes* written and the *error* (an ``errno``
+        value) which stopped the copy, or 0 when the end of *src_fd* or the
+        limit in *options* was reached. The data goes through an internal
+        pipe with ``splice()``, or straight to *dst_fd* with ``sendfile()``
+        when *src_fd* is a regular file. Either side may be a regular file;
+        the others must be non-blocking.
+
+        Both sides are driven by the loop: reading pauses while the pipe
+        holds *chunk_size* bytes that *dst_fd* has not taken yet, so a slow
+        destination never makes the forward buffer more than that. The
+        returned group holds every event of the forward; cancelling it with
+        :func:`~utils::event_loop::cancel_group` stops the copy without
+        calling the functor. Neither descriptor is closed.
+
+    .. function:: utils::event_handle async_read(int fd, void* buffer, std::size_t size, const std::function<void(ssize_t result, utils::event_loop&, utils::event_handle)>& callback)
+                  utils::event_handle async_read(int fd, void* buffer, std::size_t size, std::chrono::duration<...> timeout, const std::function<void(ssize_t result)>& callback)
+                  utils::event_handle async_write(int fd, const void* buffer, std::size_t size, ...)
+                  utils::event_handle async_accept(int fd, ...)
+
+        Start a completion-based operation on *fd*, and call the functor once
+        with its *result* when it finishes: the number of bytes transferred,
+        the accepted (non-blocking) socket, or ``-errno`` on failure. If a
+        *timeout* is given and expires first, *result* is ``-ETIMEDOUT``.
+        Every overload accepts both callback signatures. The *buffer* must
+        stay valid until the callback is called; after the operation is
+        cancelled, it may still be accessed until the loop notices the
+        cancellation, so it should outlive the current iteration.
+
+        When the kernel supports io_uring, the operations are submitted to a
+        ring owned by the loop, batched into one system call per iteration of
+        the loop, and the data is transferred before the callback is woken up.
+        Otherwise they are emulated by waiting for readiness and then calling
+        ``read()``, ``write()`` or ``accept4()``, in which case *fd* must be
+        non-blocking.
+
+    .. function:: bool register_buffers(const struct iovec* buffers, unsigned count)
+                  void unregister_buffers()
+
+        Register memory with io_uring, replacing the previously registered
+        buffers. Asynchronous reads and writes whose buffer lies entirely in
+        a registered one use the fixed-buffer operations, which avoid mapping
+        the pages for every transfer. Returns ``false`` if io_uring is not in
+        use or the kernel refuses the buffers; the buffers can then still be
+        used normally. Buffers must not be unregistered while operations on
+        them are in flight.
+
+    .. function:: bool is_io_uring_enabled() const
+
+        Whether asynchronous operations of this loop are performed by io_uring.
+        This is decided when the loop is constructed, and can be disabled at
+        compile time by defining ``UTILS_EVENT_LOOP_NO_IO_URING``.
+
+    .. function:: utils::event_loop& with_tag(const char* tag)
+
+        Attribute the next event registered on this loop to *tag*, which
+        must be a string with static storage duration. Returns ``*this``, so
+        the registration can be chained::
+
+            loop.with_tag("db.poll").listen(fd, on_readable);
+
+        Tags only matter when instrumentation is enabled (see below), and are
+        otherwise ignored.
+
+    .. function:: utils::event_loop& with_priority(utils::event_priority priority)
+
+        Register the next event on this loop in the given priority class.
+        Returns ``*this``, like :func:`~utils::event_loop::with_tag`::
+
+            loop.with_priority(utils::priority_high).listen(control_fd, on_command);
+
+        In every iteration of the loop, the callbacks of all ready
+        high-priority events are called before those of normal-priority
+        events, which are called before those of low-priority events. Events
+        default to the normal class. Immediate callbacks and asynchronous
+        operations ignore the priority.
+
+    .. function:: void set_low_priority_budget(std::size_t budget)
+
+        Call at most *budget* low-priority callbacks in every iteration of the
+        loop (0, the default, means no limit). Ready low-priority events
+        beyond the budget wait, in the order they became ready, for the next
+        iteration, which then polls without blocking. An event which becomes
+        ready again while it is waiting is called only once.
+
+    .. function:: std::size_t live_events() const noexcept
+
+        Number of events currently registered. Unlike everything else about
+        the loop, this may be read from any thread, though it may be out of
+        date by the time it is returned.
+
+    .. function:: utils::event_loop_snapshot snapshot() const
+                  void reset_snapshot()
+
+        Take a snapshot of the loop's instrumentation, or clear the recorded
+        data. When ``UTILS_EVENT_LOOP_INSTRUMENT`` is defined (consistently in
+        every translation unit), the loop records a latency histogram of
+        callback runtimes for every pair of event type and tag, how long each
+        iteration of the loop is busy before polling again (i.e. how late a
+        newly ready event can be noticed), how many callbacks each iteration
+        dispatches, and the depth of the immediate queue. Timing uses two TSC
+        reads per dispatch on x86. When the macro is not defined, nothing is
+        recorded and the snapshot is empty, with ``enabled`` set to ``false``.
+
+        The timer counters are recorded either way: ``timer_wakeups`` is the
+        number of iterations in which timers expired, and ``coalesced_timers``
+        the number of expirations of timers with slack which shared their
+        iteration with an earlier expiration, i.e. the wakeups saved.
+
     .. function:: void cancel(utils::event_handle handle)
                   void erase(utils::event_handle handle)
 
@@ -150,6 +470,27 @@ namespace utils
         that event will not be called afterward. If a handle is cancelled more
         than once, the later calls should perform nothing.
 
+    .. function:: utils::event_group create_group()
+                  utils::event_loop& with_group(utils::event_group group)
+                  void cancel_group(utils::event_group group)
+
+        Group related events, e.g. all watchers and timers of a connection, so
+        they can be cancelled together. :func:`create_group` returns a new,
+        empty group. :func:`with_group` makes the next event registered on
+        this loop a member of *group*, and returns ``*this`` for chaining like
+        :func:`~utils::event_loop::with_tag`::
+
+            auto group = loop.create_group();
+            loop.with_group(group).listen(fd, on_readable);
+            loop.with_group(group).delay(std::chrono::seconds(30), on_timeout);
+
+        :func:`cancel_group` cancels every event still in the group and frees
+        the group, in time proportional to its size. Events leave their group
+        when they are cancelled or finish. Stale group handles are ignored,
+        and events registered with one belong to no group. A group only goes
+        away when it is cancelled, even if it is empty; see
+        :type:`~utils::unique_event_group`.
+
     .. function:: void run()
 
         Start running the event loop. The function returns only after
@@ -160,18 +501,120 @@ namespace utils
 
         Stop the event loop. All scheduled events will be cancelled.
 
+    .. function:: void hold() noexcept
+                  void release() noexcept
+
+        Keep :func:`run` from returning for lack of events until a matching
+        :func:`release`, e.g. while a reply to be posted from another thread
+        is outstanding. Holds nest. They only matter to :func:`run`; neither
+        call wakes the loop or adds anything to wait for.
+
+    .. function:: std::chrono::nanoseconds now() const
+                  void advance(std::chrono::duration<...> by)
+                  void inject(int fd, int revents)
+
+        Only available with the simulated backend. :func:`now` is the virtual
+        time elapsed since the loop was constructed. :func:`advance` moves the
+        virtual clock forward by *by*; timers which become due run in the
+        next iteration of the loop. :func:`inject` makes *fd* ready with
+        *revents* (a combination of :data:`~utils::io_read` and
+        :data:`~utils::io_write`) in the next iteration, whether the kernel
+        considers it ready or not. The fd does not have to be pollable at
+        all: file descriptors which epoll refuses are accepted by
+        :func:`listen` and only become ready through :func:`inject`::
+
+            loop.listen(fake_fd, on_readable);
+            loop.delay(std::chrono::hours(2), [&] { loop.inject(fake_fd, utils::io_read); });
+            loop.run();     // returns immediately, with loop.now() == 2 hours
+
+.. data:: utils::io_read
+          utils::io_write
+          utils::io_read_write
+
+    Interest and readiness flags of a file descriptor event.
+
+.. data:: utils::io_edge
+
+    Interest flag requesting edge-triggered notification: the event fires
+    only when the file descriptor becomes ready, so the callback must drain it
+    until ``EAGAIN``. An fd is edge-triggered as soon as any of its listeners
+    asks for it. Only honored by the epoll backend; other backends ignore it.
+
+.. data:: utils::priority_low
+          utils::priority_normal
+          utils::priority_high
+
+    The priority classes of :type:`utils::event_priority`, for
+    :func:`~utils::event_loop::with_priority`.
+
+.. type:: struct utils::path_event
+
+    An event of :func:`~utils::event_loop::watch_path`. ``mask`` holds the
+    ``IN_*`` flags of all inotify events merged into it, limited to those
+    that were asked for, and ``count`` their number. ``name`` is the name of
+    the file within a watched directory, or empty for the watched path
+    itself. ``cookie`` is the cookie of the last ``IN_MOVED_*`` event, to
+    pair up the two halves of a rename.
+
+.. type:: struct utils::forward_options
+
+    Options of :func:`~utils::event_loop::forward`. ``limit`` is the number
+    of bytes to copy, or 0 (the default) to copy until the end of the source.
+    ``chunk_size`` is the most bytes moved by one system call and held in
+    the internal pipe, 64 KiB by default.
+
+.. type:: struct utils::event_loop_snapshot
+
+    Instrumentation data of an event loop, which can be printed with
+    ``dump(std::ostream&)``. Durations are in nanoseconds. The members are
+    ``enabled``, ``iterations``, ``live_events``, ``pending_imms``,
+    ``timer_wakeups``, ``coalesced_timers``, ``callbacks`` (a vector of ``{type, tag, runtime}``), ``iteration_busy``,
+    ``iteration_dispatches`` and ``imm_depth``.
+
+.. type:: struct utils::event_loop_histogram
+
+    A log-linear histogram with about 3% relative precision, holding
+    ``count``, ``min``, ``max``, ``mean`` and the non-empty ``buckets`` as
+    (upper bound, count) pairs. ``percentile(p)`` estimates the *p*-th
+    percentile, where *p* is between 0 and 100.
+
 .. function:: utils::event_loop& utils::get_main_loop()
 
     Get the main loop for this thread.
 
 */
+
+    enum io_events : int
+    {
+        io_read = 1,
+        io_write = 2,
+        io_read_write = io_read | io_write,
+        io_edge = 4
+    };
+
+    enum event_priority : int
+    {
+        priority_low = -1,
+        priority_normal = 0,
+        priority_high = 1
+    };
+
+    struct forward_options
+    {
+        std::uint64_t limit;
+        std::size_t chunk_size;
+
+        forward_options() noexcept : limit(0), chunk_size(65536) {}
+    };
 }
 
 
 #if defined(UTILS_EVENT_LOOP_BACKEND_LIBEV)
 #include "event_loop-libev.hpp"
+#elif defined(UTILS_EVENT_LOOP_BACKEND_EPOLL) || defined(UTILS_EVENT_LOOP_BACKEND_SIMULATED)
+#include "event_loop-epoll.hpp"
 #else
-#error Please define one of the following: UTILS_EVENT_LOOP_BACKEND_LIBEV
+#error Please define one of the following: UTILS_EVENT_LOOP_BACKEND_LIBEV, UTILS_EVENT_LOOP_BACKEND_EPOLL, UTILS_EVENT_LOOP_BACKEND_SIMULATED
 #endif
 
 namespace utils {
@@ -187,6 +630,17 @@ namespace utils {
 */
 typedef unique_invalidator<decltype(&event_loop::cancel), &event_loop::cancel> unique_event;
 
+/**
+.. type:: type utils::unique_event_group = utils::unique_invalidator<decltype(&utils::event_loop::cancel_group), &utils::event_loop::cancel_group>
+    :movable:
+    :noncopyable:
+    :default_constructible:
+
+    A unique owner of an event group. Once destroyed, all events in the group
+    will be cancelled.
+*/
+typedef unique_invalidator<decltype(&event_loop::cancel_group), &event_loop::cancel_group> unique_event_group;
+
 }
 
 #endif
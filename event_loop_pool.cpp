@@ -0,0 +1,111 @@
+#include <cstdint>
+#include "event_loop_pool.hpp"
+
+namespace utils {
+
+event_loop_pool::event_loop_pool(std::size_t thread_count, placement policy)
+    : _policy(policy),
+      _next(0),
+      _is_stopped(false)
+{
+    if (thread_count == 0)
+        thread_count = 1;
+
+    _shards.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++ i)
+    {
+        std::unique_ptr<shard> s (new shard);
+        // A loop returns from run() once it has nothing to watch, but a pool
+        // loop should wait for work until the pool is stopped.
+        s->loop.hold();
+        _shards.push_back(std::move(s));
+    }
+
+    for (auto& s : _shards)
+    {
+        auto loop = &(s->loop);
+        s->thread = std::thread([loop] { loop->run(); });
+    }
+}
+
+event_loop_pool::~event_loop_pool()
+{
+    stop();
+}
+
+std::size_t event_loop_pool::place(std::size_t key) noexcept
+{
+    auto n = _shards.size();
+    if (_policy == hashed)
+    {
+        // Fibonacci hashing, so that consecutive fds spread over all loops.
+        auto hash = static_cast<std::uint64_t>(key) * UINT64_C(0x9E3779B97F4A7C15);
+        return static_cast<std::size_t>((hash >> 32) % n);
+    }
+    return _next.fetch_add(1, std::memory_order_relaxed) % n;
+}
+
+std::size_t event_loop_pool::place_timer() noexcept
+{
+    // Timers have no natural key, so they are always spread in turn.
+    auto index = _next.fetch_add(1, std::memory_order_relaxed) % _shards.size();
+    ++ _shards[index]->timers;
+    return index;
+}
+
+std::size_t event_loop_pool::place_timer(std::size_t key) noexcept
+{
+    auto index = place(key);
+    ++ _shards[index]->timers;
+    return index;
+}
+
+void event_loop_pool::post_to(std::size_t index, std::function<void(event_loop&)> callback)
+{
+    auto s = _shards[index].get();
+    ++ s->posts;
+    s->loop.post([s, callback](event_loop& loop)
+    {
+        s->executed_posts.fetch_add(1, std::memory_order_relaxed);
+        callback(loop);
+    });
+}
+
+std::vector<event_loop_pool::loop_stats> event_loop_pool::stats() const
+{
+    std::vector<loop_stats> result;
+    result.reserve(_shards.size());
+    for (auto& s : _shards)
+    {
+        loop_stats st;
+        st.live_events = s->loop.live_events();
+        st.fds = s->fds.load(std::memory_order_relaxed);
+        st.timers = s->timers.load(std::memory_order_relaxed);
+        st.posts = s->posts.load(std::memory_order_relaxed);
+        st.pending_posts = st.posts - s->executed_posts.load(std::memory_order_relaxed);
+        result.push_back(st);
+    }
+    return result;
+}
+
+void event_loop_pool::stop()
+{
+    if (_is_stopped.exchange(true))
+        return;
+
+    for (auto& s : _shards)
+    {
+        s->loop.post([](event_loop& loop)
+        {
+            loop.release();
+            loop.stop();
+        });
+    }
+
+    for (auto& s : _shards)
+        if (s->thread.joinable())
+            s->thread.join();
+}
+
+}
+
@@ -0,0 +1,252 @@
+//-------------------------------------------------------
+// utils::event_loop_pool: Event loops running in threads
+//-------------------------------------------------------
+//
+//          Copyright kennytm (auraHT Ltd.) 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file doc/LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef EVENT_LOOP_POOL_HPP_Q3WZ8T0CN5K
+#define EVENT_LOOP_POOL_HPP_Q3WZ8T0CN5K 1
+
+/**
+
+``<utils/event_loop_pool.hpp>`` --- Pool of event loops
+=======================================================
+
+This module runs a fixed number of :type:`utils::event_loop`\ s, each on its own
+thread, and shards file descriptors and timers between them. Together with
+``SO_REUSEPORT`` (one listening socket per loop) or a single acceptor which
+hands accepted sockets to the pool, this scales an event-driven service across
+all cores.
+
+Synopsis
+--------
+
+Serve accepted connections on 4 threads::
+
+    #include <utils/event_loop_pool.hpp>
+
+    utils::event_loop_pool pool (4);
+
+    get_main_loop().listen(server_fd, [&](int server_fd)
+    {
+        int client_fd = accept(server_fd, nullptr, nullptr);
+        pool.listen(client_fd, [](int fd, utils::event_loop& loop, utils::event_handle handle)
+        {
+            ...
+        });
+    });
+
+*/
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <utils/event_loop.hpp>
+
+namespace utils {
+
+/**
+Members
+-------
+
+.. type:: class utils::event_loop_pool final
+    :noncopyable:
+    :nonmovable:
+
+    A fixed set of event loops, each of which is run by a dedicated thread.
+
+    Every loop is still single-threaded. The pool never touches a loop from
+    another thread except through :func:`~utils::event_loop::post`, so all
+    registrations made through the pool are asynchronous: they take effect on
+    the target thread shortly after the call returns.
+
+    .. type:: enum placement
+
+        How new file descriptors and timers are distributed.
+
+        * ``round_robin`` --- Each new registration goes to the next loop.
+        * ``hashed`` --- A file descriptor always goes to the same loop, which
+          is chosen from a hash of its number. Timers registered with a key
+          are placed the same way, e.g. on the loop of the connection they
+          time out; timers without one are still placed in turn.
+
+    .. type:: struct loop_stats
+
+        Per-loop counters, for spotting load imbalance.
+
+        * ``std::size_t live_events`` --- Events currently registered on
+          this loop, including those not registered through the pool.
+        * ``std::size_t fds`` --- File descriptors placed on this loop so far.
+        * ``std::size_t timers`` --- Timers placed on this loop so far.
+        * ``std::size_t posts`` --- Callbacks posted to this loop.
+        * ``std::size_t pending_posts`` --- Posted callbacks not yet run.
+
+    .. function:: explicit event_loop_pool(std::size_t thread_count, placement policy = round_robin)
+
+        Start *thread_count* threads (at least 1), each running its own loop.
+
+    .. function:: std::size_t size() const noexcept
+
+        Number of loops in the pool.
+
+    .. function:: std::size_t place(std::size_t key) noexcept
+
+        Choose the loop for a new registration according to the placement
+        policy. *key* is only used by the ``hashed`` policy.
+
+    .. function:: void post_to(std::size_t index, std::function<void(utils::event_loop&)> callback)
+
+        Run *callback* on the loop *index*. May be called from any thread.
+
+    .. function:: std::size_t listen(int fd, F&& callback)
+                  std::size_t listen(int fd, int events, F&& callback)
+                  std::size_t delay(std::chrono::duration<...> after, F&& callback)
+                  std::size_t repeat(std::chrono::duration<...> interval, F&& callback)
+                  std::size_t delay(std::size_t key, std::chrono::duration<...> after, F&& callback)
+                  std::size_t repeat(std::size_t key, std::chrono::duration<...> interval, F&& callback)
+
+        Place a new event on one of the loops, and register it there with the
+        same callback types as the corresponding :type:`utils::event_loop`
+        methods. Returns the index of the chosen loop. The event handle is only
+        available inside the callback.
+
+    .. function:: std::vector<loop_stats> stats() const
+
+        Take a snapshot of the counters of every loop, without waiting for
+        any of them. May be called from any thread, including the pool's own.
+        Registrations still waiting in ``pending_posts`` are not yet counted
+        in ``live_events``.
+
+    .. function:: void stop()
+
+        Ask every loop to stop, then wait for all threads to exit. All loops
+        are stopped in parallel. Calling this more than once is harmless. The
+        destructor calls this function.
+*/
+class event_loop_pool final
+{
+public:
+    enum placement
+    {
+        round_robin,
+        hashed
+    };
+
+    struct loop_stats
+    {
+        std::size_t live_events;
+        std::size_t fds;
+        std::size_t timers;
+        std::size_t posts;
+        std::size_t pending_posts;
+    };
+
+    explicit event_loop_pool(std::size_t thread_count, placement policy = round_robin);
+    ~event_loop_pool();
+
+    event_loop_pool(const event_loop_pool&) = delete;
+    event_loop_pool& operator=(const event_loop_pool&) = delete;
+
+    std::size_t size() const noexcept { return _shards.size(); }
+
+    std::size_t place(std::size_t key) noexcept;
+
+    void post_to(std::size_t index, std::function<void(event_loop&)> callback);
+
+    template <typename F>
+    std::size_t listen(int fd, F&& callback)
+    {
+        auto index = place(static_cast<std::size_t>(fd));
+        ++ _shards[index]->fds;
+        typename std::decay<F>::type cb (std::forward<F>(callback));
+        post_to(index, [fd, cb](event_loop& loop) { loop.listen(fd, cb); });
+        return index;
+    }
+
+    template <typename F>
+    std::size_t listen(int fd, int events, F&& callback)
+    {
+        auto index = place(static_cast<std::size_t>(fd));
+        ++ _shards[index]->fds;
+        typename std::decay<F>::type cb (std::forward<F>(callback));
+        post_to(index, [fd, events, cb](event_loop& loop) { loop.listen(fd, events, cb); });
+        return index;
+    }
+
+    template <typename R, typename P, typename F>
+    std::size_t delay(std::chrono::duration<R, P> after, F&& callback)
+    {
+        return delay_on(place_timer(), after, std::forward<F>(callback));
+    }
+
+    template <typename R, typename P, typename F>
+    std::size_t delay(std::size_t key, std::chrono::duration<R, P> after, F&& callback)
+    {
+        return delay_on(place_timer(key), after, std::forward<F>(callback));
+    }
+
+    template <typename R, typename P, typename F>
+    std::size_t repeat(std::chrono::duration<R, P> interval, F&& callback)
+    {
+        return repeat_on(place_timer(), interval, std::forward<F>(callback));
+    }
+
+    template <typename R, typename P, typename F>
+    std::size_t repeat(std::size_t key, std::chrono::duration<R, P> interval, F&& callback)
+    {
+        return repeat_on(place_timer(key), interval, std::forward<F>(callback));
+    }
+
+    std::vector<loop_stats> stats() const;
+
+    void stop();
+
+private:
+    struct shard
+    {
+        event_loop loop;
+        std::thread thread;
+
+        std::atomic<std::size_t> fds;
+        std::atomic<std::size_t> timers;
+        std::atomic<std::size_t> posts;
+        std::atomic<std::size_t> executed_posts;
+
+        shard() : fds(0), timers(0), posts(0), executed_posts(0) {}
+    };
+
+    std::vector<std::unique_ptr<shard>> _shards;
+    placement _policy;
+    std::atomic<std::size_t> _next;
+    std::atomic<bool> _is_stopped;
+
+    std::size_t place_timer() noexcept;
+    std::size_t place_timer(std::size_t key) noexcept;
+
+    template <typename R, typename P, typename F>
+    std::size_t delay_on(std::size_t index, std::chrono::duration<R, P> after, F&& callback)
+    {
+        typename std::decay<F>::type cb (std::forward<F>(callback));
+        post_to(index, [after, cb](event_loop& loop) { loop.delay(after, cb); });
+        return index;
+    }
+
+    template <typename R, typename P, typename F>
+    std::size_t repeat_on(std::size_t index, std::chrono::duration<R, P> interval, F&& callback)
+    {
+        typename std::decay<F>::type cb (std::forward<F>(callback));
+        post_to(index, [interval, cb](event_loop& loop) { loop.repeat(interval, cb); });
+        return index;
+    }
+};
+
+}
+
+#endif
+
@@ -0,0 +1,154 @@
+#include "offload_pool.hpp"
+
+namespace utils {
+
+// The worker running on this thread, so that tasks submitted from a task go
+// to the worker's own deque.
+static thread_local offload_pool* current_pool = nullptr;
+static thread_local std::size_t current_worker = 0;
+
+offload_pool::offload_pool(std::size_t thread_count, std::size_t capacity)
+    : _capacity(capacity),
+      _queued(0),
+      _next(0),
+      _steals(0),
+      _sleepers(0),
+      _is_stopping(false)
+{
+    if (thread_count == 0)
+        thread_count = std::thread::hardware_concurrency();
+    if (thread_count == 0)
+        thread_count = 1;
+
+    _workers.reserve(thread_count);
+    for (std::size_t i = 0; i < thread_count; ++ i)
+        _workers.emplace_back(new worker);
+
+    for (std::size_t i = 0; i < thread_count; ++ i)
+        _workers[i]->thread = std::thread([this, i] { run(i); });
+}
+
+offload_pool::~offload_pool()
+{
+    stop();
+}
+
+offload_pool& offload_pool::shared()
+{
+    static offload_pool pool;
+    return pool;
+}
+
+bool offload_pool::try_submit(std::function<void()> task)
+{
+    if (_is_stopping.load())
+        return false;
+
+    // Reserve a slot first, so that the bound holds under contention.
+    if (_queued.fetch_add(1) >= _capacity)
+    {
+        _queued.fetch_sub(1);
+        return false;
+    }
+
+    std::size_t index;
+    if (current_pool == this)
+        index = current_worker;
+    else
+        index = _next.fetch_add(1, std::memory_order_relaxed) % _workers.size();
+
+    auto& w = *_workers[index];
+    {
+        std::lock_guard<std::mutex> lock (w.mutex);
+        w.tasks.push_back(std::move(task));
+    }
+
+    wake_one();
+    return true;
+}
+
+void offload_pool::wake_one()
+{
+    // Both this and a worker going to sleep update one counter and then read
+    // the other, so at least one of them notices the other.
+    if (_sleepers.load() == 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock (_sleep_mutex);
+    }
+    _wake.notify_one();
+}
+
+bool offload_pool::pop(std::size_t index, std::function<void()>& task)
+{
+    {
+        auto& own = *_workers[index];
+        std::lock_guard<std::mutex> lock (own.mutex);
+        if (!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    auto n = _workers.size();
+    for (std::size_t i = 1; i < n; ++ i)
+    {
+        auto& victim = *_workers[(index + i) % n];
+        std::lock_guard<std::mutex> lock (victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            _steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void offload_pool::run(std::size_t index)
+{
+    current_pool = this;
+    current_worker = index;
+
+    std::function<void()> task;
+    for (;;)
+    {
+        if (pop(index, task))
+        {
+            _queued.fetch_sub(1);
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock (_sleep_mutex);
+        if (_is_stopping.load() && _queued.load() == 0)
+            return;
+
+        _sleepers.fetch_add(1);
+        _wake.wait(lock, [this] { return _queued.load() != 0 || _is_stopping.load(); });
+        _sleepers.fetch_sub(1);
+    }
+}
+
+void offload_pool::stop()
+{
+    if (_is_stopping.exchange(true))
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock (_sleep_mutex);
+    }
+    _wake.notify_all();
+
+    for (auto& w : _workers)
+        if (w->thread.joinable())
+            w->thread.join();
+}
+
+}
+
@@ -0,0 +1,292 @@
+//-----------------------------------------------------------------
+// utils::offload_pool: Work-stealing threads for CPU-bound callbacks
+//-----------------------------------------------------------------
+//
+//          Copyright kennytm (auraHT Ltd.) 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file doc/LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef OFFLOAD_POOL_HPP_L2XD7RB4KQN
+#define OFFLOAD_POOL_HPP_L2XD7RB4KQN 1
+
+/**
+
+``<utils/offload_pool.hpp>`` --- CPU offloading
+===============================================
+
+A callback which compresses or parses a large buffer stalls every other event
+of its loop. This module runs such work on a pool of worker threads instead,
+and delivers the result back to the loop which asked for it, through
+:func:`~utils::event_loop::post`.
+
+Synopsis
+--------
+
+Compress a buffer without blocking the loop::
+
+    #include <utils/offload_pool.hpp>
+
+    loop.offload([data] { return compress(data); },
+                 [&](std::string compressed)
+                 {
+                     stream.write(compressed.data(), compressed.size());
+                 });
+
+Members
+-------
+
+.. function:: bool utils::event_loop::offload(F&& work, G&& then)
+
+    Run ``work()`` on the shared pool, then call ``then(result)`` (or
+    ``then()`` if *work* returns ``void``) on the thread of this loop. The
+    loop keeps running until *then* has been called. If *work* throws, the
+    exception is rethrown from the loop instead of calling *then*. Returns
+    ``false``, without running anything, if the queue of the pool is full.
+    *work* and *then* only need to be movable, so they may own buffers
+    through ``std::unique_ptr`` or hold a ``std::promise``.
+
+    Like :func:`~utils::event_loop::post`, the loop must not be destroyed
+    while offloaded work is in flight.
+
+.. type:: class utils::offload_pool final
+    :noncopyable:
+    :nonmovable:
+
+    A fixed set of worker threads. Every worker has its own deque of tasks:
+    tasks submitted by a worker go to the back of its own deque and are run
+    from there, in last-in first-out order, while tasks from other threads
+    are dealt to the workers in turn. A worker with an empty deque steals
+    from the front of the others' before it goes to sleep.
+
+    The number of queued tasks is bounded. Submitting to a full pool fails
+    instead of blocking, since the caller is usually an event loop which
+    should rather shed load or retry later.
+
+    .. function:: explicit offload_pool(std::size_t thread_count = 0, std::size_t capacity = 65536)
+
+        Start *thread_count* workers (one per hardware thread if 0), which
+        accept up to *capacity* queued tasks.
+
+    .. function:: static utils::offload_pool& shared()
+
+        The pool used by :func:`~utils::event_loop::offload`, which is created
+        with the default arguments on first use.
+
+    .. function:: bool try_submit(std::function<void()> task)
+
+        Queue *task* to run on a worker. May be called from any thread.
+        Returns ``false`` if the pool is full or stopped. An exception
+        escaping *task* calls ``std::terminate()``.
+
+    .. function:: bool offload(utils::event_loop& loop, F&& work, G&& then)
+
+        Same as :func:`~utils::event_loop::offload`, on this pool.
+
+    .. function:: std::size_t size() const noexcept
+                  std::size_t capacity() const noexcept
+                  std::size_t pending() const noexcept
+                  std::uint64_t steals() const noexcept
+
+        Number of workers, maximum and current number of queued tasks, and
+        how many tasks have been stolen so far.
+
+    .. function:: void stop()
+
+        Run the tasks which are already queued, and then join the workers.
+        Later submissions fail. The destructor calls this function.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <utils/event_loop.hpp>
+
+namespace utils {
+
+namespace xx_impl
+{
+    // Carries the result of the work back to the loop.
+    template <typename G, typename R>
+    struct offload_reply
+    {
+        G then;
+        std::unique_ptr<R> result;
+        std::exception_ptr error;
+
+        explicit offload_reply(G&& then)
+            : then(std::move(then))
+        {}
+
+        template <typename F>
+        void run(F& work)
+        {
+            result.reset(new R(work()));
+        }
+
+        void operator()(event_loop& loop)
+        {
+            loop.release();
+            if (error)
+                std::rethrow_exception(error);
+            then(std::move(*result));
+        }
+    };
+
+    template <typename G>
+    struct offload_reply<G, void>
+    {
+        G then;
+        std::exception_ptr error;
+
+        explicit offload_reply(G&& then)
+            : then(std::move(then))
+        {}
+
+        template <typename F>
+        void run(F& work)
+        {
+            work();
+        }
+
+        void operator()(event_loop& loop)
+        {
+            loop.release();
+            if (error)
+                std::rethrow_exception(error);
+            then();
+        }
+    };
+
+    template <typename F, typename G, typename R>
+    struct offload_task
+    {
+        F work;
+        offload_reply<G, R> reply;
+        event_loop* loop;
+
+        offload_task(F&& work, G&& then, event_loop& loop)
+            : work(std::move(work)), reply(std::move(then)), loop(&loop)
+        {}
+
+        void operator()()
+        {
+            try
+            {
+                reply.run(work);
+            }
+            catch (...)
+            {
+                reply.error = std::current_exception();
+            }
+        }
+    };
+
+    // Queued tasks and posted callbacks are std::functions, which must be
+    // copyable, while the work and its continuation may be move-only. They
+    // share one task instead, which goes from the worker to the loop.
+    template <typename Task>
+    struct offload_delivery
+    {
+        std::shared_ptr<Task> task;
+
+        void operator()(event_loop& loop) { task->reply(loop); }
+    };
+
+    template <typename Task>
+    struct offload_handoff
+    {
+        std::shared_ptr<Task> task;
+
+        void operator()()
+        {
+            (*task)();
+            auto loop = task->loop;
+            loop->post(offload_delivery<Task> {std::move(task)});
+        }
+    };
+}
+
+class offload_pool final
+{
+public:
+    explicit offload_pool(std::size_t thread_count = 0, std::size_t capacity = 65536);
+    ~offload_pool();
+
+    offload_pool(const offload_pool&) = delete;
+    offload_pool& operator=(const offload_pool&) = delete;
+
+    static offload_pool& shared();
+
+    std::size_t size() const noexcept { return _workers.size(); }
+    std::size_t capacity() const noexcept { return _capacity; }
+    std::size_t pending() const noexcept { return _queued.load(std::memory_order_relaxed); }
+    std::uint64_t steals() const noexcept { return _steals.load(std::memory_order_relaxed); }
+
+    bool try_submit(std::function<void()> task);
+
+    template <typename F, typename G>
+    bool offload(event_loop& loop, F&& work, G&& then)
+    {
+        typedef typename std::decay<F>::type work_type;
+        typedef typename std::decay<G>::type then_type;
+        typedef decltype(std::declval<work_type&>()()) result_type;
+
+        typedef xx_impl::offload_task<work_type, then_type, typename std::decay<result_type>::type> task_type;
+        xx_impl::offload_handoff<task_type> handoff {std::make_shared<task_type>(
+            work_type(std::forward<F>(work)), then_type(std::forward<G>(then)), loop)};
+
+        // Posted callbacks alone do not keep the loop running.
+        loop.hold();
+        if (try_submit(std::move(handoff)))
+            return true;
+
+        loop.release();
+        return false;
+    }
+
+    void stop();
+
+private:
+    struct worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<worker>> _workers;
+    std::size_t _capacity;
+    std::atomic<std::size_t> _queued;
+    std::atomic<std::size_t> _next;
+    std::atomic<std::uint64_t> _steals;
+
+    std::mutex _sleep_mutex;
+    std::condition_variable _wake;
+    std::atomic<std::size_t> _sleepers;
+    std::atomic<bool> _is_stopping;
+
+    void run(std::size_t index);
+    bool pop(std::size_t index, std::function<void()>& task);
+    void wake_one();
+};
+
+template <typename F, typename G>
+bool event_loop::offload(F&& work, G&& then)
+{
+    return offload_pool::shared().offload(*this, std::forward<F>(work), std::forward<G>(then));
+}
+
+}
+
+#endif
+
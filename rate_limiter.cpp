@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <stdexcept>
+#include "rate_limiter.hpp"
+
+namespace utils {
+
+//{{{ Bucket
+
+// A timer may go off a little early by the bucket's reckoning; a deficit of
+// less than this many seconds' worth of tokens counts as none.
+static constexpr double timer_slack = 1e-6;
+
+rate_limiter::rate_limiter(event_loop& loop, double rate, double burst)
+    : _loop(loop), _rate(rate), _burst(burst), _tokens(burst), _refilled_at(0)
+{
+    if (!(rate > 0) || !(burst > 0))
+        throw std::invalid_argument("rate_limiter: rate and burst must be positive");
+    _refilled_at = now();
+}
+
+double rate_limiter::now() const noexcept
+{
+    using namespace std::chrono;
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    return duration_cast<duration<double>>(_loop.now()).count();
+#else
+    return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void rate_limiter::refill() noexcept
+{
+    double t = now();
+    _tokens = std::min(_burst, _tokens + (t - _refilled_at) * _rate);
+    _refilled_at = t;
+}
+
+double rate_limiter::available()
+{
+    refill();
+    return std::max(_tokens, 0.0);
+}
+
+bool rate_limiter::try_acquire(double n)
+{
+    refill();
+    if (_waiters.empty() && _tokens >= n)
+    {
+        _tokens -= n;
+        ++ _stats.granted;
+        return true;
+    }
+    ++ _stats.rejected;
+    return false;
+}
+
+//}}}
+
+//{{{ Waiting
+
+void rate_limiter::acquire_async(double n, acquire_func callback)
+{
+    if (!(n <= _burst))
+        throw std::invalid_argument("rate_limiter: more tokens requested than the burst size");
+
+    refill();
+    if (_waiters.empty() && _tokens >= n)
+    {
+        _tokens -= n;
+        ++ _stats.granted;
+        callback();
+        return;
+    }
+
+    waiter w = {n, _refilled_at, std::move(callback)};
+    _waiters.push_back(std::move(w));
+    ++ _stats.throttled;
+    // Later waiters are released by the timer of the first one.
+    if (_waiters.size() == 1)
+        schedule();
+}
+
+void rate_limiter::cancel_waiting()
+{
+    _waiters.clear();
+    _timer.reset();
+}
+
+void rate_limiter::schedule()
+{
+    using namespace std::chrono;
+    double wait = std::max(_waiters.front().n - _tokens, 0.0) / _rate;
+    _timer.reset(_loop, _loop.delay(duration<double>(wait), [this]
+    {
+        // The timer is gone once it fires.
+        _timer.release();
+        release();
+    }));
+}
+
+void rate_limiter::release()
+{
+    refill();
+    while (!_waiters.empty() && _tokens >= _waiters.front().n - timer_slack * _rate)
+    {
+        waiter w = std::move(_waiters.front());
+        _waiters.pop_front();
+        _tokens -= w.n;
+        ++ _stats.granted;
+        _stats.throttled_time += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>(_refilled_at - w.since));
+        // The callback may acquire more, which refills the bucket again.
+        w.callback();
+        refill();
+    }
+
+    if (!_waiters.empty() && !_timer.get_pool())
+        schedule();
+}
+
+//}}}
+
+}
+
@@ -0,0 +1,157 @@
+//----------------------------------------------------------------
+// utils::rate_limiter: Token bucket paced by an event_loop
+//----------------------------------------------------------------
+//
+//          Copyright kennytm (auraHT Ltd.) 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file doc/LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef RATE_LIMITER_HPP_K4RW9ZB6TQE
+#define RATE_LIMITER_HPP_K4RW9ZB6TQE 1
+
+/**
+
+``<utils/rate_limiter.hpp>`` --- Rate limiting
+==============================================
+
+This module limits how fast something happens, e.g. bytes written to a socket
+or retries sent to a server, with a token bucket: tokens accumulate at a fixed
+rate up to a burst size, and every operation takes some of them. Callers
+either take tokens if there are enough right now, or queue up to be called
+back in order once there are. All queued callers of a limiter share one timer
+of the loop, which is due exactly when the first of them can proceed.
+
+Synopsis
+--------
+
+Sending at most 1 MB/s, in bursts of up to 64 kB::
+
+    #include <utils/rate_limiter.hpp>
+
+    utils::rate_limiter limiter (loop, 1 << 20, 1 << 16);
+
+    void send_chunk(const std::string& chunk)
+    {
+        limiter.acquire_async(chunk.size(), [=] { write_all(fd, chunk); });
+    }
+
+Members
+-------
+
+.. type:: struct utils::rate_limiter_stats
+
+    Counters of a :type:`utils::rate_limiter`. ``granted`` is the number of
+    acquisitions which succeeded, at once or after waiting; ``rejected`` the
+    number of failed :func:`~utils::rate_limiter::try_acquire` calls;
+    ``throttled`` the number of :func:`~utils::rate_limiter::acquire_async`
+    calls which had to wait, and ``throttled_time`` the total time they
+    waited.
+
+.. type:: class utils::rate_limiter final
+    :noncopyable:
+    :nonmovable:
+
+    A token bucket bound to an :type:`utils::event_loop`, which must outlive
+    it. It starts full. Tokens are counted as ``double``, so *n* may be a
+    number of bytes as well as of requests.
+
+    .. function:: rate_limiter(utils::event_loop& loop, double rate, double burst)
+
+        Create a bucket refilled with *rate* tokens per second, holding at
+        most *burst* tokens. Throws ``std::invalid_argument`` unless both are
+        positive.
+
+    .. function:: bool try_acquire(double n = 1)
+
+        Take *n* tokens and return ``true`` if there are enough, otherwise
+        return ``false`` and take nothing. Never jumps the queue of
+        :func:`acquire_async`.
+
+    .. function:: void acquire_async(double n, std::function<void()> callback)
+
+        Take *n* tokens and call *callback* once there are enough. If there
+        are enough now and nobody is waiting, *callback* is called before this
+        function returns; otherwise it is queued, and queued callbacks are
+        called in order from the loop. Throws ``std::invalid_argument`` if
+        *n* exceeds the burst size, which could never be satisfied. Callbacks
+        must not destroy the limiter.
+
+    .. function:: void cancel_waiting()
+
+        Drop every queued callback without calling it.
+
+    .. function:: double available()
+                  std::size_t waiting() const noexcept
+
+        The number of tokens in the bucket, and the number of queued
+        callbacks.
+
+    .. function:: const utils::rate_limiter_stats& stats() const noexcept
+*/
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utils/event_loop.hpp>
+
+namespace utils {
+
+struct rate_limiter_stats
+{
+    std::uint64_t granted;
+    std::uint64_t rejected;
+    std::uint64_t throttled;
+    std::chrono::nanoseconds throttled_time;
+
+    rate_limiter_stats() noexcept : granted(0), rejected(0), throttled(0), throttled_time(0) {}
+};
+
+class rate_limiter final
+{
+public:
+    typedef std::function<void()> acquire_func;
+
+    rate_limiter(event_loop& loop, double rate, double burst);
+
+    rate_limiter(const rate_limiter&) = delete;
+    rate_limiter& operator=(const rate_limiter&) = delete;
+
+    bool try_acquire(double n = 1);
+    void acquire_async(double n, acquire_func callback);
+    void cancel_waiting();
+
+    double available();
+    std::size_t waiting() const noexcept { return _waiters.size(); }
+    const rate_limiter_stats& stats() const noexcept { return _stats; }
+
+private:
+    struct waiter
+    {
+        double n;
+        double since;
+        acquire_func callback;
+    };
+
+    double now() const noexcept;
+    void refill() noexcept;
+    void schedule();
+    void release();
+
+    event_loop& _loop;
+    double _rate;
+    double _burst;
+    double _tokens;
+    double _refilled_at;
+
+    std::deque<waiter> _waiters;
+    unique_event _timer;
+    rate_limiter_stats _stats;
+};
+
+}
+
+#endif
+
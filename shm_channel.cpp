@@ -0,0 +1,260 @@
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_channel.hpp"
+
+namespace utils {
+
+//{{{ Layout
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shm_channel needs address-free atomics to share them between processes");
+
+static constexpr std::size_t cache_line = 64;
+static constexpr std::uint64_t channel_magic = 0x6c6e6e6168636d73;  // "smchannl"
+// Marks the rest of the ring as unused, because the next record did not fit.
+static constexpr std::uint32_t wrap_marker = ~std::uint32_t(0);
+// A record is its 32-bit length, padded so that the data is aligned for any
+// type.
+static constexpr std::size_t record_header_size = 16;
+
+namespace xx_impl
+{
+    // The start of the shared memory. Each side writes its own cache line.
+    struct shm_channel_header
+    {
+        alignas(cache_line) std::uint64_t magic;
+        std::uint64_t capacity;
+
+        // Written by the producer.
+        alignas(cache_line) std::atomic<std::uint64_t> tail;
+        // Written by the consumer.
+        alignas(cache_line) std::atomic<std::uint64_t> head;
+        // Set by the consumer before sleeping, cleared by whoever wakes it.
+        alignas(cache_line) std::atomic<std::uint32_t> is_waiting;
+    };
+}
+
+static std::size_t record_span(std::size_t size) noexcept
+{
+    return (record_header_size + size + cache_line - 1) & ~(cache_line - 1);
+}
+
+//}}}
+
+//{{{ Setup
+
+shm_channel::shm_channel(std::size_t capacity)
+    : _header(nullptr), _ring(nullptr), _capacity(4 * cache_line),
+      _known_head(0), _known_tail(0), _batch(0)
+{
+    while (_capacity < capacity)
+        _capacity *= 2;
+
+    _memory.reset(posix::checked(memfd_create("utils::shm_channel", MFD_CLOEXEC)));
+    _notify.reset(posix::checked(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)));
+    posix::checked(ftruncate(_memory.get(), sizeof(xx_impl::shm_channel_header) + _capacity));
+    map();
+
+    // The fresh memory is zero, which is also the initial state of the
+    // positions; the magic number makes the channel valid for attaching.
+    new (_header) xx_impl::shm_channel_header;
+    _header->capacity = _capacity;
+    _header->tail.store(0, std::memory_order_relaxed);
+    _header->head.store(0, std::memory_order_relaxed);
+    _header->is_waiting.store(0, std::memory_order_relaxed);
+    _header->magic = channel_magic;
+}
+
+shm_channel::shm_channel(posix::unique_fd memory, posix::unique_fd notify)
+    : _memory(std::move(memory)), _notify(std::move(notify)),
+      _header(nullptr), _ring(nullptr), _capacity(0),
+      _known_head(0), _known_tail(0), _batch(0)
+{
+    struct stat st;
+    posix::checked(fstat(_memory.get(), &st));
+    if (static_cast<std::size_t>(st.st_size) < sizeof(xx_impl::shm_channel_header))
+        throw std::system_error(EINVAL, std::generic_category());
+
+    // Positions are masked into the ring, so it must be a power of two, and
+    // at least as large as a new channel makes it.
+    _capacity = st.st_size - sizeof(xx_impl::shm_channel_header);
+    if (_capacity < 4 * cache_line || (_capacity & (_capacity - 1)) != 0)
+        throw std::system_error(EINVAL, std::generic_category());
+    map();
+    if (_header->magic != channel_magic || _header->capacity != _capacity)
+    {
+        munmap(_header, sizeof(xx_impl::shm_channel_header) + _capacity);
+        throw std::system_error(EINVAL, std::generic_category());
+    }
+
+    _known_head = _header->head.load(std::memory_order_acquire);
+    _known_tail = _header->tail.load(std::memory_order_acquire);
+}
+
+shm_channel::~shm_channel()
+{
+    _watch.reset();
+    munmap(_header, sizeof(xx_impl::shm_channel_header) + _capacity);
+}
+
+void shm_channel::map()
+{
+    std::size_t size = sizeof(xx_impl::shm_channel_header) + _capacity;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _memory.get(), 0);
+    if (memory == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category());
+    _header = static_cast<xx_impl::shm_channel_header*>(memory);
+    _ring = static_cast<char*>(memory) + sizeof(xx_impl::shm_channel_header);
+}
+
+std::size_t shm_channel::max_message_size() const noexcept
+{
+    // A record may have to skip the end of the ring, so only one of at most
+    // half the ring is sure to fit once the consumer catches up.
+    return _capacity / 2 - record_header_size;
+}
+
+//}}}
+
+//{{{ Producer
+
+bool shm_channel::try_send(const void* data, std::size_t size)
+{
+    if (size > max_message_size())
+        throw std::system_error(std::make_error_code(std::errc::message_size));
+
+    std::uint64_t tail = _header->tail.load(std::memory_order_relaxed);
+    std::size_t offset = tail & (_capacity - 1);
+    std::size_t to_end = _capacity - offset;
+    std::size_t span = record_span(size);
+    std::size_t needed = span > to_end ? to_end + span : span;
+
+    if (tail + needed - _known_head > _capacity)
+    {
+        _known_head = _header->head.load(std::memory_order_acquire);
+        if (tail + needed - _known_head > _capacity)
+            return false;
+    }
+
+    if (span > to_end)
+    {
+        std::memcpy(_ring + offset, &wrap_marker, sizeof(wrap_marker));
+        tail += to_end;
+        offset = 0;
+    }
+
+    std::uint32_t length = static_cast<std::uint32_t>(size);
+    std::memcpy(_ring + offset, &length, sizeof(length));
+    std::memcpy(_ring + offset + record_header_size, data, size);
+    _header->tail.store(tail + span, std::memory_order_release);
+
+    // Pairs with the fence in on_notified(): either the consumer sees the new
+    // tail, or we see it waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_header->is_waiting.load(std::memory_order_relaxed)
+            && _header->is_waiting.exchange(0, std::memory_order_relaxed))
+        wake_up();
+
+    return true;
+}
+
+void shm_channel::wake_up() noexcept
+{
+    eventfd_write(_notify.get(), 1);
+}
+
+//}}}
+
+//{{{ Consumer
+
+bool shm_channel::is_empty() noexcept
+{
+    std::uint64_t head = _header->head.load(std::memory_order_relaxed);
+    if (head != _known_tail)
+        return false;
+    _known_tail = _header->tail.load(std::memory_order_acquire);
+    return head == _known_tail;
+}
+
+std::size_t shm_channel::receive(const message_func& callback, std::size_t max_count)
+{
+    std::uint64_t head = _header->head.load(std::memory_order_relaxed);
+    std::size_t count = 0;
+
+    while (count < max_count)
+    {
+        if (head == _known_tail)
+        {
+            _known_tail = _header->tail.load(std::memory_order_acquire);
+            if (head == _known_tail)
+                break;
+        }
+
+        // The other side may be buggy or hostile, so a record must not
+        // reach past the end of the ring.
+        std::size_t offset = head & (_capacity - 1);
+        if (offset & (cache_line - 1))
+            throw std::system_error(EBADMSG, std::generic_category());
+        std::uint32_t length;
+        std::memcpy(&length, _ring + offset, sizeof(length));
+        if (length == wrap_marker)
+        {
+            head += _capacity - offset;
+            continue;
+        }
+        if (length > _capacity - offset - record_header_size)
+            throw std::system_error(EBADMSG, std::generic_category());
+
+        callback(_ring + offset + record_header_size, length);
+        head += record_span(length);
+        ++ count;
+        // Free the space at once, so the producer can refill it while the
+        // rest of the batch is processed.
+        _header->head.store(head, std::memory_order_release);
+    }
+
+    _header->head.store(head, std::memory_order_release);
+    return count;
+}
+
+void shm_channel::listen(event_loop& loop, message_func callback, std::size_t batch)
+{
+    _callback = std::move(callback);
+    _batch = batch ? batch : 1;
+    _watch = unique_event(loop, loop.listen(_notify.get(), [this](int)
+    {
+        on_notified();
+    }));
+    // Drain whatever was sent before, which also arms the notification.
+    wake_up();
+}
+
+void shm_channel::on_notified()
+{
+    eventfd_t value;
+    eventfd_read(_notify.get(), &value);
+
+    if (receive(_callback, _batch) == _batch && !is_empty())
+    {
+        // Come back on the next iteration for the rest.
+        wake_up();
+        return;
+    }
+
+    _header->is_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!is_empty() && _header->is_waiting.exchange(0, std::memory_order_relaxed))
+        wake_up();
+}
+
+//}}}
+
+}
+
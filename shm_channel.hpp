@@ -0,0 +1,170 @@
+//----------------------------------------------------------------
+// utils::shm_channel: Shared-memory message ring between processes
+//----------------------------------------------------------------
+//
+//          Copyright kennytm (auraHT Ltd.) 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file doc/LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef SHM_CHANNEL_HPP_W7TD2QX5LNC
+#define SHM_CHANNEL_HPP_W7TD2QX5LNC 1
+
+/**
+
+``<utils/shm_channel.hpp>`` --- Shared-memory channels
+======================================================
+
+This module passes messages from one producer to one consumer, usually in
+different processes, through a lock-free ring in shared memory. Sending a
+message is a copy into the ring and no system call; the consumer is woken up
+through an ``eventfd`` only when the ring goes from empty to non-empty, and
+then drains every message that arrived meanwhile in one batch.
+
+Synopsis
+--------
+
+A parent process sending to a child::
+
+    #include <utils/shm_channel.hpp>
+
+    utils::shm_channel channel (1 << 20);
+    if (fork() == 0)
+    {
+        channel.listen(loop, [](const char* data, std::size_t size)
+        {
+            handle(data, size);
+        });
+        loop.run();
+    }
+    else
+    {
+        while (!channel.try_send("hello", 5))
+            wait_a_bit();
+    }
+
+Unrelated processes attach to the channel by passing :func:`memory_fd` and
+:func:`notify_fd` over a Unix socket, and constructing a channel from them.
+
+Members
+-------
+
+.. type:: class utils::shm_channel final
+    :noncopyable:
+    :nonmovable:
+
+    One end of a single-producer/single-consumer ring of variable-length
+    messages, in memory from ``memfd_create()``. Every message starts on a
+    cache line of its own, and its data is aligned to 16 bytes. At any time
+    only one object (in any process) may send, and only one may receive.
+
+    .. function:: explicit shm_channel(std::size_t capacity)
+
+        Create a new channel whose ring holds *capacity* bytes, rounded up to
+        a power of two.
+
+    .. function:: shm_channel(utils::posix::unique_fd memory, utils::posix::unique_fd notify)
+
+        Attach to a channel created elsewhere, from its shared memory and
+        ``eventfd``. Throws ``std::system_error`` with ``EINVAL`` if *memory*
+        does not hold a channel, or one whose ring is not a power of two.
+
+    .. function:: int memory_fd() const noexcept
+                  int notify_fd() const noexcept
+
+        The file descriptors to pass to another process.
+
+    .. function:: std::size_t capacity() const noexcept
+                  std::size_t max_message_size() const noexcept
+
+        The size of the ring, and of the longest message it accepts, which is
+        a little less than half of it.
+
+    .. function:: bool try_send(const void* data, std::size_t size)
+
+        Append a message to the ring. Returns ``false`` if the ring is too
+        full, so the producer decides whether to retry, drop or apply
+        backpressure. A message longer than :func:`max_message_size` throws
+        ``std::system_error`` with ``std::errc::message_size``.
+
+    .. function:: std::size_t receive(const std::function<void(const char* data, std::size_t size)>& callback, std::size_t max_count = SIZE_MAX)
+
+        Call *callback* with up to *max_count* messages which are in the ring,
+        and return how many there were. The views are only valid during the
+        call. A record which would reach past the end of the ring, as written
+        by a corrupt or hostile producer, throws ``std::system_error`` with
+        ``EBADMSG``; the messages before it have been consumed, and the
+        channel cannot be used any more.
+
+    .. function:: void listen(utils::event_loop& loop, std::function<void(const char* data, std::size_t size)> callback, std::size_t batch = 64)
+                  void stop_listening()
+
+        Receive messages on *loop*, calling *callback* with at most *batch*
+        of them per iteration of the loop, so a busy producer cannot starve
+        other events. Callbacks must not destroy the channel.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utils/event_loop.hpp>
+#include <utils/ext/posix.hpp>
+
+namespace utils {
+
+namespace xx_impl
+{
+    struct shm_channel_header;
+}
+
+class shm_channel final
+{
+public:
+    typedef std::function<void(const char*, std::size_t)> message_func;
+
+    explicit shm_channel(std::size_t capacity);
+    shm_channel(posix::unique_fd memory, posix::unique_fd notify);
+    ~shm_channel();
+
+    shm_channel(const shm_channel&) = delete;
+    shm_channel& operator=(const shm_channel&) = delete;
+
+    int memory_fd() const noexcept { return _memory.get(); }
+    int notify_fd() const noexcept { return _notify.get(); }
+
+    std::size_t capacity() const noexcept { return _capacity; }
+    std::size_t max_message_size() const noexcept;
+
+    bool try_send(const void* data, std::size_t size);
+
+    std::size_t receive(const message_func& callback, std::size_t max_count = SIZE_MAX);
+
+    void listen(event_loop& loop, message_func callback, std::size_t batch = 64);
+    void stop_listening() { _watch.reset(); }
+
+private:
+    void map();
+    bool is_empty() noexcept;
+    void wake_up() noexcept;
+    void on_notified();
+
+    posix::unique_fd _memory;
+    posix::unique_fd _notify;
+    xx_impl::shm_channel_header* _header;
+    char* _ring;
+    std::size_t _capacity;
+
+    // Last known positions of the other side, to touch its cache line only
+    // when the ring looks full (producer) or empty (consumer).
+    std::uint64_t _known_head;
+    std::uint64_t _known_tail;
+
+    unique_event _watch;
+    message_func _callback;
+    std::size_t _batch;
+};
+
+}
+
+#endif
+
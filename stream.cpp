@@ -0,0 +1,498 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "stream.hpp"
+
+namespace utils {
+
+//{{{ buffer_pool
+
+buffer_pool::buffer_pool(std::size_t chunk_size, std::size_t max_idle)
+    : _chunk_size(chunk_size < 16 ? 16 : chunk_size),
+      _max_idle(max_idle)
+{}
+
+buffer_pool::chunk buffer_pool::acquire()
+{
+    if (_idle.empty())
+        return chunk(new char[_chunk_size]);
+    auto c = std::move(_idle.back());
+    _idle.pop_back();
+    return c;
+}
+
+void buffer_pool::release(chunk&& c) noexcept
+{
+    if (!c || _idle.size() >= _max_idle)
+    {
+        c.reset();
+        return;
+    }
+    // The vector never shrinks, so pushing back only allocates while the
+    // number of idle chunks reaches a new high.
+    try
+    {
+        _idle.push_back(std::move(c));
+    }
+    catch (...)
+    {
+        c.reset();
+    }
+}
+
+//}}}
+
+//{{{ stream
+
+static constexpr std::size_t frame_header_size = 4;
+// Chunks sent by one gathering write at most.
+static constexpr int max_iov = 64;
+
+namespace
+{
+    // Set the flag of a stream pointing to this frame if the stream is
+    // destroyed during a callback.
+    class destroy_guard
+    {
+    public:
+        explicit destroy_guard(bool*& slot) noexcept : _slot(slot), _is_destroyed(false)
+        {
+            _slot = &_is_destroyed;
+        }
+
+        ~destroy_guard()
+        {
+            if (!_is_destroyed)
+                _slot = nullptr;
+        }
+
+        bool is_destroyed() const noexcept { return _is_destroyed; }
+
+    private:
+        bool*& _slot;
+        bool _is_destroyed;
+    };
+}
+
+stream::stream(event_loop& loop, buffer_pool& pool, posix::unique_fd fd)
+    : _loop(loop),
+      _pool(pool),
+      _fd(std::move(fd)),
+      _watcher(0),
+      _events(0),
+      _framing(framing::none),
+      _delimiter('\n'),
+      _in_begin(0),
+      _in_end(0),
+      _in_scanned(0),
+      _pending_write(0),
+      _flush(0),
+      _deferred_read(0),
+      _is_closing(false),
+      _is_write_blocked(false),
+      _is_socket(true),
+      _destroyed(nullptr)
+{}
+
+stream::~stream()
+{
+    if (_destroyed)
+        *_destroyed = true;
+    shutdown();
+}
+
+void stream::read_some(message_func callback)
+{
+    start_reading(framing::some, std::move(callback));
+}
+
+void stream::read_lines(char delimiter, message_func callback)
+{
+    _delimiter = delimiter;
+    start_reading(framing::lines, std::move(callback));
+}
+
+void stream::read_frames(message_func callback)
+{
+    start_reading(framing::frames, std::move(callback));
+}
+
+void stream::start_reading(framing mode, message_func&& callback)
+{
+    if (!_fd || _is_closing)
+        return;
+
+    _framing = mode;
+    _on_message = std::move(callback);
+    _in_scanned = _in_begin;
+    update_events();
+
+    // Data left over from the previous framing will not make the fd readable
+    // again.
+    if (_in_begin < _in_end && !_deferred_read)
+    {
+        _deferred_read = _loop.delay([this]
+        {
+            _deferred_read = 0;
+            dispatch();
+        });
+    }
+}
+
+void stream::pause_reading()
+{
+    _framing = framing::none;
+    update_events();
+}
+
+void stream::update_events()
+{
+    if (!_fd)
+        return;
+
+    int events = 0;
+    if (_framing != framing::none && !_is_closing)
+        events |= io_read;
+    if (_is_write_blocked)
+        events |= io_write;
+    if (events == _events)
+        return;
+
+    _events = events;
+    if (_watcher)
+    {
+        _loop.modify(_watcher, events);
+    }
+    else
+    {
+        _watcher = _loop.listen(_fd.get(), events, [this](int, int revents)
+        {
+            on_ready(revents);
+        });
+    }
+}
+
+void stream::on_ready(int revents)
+{
+    if (revents & io_read)
+        if (!handle_read())
+            return;
+    if ((revents & io_write) && _fd)
+    {
+        _is_write_blocked = false;
+        flush();
+    }
+}
+
+bool stream::handle_read()
+{
+    if (!_in)
+    {
+        _in = _pool.acquire();
+        _in_begin = _in_end = _in_scanned = 0;
+    }
+
+    auto space = _pool.chunk_size() - _in_end;
+    if (space == 0)
+        return fail(std::make_error_code(std::errc::message_size));
+
+    auto res = ::read(_fd.get(), _in.get() + _in_end, space);
+    if (res < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            compact_input();
+            return true;
+        }
+        return fail(std::error_code(errno, std::generic_category()));
+    }
+    if (res == 0)
+        return fail(std::error_code());
+
+    _in_end += static_cast<std::size_t>(res);
+    return dispatch();
+}
+
+bool stream::dispatch()
+{
+    // The callback is moved out, so that it may replace itself by switching
+    // the framing.
+    message_func callback;
+    callback.swap(_on_message);
+
+    auto chunk_size = _pool.chunk_size();
+    while (_framing != framing::none && _in_begin < _in_end)
+    {
+        auto data = _in.get();
+        const char* message;
+        std::size_t size;
+
+        switch (_framing)
+        {
+            case framing::some:
+                message = data + _in_begin;
+                size = _in_end - _in_begin;
+                _in_begin = _in_end;
+                break;
+
+            case framing::lines:
+            {
+                auto from = std::max(_in_scanned, _in_begin);
+                auto found = static_cast<const char*>(memchr(data + from, _delimiter, _in_end - from));
+                if (!found)
+                {
+                    _in_scanned = _in_end;
+                    goto incomplete;
+                }
+                message = data + _in_begin;
+                size = static_cast<std::size_t>(found - message);
+                _in_begin = _in_scanned = static_cast<std::size_t>(found - data) + 1;
+                break;
+            }
+
+            case framing::frames:
+            {
+                if (_in_end - _in_begin < frame_header_size)
+                    goto incomplete;
+                auto header = reinterpret_cast<const unsigned char*>(data + _in_begin);
+                size = std::size_t(header[0]) << 24 | std::size_t(header[1]) << 16
+                     | std::size_t(header[2]) << 8 | std::size_t(header[3]);
+                if (size > chunk_size - frame_header_size)
+                    return fail(std::make_error_code(std::errc::message_size));
+                if (_in_end - _in_begin < frame_header_size + size)
+                    goto incomplete;
+                message = data + _in_begin + frame_header_size;
+                _in_begin += frame_header_size + size;
+                break;
+            }
+
+            default:
+                goto incomplete;
+        }
+
+        {
+            destroy_guard guard (_destroyed);
+            callback(message, size);
+            if (guard.is_destroyed())
+                return false;
+        }
+        if (_on_message)
+        {
+            callback.swap(_on_message);
+            _on_message = nullptr;
+        }
+        if (!_in)
+            return true;
+    }
+
+incomplete:
+    if (!_on_message)
+        _on_message.swap(callback);
+    compact_input();
+    return true;
+}
+
+void stream::compact_input()
+{
+    if (!_in)
+        return;
+
+    if (_in_begin == _in_end)
+    {
+        // Idle streams do not hold on to a chunk.
+        _pool.release(std::move(_in));
+        _in_begin = _in_end = _in_scanned = 0;
+    }
+    else if (_in_begin > 0 && _in_end == _pool.chunk_size())
+    {
+        // Only the incomplete message is copied, once the chunk is full.
+        memmove(_in.get(), _in.get() + _in_begin, _in_end - _in_begin);
+        _in_end -= _in_begin;
+        _in_scanned -= std::min(_in_scanned, _in_begin);
+        _in_begin = 0;
+    }
+}
+
+void stream::write(const void* data, std::size_t size)
+{
+    if (!_fd || _is_closing || size == 0)
+        return;
+    enqueue(data, size);
+    schedule_flush();
+}
+
+void stream::write_frame(const void* data, std::size_t size)
+{
+    if (!_fd || _is_closing)
+        return;
+    unsigned char header[frame_header_size] = {
+        static_cast<unsigned char>(size >> 24),
+        static_cast<unsigned char>(size >> 16),
+        static_cast<unsigned char>(size >> 8),
+        static_cast<unsigned char>(size)
+    };
+    enqueue(header, sizeof(header));
+    enqueue(data, size);
+    schedule_flush();
+}
+
+void stream::enqueue(const void* data, std::size_t size)
+{
+    auto bytes = static_cast<const char*>(data);
+    auto chunk_size = _pool.chunk_size();
+    while (size > 0)
+    {
+        if (_out.empty() || _out.back().end == chunk_size)
+            _out.push_back(out_chunk {_pool.acquire(), 0, 0});
+
+        auto& c = _out.back();
+        auto n = std::min(size, chunk_size - c.end);
+        memcpy(c.data.get() + c.end, bytes, n);
+        c.end += n;
+        bytes += n;
+        size -= n;
+        _pending_write += n;
+    }
+}
+
+void stream::schedule_flush()
+{
+    if (_flush || _is_write_blocked)
+        return;
+    _flush = _loop.delay([this]
+    {
+        _flush = 0;
+        flush();
+    });
+}
+
+bool stream::flush()
+{
+    while (!_out.empty())
+    {
+        struct iovec iov[max_iov];
+        int count = 0;
+        std::size_t total = 0;
+        for (auto it = _out.begin(); it != _out.end() && count < max_iov; ++ it, ++ count)
+        {
+            iov[count].iov_base = it->data.get() + it->begin;
+            iov[count].iov_len = it->end - it->begin;
+            total += iov[count].iov_len;
+        }
+
+        ssize_t res;
+        if (_is_socket)
+        {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+            res = sendmsg(_fd.get(), &msg, MSG_NOSIGNAL);
+            if (res < 0 && errno == ENOTSOCK)
+            {
+                _is_socket = false;
+                continue;
+            }
+        }
+        else
+        {
+            res = writev(_fd.get(), iov, count);
+        }
+
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return fail(std::error_code(errno, std::generic_category()));
+        }
+
+        auto written = static_cast<std::size_t>(res);
+        _pending_write -= written;
+        while (written > 0)
+        {
+            auto& front = _out.front();
+            auto n = std::min(written, front.end - front.begin);
+            front.begin += n;
+            written -= n;
+            if (front.begin == front.end)
+            {
+                _pool.release(std::move(front.data));
+                _out.pop_front();
+            }
+        }
+
+        // A short write means the kernel buffer is full.
+        if (static_cast<std::size_t>(res) < total)
+            break;
+    }
+
+    if (_out.empty() && _is_closing)
+    {
+        shutdown();
+        return true;
+    }
+
+    _is_write_blocked = !_out.empty();
+    update_events();
+    return true;
+}
+
+void stream::close()
+{
+    if (!_fd || _is_closing)
+        return;
+
+    _is_closing = true;
+    _framing = framing::none;
+    if (_out.empty())
+        shutdown();
+    else
+        update_events();
+}
+
+bool stream::fail(std::error_code error)
+{
+    shutdown();
+
+    // Moved out, so that the callback may destroy the stream.
+    auto callback = std::move(_on_close);
+    _on_close = nullptr;
+    if (!callback)
+        return true;
+
+    destroy_guard guard (_destroyed);
+    callback(error);
+    return !guard.is_destroyed();
+}
+
+void stream::shutdown() noexcept
+{
+    if (_watcher)
+        _loop.cancel(_watcher);
+    if (_flush)
+        _loop.cancel(_flush);
+    if (_deferred_read)
+        _loop.cancel(_deferred_read);
+    _watcher = _flush = _deferred_read = 0;
+    _events = 0;
+    _framing = framing::none;
+
+    if (_in)
+        _pool.release(std::move(_in));
+    _in_begin = _in_end = _in_scanned = 0;
+    for (auto& c : _out)
+        _pool.release(std::move(c.data));
+    _out.clear();
+    _pending_write = 0;
+
+    _fd.reset();
+}
+
+//}}}
+
+}
+
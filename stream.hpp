@@ -0,0 +1,256 @@
+//----------------------------------------------------------
+// utils::stream: Buffered I/O on a file descriptor in a loop
+//----------------------------------------------------------
+//
+//          Copyright kennytm (auraHT Ltd.) 2011.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file doc/LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef STREAM_HPP_G6NB2XK0RJE
+#define STREAM_HPP_G6NB2XK0RJE 1
+
+/**
+
+``<utils/stream.hpp>`` --- Buffered streams
+===========================================
+
+This module wraps a non-blocking file descriptor registered on a
+:type:`utils::event_loop`, so that protocol code deals with whole messages
+instead of writing its own read loop. Received data is read into fixed-size
+chunks borrowed from a :type:`utils::buffer_pool`, and messages are handed to
+the callback as views into the chunk, without copying. Outgoing data is queued
+in chunks from the same pool and sent with a single gathering write per
+iteration of the loop.
+
+Synopsis
+--------
+
+An echo server for newline-delimited messages::
+
+    #include <utils/stream.hpp>
+
+    utils::buffer_pool pool;
+
+    auto s = new utils::stream(loop, pool, utils::posix::unique_fd(client_fd));
+    s->on_close([s](std::error_code) { delete s; });
+    s->read_lines('\n', [s](const char* data, std::size_t size)
+    {
+        s->write(data, size);
+        s->write("\n", 1);
+    });
+
+Members
+-------
+
+.. type:: class utils::buffer_pool final
+    :noncopyable:
+
+    A cache of fixed-size chunks of memory. A pool is meant to be shared by
+    all streams of one event loop, and is not thread-safe. It must outlive the
+    streams using it.
+
+    .. function:: explicit buffer_pool(std::size_t chunk_size = 16384, std::size_t max_idle = 1024)
+
+        Create a pool of chunks of *chunk_size* bytes, keeping at most
+        *max_idle* unused chunks for reuse.
+
+    .. function:: std::size_t chunk_size() const noexcept
+                  std::size_t idle() const noexcept
+
+        The size of every chunk, and the number of chunks ready for reuse.
+
+    .. function:: utils::buffer_pool::chunk acquire()
+                  void release(utils::buffer_pool::chunk&& chunk) noexcept
+
+        Borrow a chunk (a ``std::unique_ptr<char[]>``), and give it back.
+
+.. type:: class utils::stream final
+    :noncopyable:
+    :nonmovable:
+
+    A buffered, message-oriented view of a non-blocking file descriptor.
+
+    A stream holds on to a read chunk only while it has an incomplete message,
+    so idle connections do not tie up memory. A message must fit in a chunk;
+    a longer one closes the stream with ``std::errc::message_size``. The
+    views passed to the message callback are only valid during the call.
+
+    Callbacks may destroy the stream.
+
+    .. function:: stream(utils::event_loop& loop, utils::buffer_pool& pool, utils::posix::unique_fd fd)
+
+        Take over the non-blocking file descriptor *fd*. Nothing is read until
+        one of the ``read_*`` functions is called.
+
+    .. function:: void read_some(std::function<void(const char* data, std::size_t size)> callback)
+                  void read_lines(char delimiter, std::function<void(const char* data, std::size_t size)> callback)
+                  void read_frames(std::function<void(const char* data, std::size_t size)> callback)
+
+        Start reading, and call *callback* with every chunk of data as it
+        arrives, every message terminated by *delimiter* (which is not
+        included), or every message prefixed by its length as a 32-bit
+        big-endian integer. Calling one of these again switches the framing
+        for the data not consumed yet.
+
+    .. function:: void pause_reading()
+
+        Stop reading until a ``read_*`` function is called again.
+
+    .. function:: void on_close(std::function<void(std::error_code error)> callback)
+
+        Call *callback* when the peer closes the stream (with an empty
+        *error*) or an I/O error occurs. The file descriptor has already been
+        closed at that point.
+
+    .. function:: void write(const void* data, std::size_t size)
+                  void write_frame(const void* data, std::size_t size)
+
+        Queue *data*, optionally prefixed by its length in the format of
+        ``read_frames``. Queued data is sent on the next iteration of the
+        loop, gathering everything written until then into one system call.
+
+    .. function:: std::size_t pending_write() const noexcept
+
+        Number of bytes queued and not yet sent.
+
+    .. function:: void close()
+
+        Stop reading, and close the file descriptor once all queued data is
+        sent. The close callback is not called. The destructor closes the
+        file descriptor at once, dropping the queued data.
+
+    .. function:: bool is_open() const noexcept
+                  int fd() const noexcept
+
+        Whether the file descriptor is still open, and its number.
+*/
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <system_error>
+#include <utils/event_loop.hpp>
+#include <utils/ext/posix.hpp>
+
+namespace utils {
+
+class buffer_pool final
+{
+public:
+    typedef std::unique_ptr<char[]> chunk;
+
+    explicit buffer_pool(std::size_t chunk_size = 16384, std::size_t max_idle = 1024);
+
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    std::size_t chunk_size() const noexcept { return _chunk_size; }
+    std::size_t idle() const noexcept { return _idle.size(); }
+
+    chunk acquire();
+    void release(chunk&& c) noexcept;
+
+private:
+    std::size_t _chunk_size;
+    std::size_t _max_idle;
+    std::vector<chunk> _idle;
+};
+
+class stream final
+{
+public:
+    typedef std::function<void(const char*, std::size_t)> message_func;
+    typedef std::function<void(std::error_code)> close_func;
+
+    stream(event_loop& loop, buffer_pool& pool, posix::unique_fd fd);
+    ~stream();
+
+    stream(const stream&) = delete;
+    stream& operator=(const stream&) = delete;
+
+    void read_some(message_func callback);
+    void read_lines(char delimiter, message_func callback);
+    void read_frames(message_func callback);
+    void pause_reading();
+
+    void on_close(close_func callback) { _on_close = std::move(callback); }
+
+    void write(const void* data, std::size_t size);
+    void write_frame(const void* data, std::size_t size);
+    std::size_t pending_write() const noexcept { return _pending_write; }
+
+    void close();
+
+    bool is_open() const noexcept { return static_cast<bool>(_fd); }
+    int fd() const noexcept { return _fd.get(); }
+
+private:
+    enum class framing
+    {
+        none,
+        some,
+        lines,
+        frames
+    };
+
+    struct out_chunk
+    {
+        buffer_pool::chunk data;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    event_loop& _loop;
+    buffer_pool& _pool;
+    posix::unique_fd _fd;
+    event_handle _watcher;
+    int _events;
+
+    framing _framing;
+    char _delimiter;
+    message_func _on_message;
+    close_func _on_close;
+
+    buffer_pool::chunk _in;
+    std::size_t _in_begin;
+    std::size_t _in_end;
+    // Lines only: where to continue looking for the delimiter.
+    std::size_t _in_scanned;
+
+    std::deque<out_chunk> _out;
+    std::size_t _pending_write;
+    event_handle _flush;
+    event_handle _deferred_read;
+    bool _is_closing;
+    // The last write was short, so the rest waits for the fd to be writable.
+    bool _is_write_blocked;
+    // Sockets are written with sendmsg(MSG_NOSIGNAL), so that a closed peer
+    // does not raise SIGPIPE.
+    bool _is_socket;
+
+    // Points to a flag in the frame of the callback being dispatched, which
+    // is set if the stream is destroyed meanwhile.
+    bool* _destroyed;
+
+    void start_reading(framing mode, message_func&& callback);
+    void update_events();
+    void on_ready(int revents);
+    // These return false if a callback has destroyed the stream.
+    bool handle_read();
+    bool dispatch();
+    void compact_input();
+    void enqueue(const void* data, std::size_t size);
+    void schedule_flush();
+    bool flush();
+    bool fail(std::error_code error);
+    void shutdown() noexcept;
+};
+
+}
+
+#endif
+
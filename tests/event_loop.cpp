@@ -1,6 +1,19 @@
+#include <algorithm>
+#include <array>
 #include <chrono>
 #include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <cerrno>
 #include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <boost/test/unit_test.hpp>
 #include <utils/event_loop.hpp>
 
@@ -14,6 +27,41 @@ struct null_output_iterator : std::iterator<std::output_iterator_tag, null_outpu
     null_output_iterator& operator*() noexcept { return *this; }
 };
 
+// Clocks as seen by the loop's timers, which are virtual under the simulated
+// backend, so that the timing checks below hold on every backend.
+static std::chrono::steady_clock::time_point loop_time(const utils::event_loop& loop)
+{
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    return std::chrono::steady_clock::time_point(loop.now());
+#else
+    (void) loop;
+    return std::chrono::steady_clock::now();
+#endif
+}
+
+static std::chrono::system_clock::time_point loop_wall_time(const utils::event_loop& loop)
+{
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(loop.now()));
+#else
+    (void) loop;
+    return std::chrono::system_clock::now();
+#endif
+}
+
+// Block the loop for a while, as a slow callback would.
+template <typename R, typename P>
+static void stall(utils::event_loop& loop, std::chrono::duration<R, P> duration)
+{
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    loop.advance(duration);
+#else
+    (void) loop;
+    std::this_thread::sleep_for(duration);
+#endif
+}
+
 BOOST_AUTO_TEST_SUITE(signals)
 
 BOOST_AUTO_TEST_CASE(imm_delay)
@@ -104,6 +152,51 @@ BOOST_AUTO_TEST_CASE(imm_repeat)
     BOOST_CHECK_EQUAL(q, 10);
 }
 
+BOOST_AUTO_TEST_CASE(imm_order)
+{
+    // Immediate callbacks are called in the order they are scheduled, and
+    // those scheduled during a tick are deferred to the next one.
+
+    utils::event_loop loop;
+    std::vector<int> order;
+
+    loop.delay([&]
+    {
+        order.push_back(1);
+        loop.delay([&]{ order.push_back(4); });
+    });
+    loop.delay([&]{ order.push_back(2); });
+    loop.delay([&]{ order.push_back(3); });
+
+    loop.run();
+
+    std::vector<int> expected {1, 2, 3, 4};
+    BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(large_callback)
+{
+    // Callbacks too large to be stored inline are kept in the loop's pool.
+
+    utils::event_loop loop;
+
+    std::array<int, 64> numbers;
+    std::iota(numbers.begin(), numbers.end(), 0);
+    int sum = 0;
+
+    for (int i = 0; i < 3; ++ i)
+    {
+        loop.delay([numbers, &sum]
+        {
+            sum += std::accumulate(numbers.begin(), numbers.end(), 0);
+        });
+    }
+
+    loop.run();
+
+    BOOST_CHECK_EQUAL(sum, 3 * 63 * 64 / 2);
+}
+
 BOOST_AUTO_TEST_CASE(cancel_before_start)
 {
     utils::event_loop loop;
@@ -117,16 +210,38 @@ BOOST_AUTO_TEST_CASE(cancel_before_start)
     loop.run();
 }
 
+BOOST_AUTO_TEST_CASE(cancel_stale_handle)
+{
+    utils::event_loop loop;
+    int i = 0;
+
+    auto stale_handle = loop.delay([]
+    {
+        BOOST_FAIL("Event should have been cancelled.");
+    });
+    loop.cancel(stale_handle);
+
+    // The new event reuses the slot of the cancelled one, but cancelling the
+    // stale handle again must not affect it.
+    auto handle = loop.delay([&]{ ++ i; });
+    BOOST_CHECK_NE(handle, stale_handle);
+    loop.cancel(stale_handle);
+
+    loop.run();
+
+    BOOST_CHECK_EQUAL(i, 1);
+}
+
 BOOST_AUTO_TEST_CASE(timed_delay)
 {
     utils::event_loop loop;
 
-    auto start_time = std::chrono::steady_clock::now();
+    auto start_time = loop_time(loop);
     auto end_time = start_time;
 
     loop.delay(std::chrono::milliseconds(400), [&]
     {
-        end_time = std::chrono::steady_clock::now();
+        end_time = loop_time(loop);
     });
 
     loop.run();
@@ -144,11 +259,11 @@ BOOST_AUTO_TEST_CASE(timed_delay_with_keep)
     typedef std::chrono::steady_clock::time_point time;
 
     std::vector<time> times;
-    times.push_back(std::chrono::steady_clock::now());
+    times.push_back(loop_time(loop));
 
     loop.delay(std::chrono::milliseconds(200), [&](bool& keep, utils::event_loop& loop, utils::event_handle)
     {
-        times.push_back(std::chrono::steady_clock::now());
+        times.push_back(loop_time(loop));
         keep = times.size() <= 4;
     });
 
@@ -176,11 +291,11 @@ BOOST_AUTO_TEST_CASE(timed_repeat)
     typedef std::chrono::steady_clock::time_point time;
 
     std::vector<time> times;
-    times.push_back(std::chrono::steady_clock::now());
+    times.push_back(loop_time(loop));
 
     loop.repeat(std::chrono::milliseconds(200), [&](utils::event_loop& loop, utils::event_handle handle)
     {
-        times.push_back(std::chrono::steady_clock::now());
+        times.push_back(loop_time(loop));
         if (times.size() > 4)
             loop.cancel(handle);
     });
@@ -202,6 +317,116 @@ BOOST_AUTO_TEST_CASE(timed_repeat)
     );
 }
 
+BOOST_AUTO_TEST_CASE(timer_slack)
+{
+    // Keepalive-like timers with slightly different intervals are grouped
+    // into a few wakeups, but none of them expires early.
+
+    utils::event_loop loop;
+    std::vector<utils::event_handle> timers;
+    int expirations = 0;
+    auto start_time = loop_time(loop);
+
+    for (int i = 0; i < 100; ++ i)
+    {
+        auto interval = std::chrono::microseconds(50000 + 100 * i);
+        bool is_first = true;
+        timers.push_back(loop.repeat(interval, std::chrono::milliseconds(20), [=, &expirations, &loop]() mutable
+        {
+            ++ expirations;
+            if (!is_first)
+                return;
+            is_first = false;
+            auto elapsed = loop_time(loop) - start_time;
+            BOOST_CHECK(elapsed >= interval - std::chrono::milliseconds(1));
+            BOOST_CHECK(elapsed <= interval + std::chrono::milliseconds(30));
+        }));
+    }
+
+    loop.delay(std::chrono::milliseconds(200), [&]
+    {
+        for (auto handle : timers)
+            loop.cancel(handle);
+    });
+
+    loop.run();
+
+    auto snapshot = loop.snapshot();
+    BOOST_CHECK_GE(expirations, 300);
+    BOOST_CHECK_LE(snapshot.timer_wakeups, 20);
+    BOOST_CHECK_GE(snapshot.coalesced_timers + snapshot.timer_wakeups, static_cast<std::uint64_t>(expirations));
+
+    loop.reset_snapshot();
+    BOOST_CHECK_EQUAL(loop.snapshot().coalesced_timers, 0);
+}
+
+BOOST_AUTO_TEST_CASE(wheel_delay)
+{
+    // Timers far enough to start in the upper levels of the wheel must
+    // cascade down and fire on time.
+
+    utils::event_loop loop;
+    loop.enable_timer_wheel(std::chrono::milliseconds(1));
+
+    auto start_time = loop_time(loop);
+    std::vector<std::pair<int, long>> fired;
+
+    for (int ms : {700, 5, 300})
+    {
+        loop.delay(std::chrono::milliseconds(ms), [&, ms]
+        {
+            auto diff = loop_time(loop) - start_time;
+            fired.emplace_back(ms, std::chrono::duration_cast<std::chrono::milliseconds>(diff).count());
+        });
+    }
+
+    auto cancelled = loop.delay(std::chrono::milliseconds(400), []
+    {
+        BOOST_FAIL("Event should have been cancelled.");
+    });
+    loop.cancel(cancelled);
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(fired.size(), 3);
+    BOOST_CHECK_EQUAL(fired[0].first, 5);
+    BOOST_CHECK_EQUAL(fired[1].first, 300);
+    BOOST_CHECK_EQUAL(fired[2].first, 700);
+    for (auto& p : fired)
+    {
+        BOOST_CHECK_GE(p.second, p.first - 1);
+        BOOST_CHECK_LE(p.second, p.first + 10);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(wheel_repeat_restart)
+{
+    utils::event_loop loop;
+    loop.enable_timer_wheel(std::chrono::milliseconds(5));
+
+    auto start_time = loop_time(loop);
+    std::vector<long> times;
+
+    auto handle = loop.repeat(std::chrono::milliseconds(100), [&](utils::event_loop& loop, utils::event_handle handle)
+    {
+        auto diff = loop_time(loop) - start_time;
+        times.push_back(std::chrono::duration_cast<std::chrono::milliseconds>(diff).count());
+        if (times.size() >= 2)
+            loop.cancel(handle);
+    });
+
+    // Push the first expiry back by 50 ms.
+    loop.delay(std::chrono::milliseconds(50), [&] { loop.restart(handle); });
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(times.size(), 2);
+    BOOST_CHECK_GE(times[0], 145);
+    BOOST_CHECK_LE(times[0], 165);
+    BOOST_CHECK_GE(times[1], 245);
+    BOOST_CHECK_LE(times[1], 270);
+}
+
 BOOST_AUTO_TEST_CASE(pipe_io)
 {
     utils::event_loop loop;
@@ -209,7 +434,7 @@ BOOST_AUTO_TEST_CASE(pipe_io)
     int fds[2];
     pipe(fds);
 
-    auto start_time = std::chrono::steady_clock::now();
+    auto start_time = loop_time(loop);
 
     loop.repeat(std::chrono::milliseconds(200), [=](utils::event_loop& loop, utils::event_handle handle)
     {
@@ -236,7 +461,7 @@ BOOST_AUTO_TEST_CASE(pipe_io)
         }
         else
         {
-            auto time_diff = std::chrono::steady_clock::now() - start_time;
+            auto time_diff = loop_time(loop) - start_time;
             auto millisecs = std::chrono::duration_cast<std::chrono::milliseconds>(time_diff).count();
             BOOST_TEST_CHECKPOINT("counter = " << counter);
             BOOST_CHECK_GE(millisecs, 200 * counter - 8);
@@ -250,6 +475,260 @@ BOOST_AUTO_TEST_CASE(pipe_io)
     BOOST_CHECK_EQUAL(counters_received, 1+2+3+4);
 }
 
+BOOST_AUTO_TEST_CASE(listen_from_io_callback)
+{
+    // Like accepting a connection and listening to it: a callback registers
+    // a higher fd than any so far, while its own fd is being dispatched.
+
+    utils::event_loop loop;
+    int p[2];
+    BOOST_REQUIRE_EQUAL(pipe(p), 0);
+    BOOST_REQUIRE_EQUAL(write(p[1], "x", 1), 1);
+
+    int high = -1;
+    bool is_high_called = false;
+    loop.listen(p[0], [&](int, utils::event_loop& loop, utils::event_handle handle)
+    {
+        loop.cancel(handle);
+        high = fcntl(p[1], F_DUPFD_CLOEXEC, 900);
+        BOOST_REQUIRE(high >= 900);
+        loop.listen(high, utils::io_write, [&](int, int, utils::event_loop& loop, utils::event_handle handle)
+        {
+            is_high_called = true;
+            loop.cancel(handle);
+        });
+    });
+    loop.run();
+
+    BOOST_CHECK(is_high_called);
+    close(high);
+    close(p[0]);
+    close(p[1]);
+}
+
+BOOST_AUTO_TEST_CASE(socket_read_write)
+{
+    utils::event_loop loop;
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+    std::vector<int> revents_seen;
+
+    loop.listen(fds[0], utils::io_read_write, [&](int fd, int revents, utils::event_loop& loop, utils::event_handle handle)
+    {
+        revents_seen.push_back(revents);
+        if (revents == utils::io_write)
+        {
+            // Nothing has been sent yet, so the socket can only be writable.
+            loop.modify(handle, utils::io_read);
+            write(fds[1], "x", 1);
+        }
+        else
+        {
+            char c;
+            read(fd, &c, 1);
+            loop.cancel(handle);
+        }
+    });
+
+    loop.run();
+
+    close(fds[0]);
+    close(fds[1]);
+
+    std::vector<int> expected {utils::io_write, utils::io_read};
+    BOOST_CHECK_EQUAL_COLLECTIONS(revents_seen.begin(), revents_seen.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(edge_triggered_drain)
+{
+    utils::event_loop loop;
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    write(fds[1], "abc", 3);
+
+    std::string received;
+
+    loop.listen(fds[0], utils::io_read | utils::io_edge, [&](int fd, int, utils::event_loop& loop, utils::event_handle handle)
+    {
+        char buffer[2];
+        ssize_t size;
+        while ((size = read(fd, buffer, sizeof(buffer))) > 0)
+            received.append(buffer, size);
+        loop.cancel(handle);
+    });
+
+    loop.run();
+
+    close(fds[0]);
+    close(fds[1]);
+
+    BOOST_CHECK_EQUAL(received, "abc");
+}
+
+BOOST_AUTO_TEST_CASE(async_read_write)
+{
+    utils::event_loop loop;
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+
+    char buffer[16] = {};
+    ssize_t read_result = 0, write_result = 0;
+
+    loop.async_read(fds[0], buffer, sizeof(buffer), [&](ssize_t res) { read_result = res; });
+    loop.async_write(fds[1], "hello", 5, [&](ssize_t res, utils::event_loop&, utils::event_handle)
+    {
+        write_result = res;
+    });
+
+    loop.run();
+
+    close(fds[0]);
+    close(fds[1]);
+
+    BOOST_CHECK_EQUAL(write_result, 5);
+    BOOST_CHECK_EQUAL(read_result, 5);
+    BOOST_CHECK_EQUAL(std::string(buffer), "hello");
+}
+
+BOOST_AUTO_TEST_CASE(async_registered_buffer)
+{
+    utils::event_loop loop;
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    write(fds[1], "abcdef", 6);
+
+    // Registration is only possible with io_uring, but reads into the
+    // buffer must work either way.
+    static char pool[4096];
+    struct iovec iov = {pool, sizeof(pool)};
+    BOOST_CHECK_EQUAL(loop.register_buffers(&iov, 1), loop.is_io_uring_enabled());
+
+    ssize_t result = 0;
+    loop.async_read(fds[0], pool + 100, 3, [&](ssize_t res) { result = res; });
+    loop.run();
+    loop.unregister_buffers();
+
+    close(fds[0]);
+    close(fds[1]);
+
+    BOOST_CHECK_EQUAL(result, 3);
+    BOOST_CHECK_EQUAL(std::string(pool + 100, 3), "abc");
+}
+
+BOOST_AUTO_TEST_CASE(async_timeout)
+{
+    utils::event_loop loop;
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+
+    char buffer[4];
+    ssize_t result = 0;
+    auto start_time = loop_time(loop);
+
+    loop.async_read(fds[0], buffer, sizeof(buffer), std::chrono::milliseconds(50), [&](ssize_t res)
+    {
+        result = res;
+    });
+    loop.run();
+
+    auto diff = loop_time(loop) - start_time;
+    auto millisecs = std::chrono::duration_cast<std::chrono::milliseconds>(diff).count();
+
+    close(fds[0]);
+    close(fds[1]);
+
+    BOOST_CHECK_EQUAL(result, -ETIMEDOUT);
+    BOOST_CHECK_GE(millisecs, 45);
+    BOOST_CHECK_LE(millisecs, 150);
+}
+
+BOOST_AUTO_TEST_CASE(async_cancel)
+{
+    utils::event_loop loop;
+
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+
+    char buffer[4];
+    auto handle = loop.async_read(fds[0], buffer, sizeof(buffer), [](ssize_t)
+    {
+        BOOST_FAIL("Event should have been cancelled.");
+    });
+
+    loop.delay(std::chrono::milliseconds(10), [&]{ loop.cancel(handle); });
+    loop.run();
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(async_accept)
+{
+    utils::event_loop loop;
+
+    int server = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(server, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    socklen_t addr_len = sizeof(addr);
+    getsockname(server, reinterpret_cast<struct sockaddr*>(&addr), &addr_len);
+    listen(server, 4);
+
+    int accepted = -1;
+    loop.async_accept(server, [&](ssize_t fd) { accepted = static_cast<int>(fd); });
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    connect(client, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+
+    loop.run();
+
+    BOOST_CHECK_GE(accepted, 0);
+
+    close(accepted);
+    close(client);
+    close(server);
+}
+
+BOOST_AUTO_TEST_CASE(instrument_snapshot)
+{
+    utils::event_loop loop;
+
+    loop.with_tag("test.busy").delay([]
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    });
+    loop.delay(std::chrono::milliseconds(1), []{});
+
+    loop.run();
+
+    auto snapshot = loop.snapshot();
+    BOOST_CHECK_EQUAL(snapshot.live_events, 0);
+
+#ifdef UTILS_EVENT_LOOP_INSTRUMENT
+    BOOST_CHECK(snapshot.enabled);
+    BOOST_CHECK_GE(snapshot.iterations, 1);
+    BOOST_REQUIRE_EQUAL(snapshot.callbacks.size(), 2);
+
+    auto& busy = snapshot.callbacks[0];
+    BOOST_CHECK_EQUAL(busy.tag, "test.busy");
+    BOOST_CHECK_EQUAL(busy.type, "delay_imm_simple");
+    BOOST_CHECK_EQUAL(busy.runtime.count, 1);
+    BOOST_CHECK_GE(busy.runtime.percentile(50), 1.9e6);
+
+    loop.reset_snapshot();
+    BOOST_CHECK(loop.snapshot().callbacks.empty());
+#else
+    BOOST_CHECK(!snapshot.enabled);
+#endif
+}
+
 BOOST_AUTO_TEST_CASE(catch_signal)
 {
     utils::event_loop loop;
@@ -268,6 +747,588 @@ BOOST_AUTO_TEST_CASE(catch_signal)
     BOOST_CHECK_EQUAL(raised_signal, SIGINT);
 }
 
+BOOST_AUTO_TEST_CASE(post_from_threads)
+{
+    static const int thread_count = 4;
+    static const int posts_per_thread = 10000;
+
+    utils::event_loop loop;
+
+    auto keep_alive = loop.repeat(std::chrono::seconds(60), []{});
+
+    int received = 0;
+    std::vector<int> last_seen (thread_count, -1);
+    bool in_order = true;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++ t)
+    {
+        threads.emplace_back([&, t]
+        {
+            for (int i = 0; i < posts_per_thread; ++ i)
+            {
+                loop.post([&, t, i](utils::event_loop& loop)
+                {
+                    in_order = in_order && (last_seen[t] == i - 1);
+                    last_seen[t] = i;
+                    if (++ received == thread_count * posts_per_thread)
+                        loop.cancel(keep_alive);
+                });
+            }
+        });
+    }
+
+    loop.run();
+
+    for (auto& thread : threads)
+        thread.join();
+
+    BOOST_CHECK_EQUAL(received, thread_count * posts_per_thread);
+    BOOST_CHECK(in_order);
+}
+
+BOOST_AUTO_TEST_CASE(post_after_throw)
+{
+    // A throwing posted callback leaves the rest of its batch for the next
+    // run(), ahead of anything posted since.
+
+    utils::event_loop loop;
+    auto keep_alive = loop.repeat(std::chrono::seconds(60), []{});
+
+    std::string trace;
+    loop.post([&](utils::event_loop&) { trace += 'a'; throw std::runtime_error("bad"); });
+    loop.post([&](utils::event_loop&) { trace += 'b'; });
+    loop.post([&](utils::event_loop& loop) { trace += 'c'; loop.cancel(keep_alive); });
+
+    BOOST_CHECK_THROW(loop.run(), std::runtime_error);
+    BOOST_CHECK_EQUAL(trace, "a");
+
+    loop.post([&](utils::event_loop&) { trace += 'd'; });
+    loop.run();
+    BOOST_CHECK_EQUAL(trace, "abcd");
+}
+
+BOOST_AUTO_TEST_CASE(priority_order)
+{
+    utils::event_loop loop;
+    std::vector<int> fds;
+    std::vector<std::string> calls;
+
+    auto listen = [&](utils::event_priority priority, const char* name)
+    {
+        int p[2];
+        BOOST_REQUIRE_EQUAL(pipe(p), 0);
+        BOOST_REQUIRE_EQUAL(write(p[1], "x", 1), 1);
+        fds.push_back(p[0]);
+        fds.push_back(p[1]);
+        loop.with_priority(priority).listen(p[0], [&, name](int fd, utils::event_loop& loop, utils::event_handle handle)
+        {
+            char c;
+            read(fd, &c, 1);
+            calls.push_back(name);
+            loop.cancel(handle);
+        });
+    };
+
+    // All three are ready in the first iteration.
+    listen(utils::priority_low, "low");
+    listen(utils::priority_normal, "normal");
+    listen(utils::priority_high, "high");
+    loop.with_priority(utils::priority_low).delay(std::chrono::milliseconds(0), [&] { calls.push_back("low timer"); });
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(calls.size(), 4);
+    BOOST_CHECK_EQUAL(calls[0], "high");
+    BOOST_CHECK_EQUAL(calls[1], "normal");
+    BOOST_CHECK(calls[2] == "low" || calls[2] == "low timer");
+    BOOST_CHECK(calls[3] == "low" || calls[3] == "low timer");
+
+    for (int fd : fds)
+        close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(low_priority_budget)
+{
+    utils::event_loop loop;
+    loop.set_low_priority_budget(3);
+
+    // A high-priority fd which stays readable counts the iterations.
+    int busy[2];
+    BOOST_REQUIRE_EQUAL(pipe(busy), 0);
+    BOOST_REQUIRE_EQUAL(write(busy[1], "x", 1), 1);
+    int iteration = 0;
+    auto counter = loop.with_priority(utils::priority_high).listen(busy[0], [&](int) { ++ iteration; });
+
+    std::vector<int> fds;
+    std::vector<utils::event_handle> lows;
+    std::vector<int> called_at;
+    for (int i = 0; i < 10; ++ i)
+    {
+        int p[2];
+        BOOST_REQUIRE_EQUAL(pipe2(p, O_NONBLOCK), 0);
+        BOOST_REQUIRE_EQUAL(write(p[1], "x", 1), 1);
+        fds.push_back(p[0]);
+        fds.push_back(p[1]);
+        lows.push_back(loop.with_priority(utils::priority_low).listen(p[0], [&](int fd, utils::event_loop& loop, utils::event_handle)
+        {
+            char c;
+            BOOST_CHECK_EQUAL(read(fd, &c, 1), 1);
+            called_at.push_back(iteration);
+            if (called_at.size() == 10)
+            {
+                loop.cancel(counter);
+                for (auto handle : lows)
+                    loop.cancel(handle);
+            }
+        }));
+    }
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(called_at.size(), 10);
+    for (std::size_t i = 0; i < called_at.size(); ++ i)
+    {
+        BOOST_TEST_CHECKPOINT("i = " << i);
+        BOOST_CHECK_EQUAL(called_at[i], static_cast<int>(i / 3 + 1));
+    }
+
+    close(busy[0]);
+    close(busy[1]);
+    for (int fd : fds)
+        close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(idle_after_imms)
+{
+    utils::event_loop loop;
+    std::string trace;
+
+    int imms = 0;
+    loop.repeat([&](utils::event_loop& loop, utils::event_handle handle)
+    {
+        trace += 'm';
+        if (++ imms == 3)
+            loop.cancel(handle);
+    });
+    loop.when_idle(std::chrono::hours(1), [&](bool& more, utils::event_loop&, utils::event_handle)
+    {
+        trace += 'i';
+        more = trace.size() < 6;
+    });
+
+    loop.run();
+    BOOST_CHECK_EQUAL(trace, "mmmiii");
+}
+
+BOOST_AUTO_TEST_CASE(idle_budget)
+{
+    using namespace std::chrono;
+
+    // Every chunk of idle work makes a pipe readable. With no budget, the
+    // reader gets in between the chunks; otherwise the work runs through.
+    for (bool is_limited : {true, false})
+    {
+        BOOST_TEST_CHECKPOINT("is_limited = " << is_limited);
+        utils::event_loop loop;
+        int p[2];
+        BOOST_REQUIRE_EQUAL(pipe(p), 0);
+
+        std::string trace;
+        int chunks = 0;
+        loop.listen(p[0], [&](int fd, utils::event_loop& loop, utils::event_handle handle)
+        {
+            char buffer[16];
+            BOOST_CHECK(read(fd, buffer, sizeof(buffer)) > 0);
+            trace += 'r';
+            if (chunks == 4)
+                loop.cancel(handle);
+        });
+        loop.when_idle(is_limited ? nanoseconds(0) : nanoseconds(hours(1)), [&]() -> bool
+        {
+            trace += 'i';
+            BOOST_CHECK_EQUAL(write(p[1], "x", 1), 1);
+            return ++ chunks < 4;
+        });
+
+        loop.run();
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+        // The budget cannot be measured on the virtual clock; one chunk runs.
+        BOOST_CHECK_EQUAL(trace, "iriririr");
+#else
+        BOOST_CHECK_EQUAL(trace, is_limited ? "iriririr" : "iiiir");
+#endif
+
+        close(p[0]);
+        close(p[1]);
+    }
+}
+
+#ifndef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+BOOST_AUTO_TEST_CASE(idle_shared_budget)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    int p[2];
+    BOOST_REQUIRE_EQUAL(pipe(p), 0);
+
+    // Two tasks of 5 ms chunks with a 20 ms budget each. The first uses up
+    // the budget of the iteration, so the second only starts after the
+    // reader has had its turn, and then goes first.
+    std::string trace;
+    int a = 0, b = 0;
+    loop.listen(p[0], [&](int fd, utils::event_loop& loop, utils::event_handle handle)
+    {
+        char buffer[64];
+        BOOST_CHECK(read(fd, buffer, sizeof(buffer)) > 0);
+        trace += 'r';
+        if (a == 8 && b == 8)
+            loop.cancel(handle);
+    });
+    for (auto count : {&a, &b})
+    {
+        auto name = count == &a ? 'a' : 'b';
+        loop.when_idle(milliseconds(20), [&, count, name]() -> bool
+        {
+            trace += name;
+            stall(loop, milliseconds(5));
+            BOOST_CHECK_EQUAL(write(p[1], "x", 1), 1);
+            return ++ *count < 8;
+        });
+    }
+
+    loop.run();
+
+    BOOST_CHECK_EQUAL(a, 8);
+    BOOST_CHECK_EQUAL(b, 8);
+    auto first_read = trace.find('r');
+    BOOST_CHECK_EQUAL(trace.substr(0, first_read).find('b'), std::string::npos);
+    BOOST_CHECK_EQUAL(trace.substr(first_read + 1, 1), "b");
+
+    close(p[0]);
+    close(p[1]);
+}
+#endif
+
+namespace
+{
+    struct raw_context
+    {
+        std::string trace;
+        int keeps;
+    };
+
+    void raw_on_readable(void* ctx, int fd, utils::event_loop& loop, utils::event_handle handle)
+    {
+        char c;
+        BOOST_CHECK_EQUAL(read(fd, &c, 1), 1);
+        static_cast<raw_context*>(ctx)->trace += c;
+        loop.cancel(handle);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(raw_callbacks)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    raw_context ctx = {"", 0};
+
+    int p[2];
+    BOOST_REQUIRE_EQUAL(pipe(p), 0);
+    BOOST_REQUIRE_EQUAL(write(p[1], "f", 1), 1);
+
+    loop.listen(p[0], raw_on_readable, &ctx);
+    loop.listen(p[1], utils::io_write, [](void* ctx, int, int revents, utils::event_loop& loop, utils::event_handle handle)
+    {
+        BOOST_CHECK_EQUAL(revents, utils::io_write);
+        static_cast<raw_context*>(ctx)->trace += 'w';
+        loop.cancel(handle);
+    }, &ctx);
+    loop.delay(milliseconds(1), [](void* ctx, bool& keep, utils::event_loop&, utils::event_handle)
+    {
+        auto c = static_cast<raw_context*>(ctx);
+        c->trace += 'd';
+        keep = ++ c->keeps < 3;
+    }, &ctx);
+    loop.repeat([](void* ctx, utils::event_loop& loop, utils::event_handle handle)
+    {
+        static_cast<raw_context*>(ctx)->trace += 'r';
+        loop.cancel(handle);
+    }, &ctx);
+
+    // Cancelling events with raw callbacks has nothing to destroy.
+    std::vector<utils::unique_event> events;
+    for (int i = 0; i < 300; ++ i)
+        events.emplace_back(loop, loop.delay(hours(1), [](void*, bool&, utils::event_loop&, utils::event_handle) {}, nullptr));
+    events.clear();
+
+    loop.run();
+
+    std::string trace = ctx.trace;
+    std::sort(trace.begin(), trace.end());
+    BOOST_CHECK_EQUAL(trace, "dddfrw");
+
+    close(p[0]);
+    close(p[1]);
+}
+
+BOOST_AUTO_TEST_CASE(forward_splice)
+{
+    int src[2], dst[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, src), 0);
+    BOOST_REQUIRE_EQUAL(pipe2(dst, O_NONBLOCK), 0);
+
+    utils::event_loop loop;
+    const std::size_t total = 1 << 20;
+    auto byte_at = [](std::size_t i) { return static_cast<char>(i * 7 % 251); };
+
+    // Produce faster than the forward may buffer, to exercise backpressure.
+    std::size_t produced = 0;
+    loop.listen(src[1], utils::io_write, [&](int fd, int, utils::event_loop& loop, utils::event_handle handle)
+    {
+        char buffer[40000];
+        std::size_t size = std::min(sizeof(buffer), total - produced);
+        for (std::size_t i = 0; i < size; ++ i)
+            buffer[i] = byte_at(produced + i);
+        ssize_t n = write(fd, buffer, size);
+        if (n > 0)
+            produced += n;
+        if (produced == total)
+        {
+            shutdown(fd, SHUT_WR);
+            loop.cancel(handle);
+        }
+    });
+
+    std::size_t consumed = 0;
+    bool is_intact = true;
+    loop.listen(dst[0], [&](int fd, utils::event_loop& loop, utils::event_handle handle)
+    {
+        char buffer[3000];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < n; ++ i)
+            is_intact = is_intact && buffer[i] == byte_at(consumed + i);
+        if (n > 0)
+            consumed += n;
+        if (consumed == total)
+            loop.cancel(handle);
+    });
+
+    utils::forward_options options;
+    options.chunk_size = 16384;
+    std::uint64_t forwarded = 0;
+    int error = -1;
+    loop.forward(src[0], dst[1], options, [&](std::uint64_t bytes, int err)
+    {
+        forwarded = bytes;
+        error = err;
+    });
+
+    loop.run();
+
+    BOOST_CHECK_EQUAL(forwarded, total);
+    BOOST_CHECK_EQUAL(error, 0);
+    BOOST_CHECK_EQUAL(consumed, total);
+    BOOST_CHECK(is_intact);
+
+    // A cancelled forward does not report anything.
+    bool is_called = false;
+    auto group = loop.forward(dst[0], src[1], [&](std::uint64_t, int) { is_called = true; });
+    loop.delay(std::chrono::milliseconds(10), [&] { loop.cancel_group(group); });
+    loop.run();
+    BOOST_CHECK(!is_called);
+
+    for (int fd : {src[0], src[1], dst[0], dst[1]})
+        close(fd);
+}
+
+BOOST_AUTO_TEST_CASE(forward_files)
+{
+    char in_path[] = "/tmp/forward_in_XXXXXX";
+    char out_path[] = "/tmp/forward_out_XXXXXX";
+    int in_fd = mkstemp(in_path);
+    int out_fd = mkstemp(out_path);
+    BOOST_REQUIRE(in_fd >= 0 && out_fd >= 0);
+    unlink(in_path);
+    unlink(out_path);
+
+    std::string content (200000, '\0');
+    for (std::size_t i = 0; i < content.size(); ++ i)
+        content[i] = static_cast<char>(i % 199);
+    BOOST_REQUIRE_EQUAL(write(in_fd, content.data(), content.size()), static_cast<ssize_t>(content.size()));
+    lseek(in_fd, 0, SEEK_SET);
+
+    int p[2];
+    BOOST_REQUIRE_EQUAL(pipe2(p, O_NONBLOCK), 0);
+
+    utils::event_loop loop;
+
+    // File to pipe with sendfile(), stopping at the limit.
+    utils::forward_options options;
+    options.limit = 150000;
+    std::uint64_t sent = 0;
+    int send_error = -1;
+    loop.forward(in_fd, p[1], options, [&](std::uint64_t bytes, int err, utils::event_loop&)
+    {
+        sent = bytes;
+        send_error = err;
+        close(p[1]);
+    });
+
+    // Pipe to file with splice(), until the end of the pipe.
+    std::uint64_t received = 0;
+    int receive_error = -1;
+    loop.forward(p[0], out_fd, [&](std::uint64_t bytes, int err)
+    {
+        received = bytes;
+        receive_error = err;
+    });
+
+    loop.run();
+
+    BOOST_CHECK_EQUAL(sent, 150000u);
+    BOOST_CHECK_EQUAL(send_error, 0);
+    BOOST_CHECK_EQUAL(received, 150000u);
+    BOOST_CHECK_EQUAL(receive_error, 0);
+
+    std::string copied (150000, '\0');
+    BOOST_CHECK_EQUAL(pread(out_fd, &copied[0], copied.size(), 0), 150000);
+    BOOST_CHECK(copied == content.substr(0, 150000));
+
+    close(p[0]);
+    close(in_fd);
+    close(out_fd);
+}
+
+BOOST_AUTO_TEST_CASE(at_deadlines)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    std::string trace;
+    auto loop_start = loop_time(loop);
+    auto start = steady_clock::now();
+    steady_clock::duration steady_at {}, system_at {};
+    loop.at(start + milliseconds(60), [&] { trace += 's'; steady_at = loop_time(loop) - loop_start; });
+    loop.at(system_clock::now() + milliseconds(30), [&](utils::event_loop&, utils::event_handle)
+    {
+        trace += 'w';
+        system_at = loop_time(loop) - loop_start;
+    });
+    loop.at(start - seconds(1), [&] { trace += 'p'; });
+    auto issued = steady_clock::now();
+
+    // Every event fires once, after which the loop has nothing left.
+    loop.run();
+
+    BOOST_CHECK_EQUAL(trace, "pws");
+    BOOST_CHECK(system_at >= milliseconds(29));
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    // The real time taken to get here does not pass on the virtual clock.
+    BOOST_CHECK(steady_at >= start + milliseconds(60) - issued);
+    BOOST_CHECK(steady_at <= milliseconds(60));
+#else
+    (void) issued;
+    BOOST_CHECK(steady_at >= milliseconds(60));
+    BOOST_CHECK(steady_at < milliseconds(160));
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(every_aligned)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    BOOST_CHECK_THROW(loop.every(seconds(0), [] {}), std::invalid_argument);
+
+    std::vector<long> phases;
+    loop.every(milliseconds(50), milliseconds(10), [&](utils::event_loop& loop, utils::event_handle handle)
+    {
+        auto ms = duration_cast<milliseconds>(loop_wall_time(loop).time_since_epoch()).count();
+        phases.push_back((ms - 10) % 50);
+        // A late callback does not shift the following deadlines.
+        if (phases.size() == 2)
+            stall(loop, milliseconds(20));
+        if (phases.size() == 4)
+            loop.cancel(handle);
+    });
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(phases.size(), 4u);
+    for (long phase : phases)
+        BOOST_CHECK_LT(phase, 15);
+}
+
+BOOST_AUTO_TEST_CASE(watch_path_events)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    char dir_template[] = "/tmp/utils-watch-path-XXXXXX";
+    std::string dir = mkdtemp(dir_template);
+    std::string a = dir + "/a", b = dir + "/b";
+    close(open(a.c_str(), O_WRONLY | O_CREAT, 0600));
+
+    BOOST_CHECK_THROW(loop.watch_path(dir + "/missing", IN_MODIFY, [](const utils::path_event&) {}), std::system_error);
+
+    struct seen { std::string name; std::uint32_t mask, count; };
+    std::vector<seen> in_dir, created, on_file;
+    loop.set_path_coalescing(milliseconds(30));
+    utils::unique_event dir_watch (loop, loop.watch_path(dir, IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE,
+        [&](const utils::path_event& event, utils::event_loop&, utils::event_handle)
+    {
+        in_dir.push_back({event.name, event.mask, event.count});
+    }));
+    // Shares the inotify watch with the one above, but only sees creations.
+    auto creations = loop.watch_path(dir, IN_CREATE, [&](const utils::path_event& event)
+    {
+        created.push_back({event.name, event.mask, event.count});
+    });
+    loop.watch_path(a, IN_MODIFY, [&](const utils::path_event& event)
+    {
+        on_file.push_back({event.name, event.mask, event.count});
+    });
+
+    loop.delay(milliseconds(10), [&]
+    {
+        int fd = open(b.c_str(), O_WRONLY | O_CREAT, 0600);
+        BOOST_CHECK_EQUAL(write(fd, "xy", 1), 1);
+        BOOST_CHECK_EQUAL(write(fd, "xy" + 1, 1), 1);
+        close(fd);
+        fd = open(a.c_str(), O_WRONLY);
+        BOOST_CHECK_EQUAL(write(fd, "z", 1), 1);
+        close(fd);
+    });
+    // Deleting the file drops its watch, which cancels the event.
+    loop.delay(milliseconds(100), [&] { unlink(a.c_str()); });
+    loop.delay(milliseconds(200), [&]
+    {
+        dir_watch.reset();
+        loop.cancel(creations);
+    });
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(in_dir.size(), 2u);
+    BOOST_CHECK_EQUAL(in_dir[0].name, "b");
+    BOOST_CHECK_EQUAL(in_dir[0].mask, IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE);
+    BOOST_CHECK_GE(in_dir[0].count, 3u);
+    BOOST_CHECK_EQUAL(in_dir[1].name, "a");
+    BOOST_CHECK_EQUAL(in_dir[1].mask, IN_MODIFY | IN_CLOSE_WRITE);
+
+    BOOST_REQUIRE_EQUAL(created.size(), 1u);
+    BOOST_CHECK_EQUAL(created[0].name, "b");
+    BOOST_CHECK_EQUAL(created[0].mask, IN_CREATE);
+
+    BOOST_REQUIRE_EQUAL(on_file.size(), 2u);
+    BOOST_CHECK_EQUAL(on_file[0].name, "");
+    BOOST_CHECK_EQUAL(on_file[0].mask, IN_MODIFY);
+    BOOST_CHECK_EQUAL(on_file[1].mask, IN_IGNORED);
+
+    unlink(b.c_str());
+    rmdir(dir.c_str());
+}
+
 BOOST_AUTO_TEST_CASE(unique_event_owner)
 {
     utils::event_loop loop;
@@ -287,5 +1348,70 @@ BOOST_AUTO_TEST_CASE(unique_event_owner)
     BOOST_CHECK_EQUAL(i, 1);
 }
 
+BOOST_AUTO_TEST_CASE(group_cancel)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    int p[2];
+    BOOST_REQUIRE_EQUAL(pipe(p), 0);
+
+    std::string trace;
+    auto group = loop.create_group();
+    loop.with_group(group).listen(p[0], [&](int) { trace += 'w'; });
+    loop.with_group(group).delay(milliseconds(1), [&] { trace += 'd'; });
+    loop.with_group(group).repeat([&] { trace += 'r'; });
+    loop.with_group(group).delay([&] { trace += 'o'; });
+    loop.with_group(group).when_idle(milliseconds(1), [&] { trace += 'i'; return true; });
+    loop.delay([&] { trace += 'x'; });
+
+    // The first member is gone before the group is cancelled.
+    auto early = loop.with_group(group).delay(hours(1), [&] { trace += 'e'; });
+    loop.cancel(early);
+
+    loop.delay([&](bool&, utils::event_loop& loop, utils::event_handle)
+    {
+        loop.cancel_group(group);
+        trace += '|';
+    });
+
+    loop.run();
+    BOOST_CHECK_EQUAL(trace, "rox|");
+
+    // The group handle is stale now, so the event belongs to no group.
+    bool called = false;
+    loop.with_group(group).delay(milliseconds(1), [&] { called = true; });
+    loop.cancel_group(group);
+    loop.run();
+    BOOST_CHECK(called);
+
+    close(p[0]);
+    close(p[1]);
+}
+
+BOOST_AUTO_TEST_CASE(unique_event_group_owner)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    int calls = 0;
+    {
+        utils::unique_event_group group (loop, loop.create_group());
+        for (int i = 0; i < 100; ++ i)
+            loop.with_group(group.get()).delay(milliseconds(i % 10), [&] { ++ calls; });
+        loop.delay(milliseconds(20), [&] { ++ calls; });
+    }
+
+    // A group recycled by create_group() does not resurrect the old handles.
+    auto other = loop.create_group();
+    loop.with_group(other).repeat([&](utils::event_loop& loop, utils::event_handle)
+    {
+        ++ calls;
+        loop.cancel_group(other);
+    });
+
+    loop.run();
+    BOOST_CHECK_EQUAL(calls, 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
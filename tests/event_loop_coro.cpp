@@ -0,0 +1,232 @@
+// The coroutine support needs C++20; this file is empty in older modes.
+#if defined(__cpp_impl_coroutine)
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <csignal>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <utils/event_loop-coro.hpp>
+
+BOOST_AUTO_TEST_SUITE(event_loop_coro)
+
+static utils::task<int> add_later(utils::event_loop& loop, int a, int b)
+{
+    co_await loop.sleep(std::chrono::milliseconds(1));
+    co_return a + b;
+}
+
+static utils::task<> sum_in_sequence(utils::event_loop& loop, int& result, std::string& trace)
+{
+    trace += 'a';
+    result = co_await add_later(loop, 1, 2);
+    trace += 'b';
+    result += co_await add_later(loop, result, 4);
+    trace += 'c';
+}
+
+BOOST_AUTO_TEST_CASE(coro_sleep_task)
+{
+    utils::event_loop loop;
+    int result = 0;
+    std::string trace;
+
+    utils::spawn(sum_in_sequence(loop, result, trace));
+    BOOST_CHECK_EQUAL(trace, "a");
+
+    loop.run();
+    BOOST_CHECK_EQUAL(trace, "abc");
+    BOOST_CHECK_EQUAL(result, 10);
+    BOOST_CHECK_EQUAL(loop.snapshot().live_events, 0u);
+}
+
+static utils::task<int> deep(int depth)
+{
+    if (depth == 0)
+        co_return 0;
+    co_return co_await deep(depth - 1) + 1;
+}
+
+static utils::task<> run_deep(int& result)
+{
+    result = co_await deep(1000);
+}
+
+BOOST_AUTO_TEST_CASE(coro_nested)
+{
+    // Every task resumes its awaiter directly when it finishes.
+
+    int result = 0;
+    utils::spawn(run_deep(result));
+    BOOST_CHECK_EQUAL(result, 1000);
+}
+
+static utils::task<int> fail(utils::event_loop& loop)
+{
+    co_await loop.sleep(std::chrono::milliseconds(0));
+    throw std::runtime_error("fail");
+}
+
+static utils::task<> catch_failure(utils::event_loop& loop, std::string& message)
+{
+    try
+    {
+        co_await fail(loop);
+    }
+    catch (const std::runtime_error& e)
+    {
+        message = e.what();
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coro_exception)
+{
+    utils::event_loop loop;
+    std::string message;
+    utils::spawn(catch_failure(loop, message));
+    loop.run();
+    BOOST_CHECK_EQUAL(message, "fail");
+}
+
+static utils::task<> read_twice(utils::event_loop& loop, int fd, std::string& data)
+{
+    for (int i = 0; i < 2; ++ i)
+    {
+        auto error = co_await loop.readable(fd);
+        BOOST_CHECK(!error);
+        char buffer[16];
+        auto size = read(fd, buffer, sizeof(buffer));
+        BOOST_REQUIRE_GT(size, 0);
+        data.append(buffer, size);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coro_readable)
+{
+    utils::event_loop loop;
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+
+    std::string data;
+    utils::spawn(read_twice(loop, fds[0], data));
+
+    loop.delay(std::chrono::milliseconds(1), [&]
+    {
+        BOOST_CHECK_EQUAL(write(fds[1], "ab", 2), 2);
+        loop.delay(std::chrono::milliseconds(1), [&]
+        {
+            BOOST_CHECK_EQUAL(write(fds[1], "cd", 2), 2);
+        });
+    });
+
+    loop.run();
+    BOOST_CHECK_EQUAL(data, "abcd");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static utils::task<> wait_signal(utils::event_loop& loop, std::error_code& error)
+{
+    error = co_await loop.signal(SIGUSR2);
+}
+
+BOOST_AUTO_TEST_CASE(coro_signal)
+{
+    utils::event_loop loop;
+    std::error_code error = std::make_error_code(std::errc::interrupted);
+    utils::spawn(wait_signal(loop, error));
+    loop.delay([] { raise(SIGUSR2); });
+    loop.run();
+    BOOST_CHECK(!error);
+}
+
+static utils::task<> sleep_bound(utils::event_loop& loop, utils::unique_event& owner, std::error_code& error)
+{
+    error = co_await loop.sleep(std::chrono::hours(1)).bind(owner);
+}
+
+BOOST_AUTO_TEST_CASE(coro_cancel)
+{
+    // Resetting the unique_event resumes the coroutine with an error on the
+    // next iteration, instead of leaving it suspended forever.
+
+    utils::event_loop loop;
+    utils::unique_event owner;
+    std::error_code error;
+    bool is_resumed_in_reset = false;
+
+    utils::spawn(sleep_bound(loop, owner, error));
+    BOOST_CHECK(owner.get_pool() == &loop);
+
+    loop.delay([&]
+    {
+        owner.reset();
+        is_resumed_in_reset = static_cast<bool>(error);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    loop.run();
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+    BOOST_CHECK(!is_resumed_in_reset);
+    BOOST_CHECK(error == std::errc::operation_canceled);
+}
+
+static utils::task<> sleep_then_set(utils::event_loop& loop, bool& is_resumed)
+{
+    co_await loop.sleep(std::chrono::milliseconds(10));
+    is_resumed = true;
+}
+
+// Runs a task up to its first suspension, without anyone awaiting it.
+static void start(utils::task<>& work)
+{
+    work.operator co_await().await_suspend(std::noop_coroutine()).resume();
+}
+
+BOOST_AUTO_TEST_CASE(coro_destroy_suspended)
+{
+    // Destroying a suspended task cancels what it awaits, so its frame is
+    // not resumed after it is gone.
+
+    utils::event_loop loop;
+    bool is_resumed = false;
+    auto sleeping = sleep_then_set(loop, is_resumed);
+    start(sleeping);
+    BOOST_CHECK_EQUAL(loop.snapshot().live_events, 1u);
+    sleeping = utils::task<>();
+    BOOST_CHECK_EQUAL(loop.snapshot().live_events, 0u);
+
+    // Also when it was cancelled and its resumption is still due.
+    utils::unique_event owner;
+    std::error_code error;
+    auto bound = sleep_bound(loop, owner, error);
+    start(bound);
+    owner.reset();
+    bound = utils::task<>();
+
+    loop.run();
+    BOOST_CHECK(!is_resumed);
+    BOOST_CHECK(!error);
+    BOOST_CHECK_EQUAL(loop.snapshot().live_events, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(coro_destroy_loop)
+{
+    // A coroutine still suspended when its loop is destroyed is not resumed.
+
+    std::error_code error;
+    {
+        auto loop = std::make_unique<utils::event_loop>();
+        utils::unique_event owner;
+        utils::spawn(sleep_bound(*loop, owner, error));
+        owner.release();
+    }
+    BOOST_CHECK(!error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
@@ -0,0 +1,157 @@
+#include <atomic>
+#include <future>
+#include <set>
+#include <vector>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <utils/event_loop_pool.hpp>
+
+BOOST_AUTO_TEST_SUITE(event_loop_pool)
+
+BOOST_AUTO_TEST_CASE(post_to_every_loop)
+{
+    utils::event_loop_pool pool (3);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    std::vector<std::promise<std::thread::id>> promises (pool.size());
+    for (std::size_t i = 0; i < pool.size(); ++ i)
+    {
+        auto promise = &promises[i];
+        pool.post_to(i, [promise](utils::event_loop&)
+        {
+            promise->set_value(std::this_thread::get_id());
+        });
+    }
+
+    std::set<std::thread::id> ids;
+    for (auto& promise : promises)
+        ids.insert(promise.get_future().get());
+
+    BOOST_CHECK_EQUAL(ids.size(), 3);
+    BOOST_CHECK(ids.find(std::this_thread::get_id()) == ids.end());
+
+    pool.stop();
+    for (auto& st : pool.stats())
+    {
+        BOOST_CHECK_EQUAL(st.posts, 1);
+        BOOST_CHECK_EQUAL(st.pending_posts, 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(hashed_placement)
+{
+    utils::event_loop_pool pool (4, utils::event_loop_pool::hashed);
+
+    std::vector<int> counts (pool.size());
+    for (std::size_t key = 0; key < 1000; ++ key)
+    {
+        BOOST_CHECK_EQUAL(pool.place(key), pool.place(key));
+        ++ counts[pool.place(key)];
+    }
+
+    // Consecutive keys, like fds, are spread evenly.
+    for (int count : counts)
+    {
+        BOOST_CHECK_GE(count, 200);
+        BOOST_CHECK_LE(count, 300);
+    }
+
+    // Keyed timers follow the fds with the same key.
+    for (std::size_t key = 0; key < 10; ++ key)
+        BOOST_CHECK_EQUAL(pool.delay(key, std::chrono::hours(1), [] {}), pool.place(key));
+}
+
+// Waits until every loop has run what was posted to it so far.
+static void drain(utils::event_loop_pool& pool)
+{
+    std::vector<std::promise<void>> promises (pool.size());
+    for (std::size_t i = 0; i < pool.size(); ++ i)
+    {
+        auto promise = &promises[i];
+        pool.post_to(i, [promise](utils::event_loop&) { promise->set_value(); });
+    }
+    for (auto& promise : promises)
+        promise.get_future().wait();
+}
+
+BOOST_AUTO_TEST_CASE(live_events)
+{
+    utils::event_loop_pool pool (2);
+
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+    std::promise<void> done;
+
+    // Four timers on two loops, one of which is cancelled from its callback
+    // once the pipe is readable, and an fd on the first loop.
+    for (int i = 0; i < 4; ++ i)
+        pool.repeat(std::chrono::hours(1), [] {});
+    pool.post_to(0, [&](utils::event_loop& loop)
+    {
+        loop.listen(fds[0], [&](int, utils::event_loop& loop, utils::event_handle handle)
+        {
+            loop.cancel(handle);
+            done.set_value();
+        });
+    });
+
+    drain(pool);
+    auto stats = pool.stats();
+    BOOST_CHECK_EQUAL(stats[0].live_events, 3u);
+    BOOST_CHECK_EQUAL(stats[1].live_events, 2u);
+    BOOST_CHECK_EQUAL(stats[0].timers, 2u);
+
+    BOOST_REQUIRE_EQUAL(write(fds[1], "x", 1), 1);
+    done.get_future().wait();
+    stats = pool.stats();
+    BOOST_CHECK_EQUAL(stats[0].live_events, 2u);
+    BOOST_CHECK_EQUAL(stats[0].fds, 0u);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(stats_from_every_loop)
+{
+    utils::event_loop_pool pool (2);
+
+    // Each loop asks for the stats while the other may be doing the same.
+    std::vector<std::promise<std::size_t>> promises (pool.size());
+    for (std::size_t i = 0; i < pool.size(); ++ i)
+    {
+        auto promise = &promises[i];
+        pool.post_to(i, [&pool, promise](utils::event_loop&)
+        {
+            promise->set_value(pool.stats().size());
+        });
+    }
+
+    for (auto& promise : promises)
+        BOOST_CHECK_EQUAL(promise.get_future().get(), 2u);
+}
+
+BOOST_AUTO_TEST_CASE(round_robin_timers)
+{
+    utils::event_loop_pool pool (2);
+
+    std::atomic<int> fired (0);
+    std::promise<void> done;
+
+    for (int i = 0; i < 4; ++ i)
+    {
+        pool.delay(std::chrono::milliseconds(10), [&]
+        {
+            if (++ fired == 4)
+                done.set_value();
+        });
+    }
+
+    done.get_future().wait();
+    pool.stop();
+
+    for (auto& st : pool.stats())
+        BOOST_CHECK_EQUAL(st.timers, 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
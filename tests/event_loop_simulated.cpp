@@ -0,0 +1,217 @@
+// These tests need the virtual clock; this file is empty with other backends.
+#if defined(UTILS_EVENT_LOOP_BACKEND_SIMULATED)
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <unistd.h>
+#include <boost/test/unit_test.hpp>
+#include <utils/event_loop.hpp>
+
+BOOST_AUTO_TEST_SUITE(event_loop_simulated)
+
+BOOST_AUTO_TEST_CASE(simulated_repeat_for_hours)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    long ticks = 0;
+    long slow_ticks = 0;
+    auto tick = loop.repeat(seconds(1), [&] { ++ ticks; });
+    auto slow_tick = loop.repeat(minutes(7), milliseconds(500), [&] { ++ slow_ticks; });
+    // Stop half a second after the last ticks, which are due at the same time.
+    loop.delay(hours(10) + milliseconds(500), [&]
+    {
+        loop.cancel(tick);
+        loop.cancel(slow_tick);
+    });
+
+    auto start = steady_clock::now();
+    loop.run();
+    auto elapsed = steady_clock::now() - start;
+
+    BOOST_CHECK_EQUAL(ticks, 36000);
+    BOOST_CHECK_EQUAL(slow_ticks, 600 / 7);
+    BOOST_CHECK(loop.now() == hours(10) + milliseconds(500));
+    BOOST_CHECK(elapsed < seconds(5));
+}
+
+BOOST_AUTO_TEST_CASE(simulated_advance)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    nanoseconds called_at (-1);
+    loop.delay(seconds(2), [&] { called_at = loop.now(); });
+    loop.advance(seconds(3));
+    BOOST_CHECK(loop.now() == seconds(3));
+
+    loop.run();
+    BOOST_CHECK(called_at == seconds(3));
+}
+
+BOOST_AUTO_TEST_CASE(simulated_inject)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+
+    // A number which is not open cannot be watched by epoll.
+    int fake_fd = dup(fds[0]);
+    BOOST_REQUIRE(fake_fd >= 0);
+    close(fake_fd);
+
+    std::string trace;
+    nanoseconds read_at (-1);
+    loop.listen(fake_fd, utils::io_read_write, [&](int fd, int revents, utils::event_loop& loop, utils::event_handle handle)
+    {
+        BOOST_CHECK_EQUAL(fd, fake_fd);
+        trace += revents == utils::io_write ? 'w' : 'r';
+        if (revents == utils::io_read)
+        {
+            read_at = loop.now();
+            loop.cancel(handle);
+        }
+    });
+    loop.delay(minutes(1), [&] { loop.inject(fake_fd, utils::io_write); });
+    loop.delay(hours(1), [&] { loop.inject(fake_fd, utils::io_read); });
+
+    // Emulated asynchronous operations time out on the virtual clock.
+    char c;
+    ssize_t result = 0;
+    nanoseconds timed_out_at (-1);
+    loop.async_read(fds[0], &c, 1, minutes(30), [&](ssize_t res)
+    {
+        result = res;
+        timed_out_at = loop.now();
+    });
+
+    loop.run();
+
+    BOOST_CHECK_EQUAL(trace, "wr");
+    BOOST_CHECK(read_at == hours(1));
+    BOOST_CHECK_EQUAL(result, -ETIMEDOUT);
+    BOOST_CHECK(timed_out_at == minutes(30));
+    BOOST_CHECK(!loop.is_io_uring_enabled());
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(simulated_wheel)
+{
+    // Wheel deadlines land exactly on tick boundaries of the virtual clock,
+    // which must count as reaching the tick.
+
+    using namespace std::chrono;
+    utils::event_loop loop;
+    loop.enable_timer_wheel(milliseconds(5));
+
+    std::vector<nanoseconds> times;
+    loop.repeat(milliseconds(100), [&](utils::event_loop& loop, utils::event_handle handle)
+    {
+        times.push_back(loop.now());
+        if (times.size() == 30)
+            loop.cancel(handle);
+    });
+    nanoseconds delayed_at (-1);
+    loop.delay(milliseconds(7), [&] { delayed_at = loop.now(); });
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(times.size(), 30u);
+    for (std::size_t i = 0; i < times.size(); ++ i)
+        BOOST_CHECK(times[i] == milliseconds(100 * (i + 1)));
+    BOOST_CHECK(delayed_at == milliseconds(10));
+}
+
+BOOST_AUTO_TEST_CASE(simulated_idle_chunks)
+{
+    // However large the budget, each idle iteration runs one chunk of every
+    // idle task, so the interleaving does not depend on the host's speed.
+
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    std::string trace;
+    int a = 0, b = 0;
+    loop.when_idle(hours(1), [&] { trace += 'a'; return ++ a < 3; });
+    loop.when_idle(hours(1), [&] { trace += 'b'; return ++ b < 3; });
+    loop.run();
+
+    BOOST_CHECK_EQUAL(trace, "ababab");
+    BOOST_CHECK(loop.now() == nanoseconds(0));
+}
+
+BOOST_AUTO_TEST_CASE(simulated_periodic)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    loop.advance(seconds(13));
+
+    // Every minute, five seconds past the minute. A callback overrunning the
+    // next deadline delays only that one.
+    std::vector<long> fired;
+    loop.every(minutes(1), seconds(5), [&](utils::event_loop& loop, utils::event_handle handle)
+    {
+        fired.push_back(duration_cast<seconds>(loop.now()).count());
+        if (fired.size() == 2)
+            loop.advance(seconds(90));
+        if (fired.size() == 4)
+            loop.cancel(handle);
+    });
+
+    nanoseconds at_called (-1);
+    loop.at(steady_clock::now() + hours(2), [&] { at_called = loop.now(); });
+
+    loop.run();
+
+    BOOST_CHECK((fired == std::vector<long> {65, 125, 215, 245}));
+    BOOST_CHECK(at_called > hours(2) + seconds(12));
+    BOOST_CHECK(at_called < hours(2) + seconds(14));
+}
+
+// Timers with random deadlines, which reschedule each other, produce a trace
+// depending only on the seed.
+static std::string random_timers_trace(unsigned seed)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    std::mt19937 rng (seed);
+    std::uniform_int_distribution<int> dist (0, 5000);
+    std::string trace;
+
+    for (int i = 0; i < 200; ++ i)
+    {
+        loop.delay(milliseconds(dist(rng)), [&, i]
+        {
+            trace += std::to_string(i) + '@' + std::to_string(loop.now().count()) + ' ';
+            if (i % 3 == 0)
+            {
+                loop.delay(milliseconds(dist(rng)), [&, i]
+                {
+                    trace += std::to_string(i) + "! ";
+                });
+            }
+        });
+    }
+
+    loop.run();
+    return trace;
+}
+
+BOOST_AUTO_TEST_CASE(simulated_deterministic)
+{
+    auto first = random_timers_trace(7);
+    BOOST_CHECK(!first.empty());
+    BOOST_CHECK_EQUAL(first, random_timers_trace(7));
+    BOOST_CHECK_NE(first, random_timers_trace(8));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
@@ -0,0 +1,178 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <boost/test/unit_test.hpp>
+#include <utils/offload_pool.hpp>
+
+BOOST_AUTO_TEST_SUITE(offload_pool)
+
+BOOST_AUTO_TEST_CASE(result_on_loop_thread)
+{
+    utils::offload_pool pool (2);
+    utils::event_loop loop;
+
+    std::thread::id worker_id, then_id;
+    std::string result;
+    bool is_submitted = pool.offload(loop, [&]
+    {
+        worker_id = std::this_thread::get_id();
+        return std::string(1000, 'x').substr(0, 3);
+    },
+    [&](std::string r)
+    {
+        then_id = std::this_thread::get_id();
+        result = r;
+    });
+    BOOST_CHECK(is_submitted);
+
+    // The loop is kept running until the result arrives.
+    loop.run();
+
+    BOOST_CHECK_EQUAL(result, "xxx");
+    BOOST_CHECK(worker_id != std::this_thread::get_id());
+    BOOST_CHECK(then_id == std::this_thread::get_id());
+    BOOST_CHECK_EQUAL(loop.snapshot().live_events, 0u);
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    // Waiting for the result does not move the virtual clock.
+    BOOST_CHECK(loop.now() == std::chrono::nanoseconds(0));
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(shared_pool_and_void)
+{
+    utils::event_loop loop;
+    int count = 0;
+    for (int i = 0; i < 100; ++ i)
+        BOOST_CHECK(loop.offload([]{}, [&] { ++ count; }));
+    loop.run();
+    BOOST_CHECK_EQUAL(count, 100);
+}
+
+// Owns its input, so it can only be moved.
+struct sum_buffer
+{
+    std::unique_ptr<int[]> buffer;
+    int size;
+
+    int operator()() const
+    {
+        int sum = 0;
+        for (int i = 0; i < size; ++ i)
+            sum += buffer[i];
+        return sum;
+    }
+};
+
+struct fulfil
+{
+    std::promise<int> promise;
+
+    void operator()(int sum) { promise.set_value(sum); }
+};
+
+BOOST_AUTO_TEST_CASE(move_only_callbacks)
+{
+    utils::offload_pool pool (1);
+    utils::event_loop loop;
+
+    sum_buffer work {std::unique_ptr<int[]>(new int[100]), 100};
+    for (int i = 0; i < 100; ++ i)
+        work.buffer[i] = i;
+    fulfil then;
+    auto sum = then.promise.get_future();
+
+    BOOST_CHECK(pool.offload(loop, std::move(work), std::move(then)));
+    loop.run();
+    BOOST_CHECK_EQUAL(sum.get(), 4950);
+}
+
+BOOST_AUTO_TEST_CASE(exception_rethrown_on_loop)
+{
+    utils::offload_pool pool (1);
+    utils::event_loop loop;
+    bool is_called = false;
+    pool.offload(loop, []() -> int { throw std::runtime_error("bad"); }, [&](int) { is_called = true; });
+    BOOST_CHECK_THROW(loop.run(), std::runtime_error);
+    BOOST_CHECK(!is_called);
+}
+
+BOOST_AUTO_TEST_CASE(exception_keeps_other_replies)
+{
+    using namespace std::chrono;
+    utils::offload_pool pool (1);
+    utils::event_loop loop;
+    std::atomic<int> done (0);
+    bool is_called = false;
+    pool.offload(loop, [&]() -> int { ++ done; throw std::runtime_error("bad"); }, [](int) {});
+    while (done != 1)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(milliseconds(10));
+    pool.offload(loop, [&] { ++ done; }, [&] { is_called = true; });
+
+    // Both replies are posted before the loop looks at either.
+    while (done != 2)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(milliseconds(10));
+
+    BOOST_CHECK_THROW(loop.run(), std::runtime_error);
+    BOOST_CHECK(!is_called);
+    loop.run();
+    BOOST_CHECK(is_called);
+    BOOST_CHECK_EQUAL(loop.snapshot().live_events, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(stealing)
+{
+    // A task spawning many subtasks puts them into the deque of its own
+    // worker, from which the other workers steal.
+
+    utils::offload_pool pool (4);
+    std::atomic<int> done (0);
+    std::promise<void> finished;
+
+    pool.try_submit([&]
+    {
+        for (int i = 0; i < 200; ++ i)
+        {
+            pool.try_submit([&]
+            {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                if (++ done == 200)
+                    finished.set_value();
+            });
+        }
+    });
+
+    finished.get_future().wait();
+    BOOST_CHECK_EQUAL(done.load(), 200);
+    BOOST_CHECK_GT(pool.steals(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(backpressure)
+{
+    utils::offload_pool pool (1, 2);
+    std::promise<void> release;
+    auto gate = release.get_future().share();
+    std::promise<void> started;
+
+    BOOST_CHECK(pool.try_submit([&, gate] { started.set_value(); gate.wait(); }));
+    started.get_future().wait();
+
+    // The worker is busy, so the queue fills up.
+    BOOST_CHECK(pool.try_submit([]{}));
+    BOOST_CHECK(pool.try_submit([]{}));
+    BOOST_CHECK(!pool.try_submit([]{}));
+    BOOST_CHECK_EQUAL(pool.pending(), 2u);
+
+    release.set_value();
+    pool.stop();
+    BOOST_CHECK_EQUAL(pool.pending(), 0u);
+    BOOST_CHECK(!pool.try_submit([]{}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
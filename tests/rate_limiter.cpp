@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <utils/rate_limiter.hpp>
+
+BOOST_AUTO_TEST_SUITE(rate_limiter)
+
+BOOST_AUTO_TEST_CASE(try_acquire_burst)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+
+    BOOST_CHECK_THROW(utils::rate_limiter(loop, 0, 1), std::invalid_argument);
+    BOOST_CHECK_THROW(utils::rate_limiter(loop, 1, -1), std::invalid_argument);
+
+    utils::rate_limiter limiter (loop, 1000, 10);
+    int accepted = 0;
+    while (limiter.try_acquire())
+        ++ accepted;
+    BOOST_CHECK_EQUAL(accepted, 10);
+    BOOST_CHECK_EQUAL(limiter.stats().granted, 10u);
+    BOOST_CHECK_EQUAL(limiter.stats().rejected, 1u);
+
+#ifndef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    std::this_thread::sleep_for(milliseconds(5));
+    BOOST_CHECK_GE(limiter.available(), 4.0);
+    BOOST_CHECK(limiter.try_acquire(4));
+#endif
+
+    BOOST_CHECK_THROW(limiter.acquire_async(11, [] {}), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(acquire_async_paced)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    utils::rate_limiter limiter (loop, 200, 1);
+
+    std::vector<steady_clock::time_point> times;
+    for (int i = 0; i < 10; ++ i)
+        limiter.acquire_async(1, [&] { times.push_back(steady_clock::now()); });
+
+    // The first one goes at once, the rest wait in turn.
+    BOOST_CHECK_EQUAL(times.size(), 1u);
+    BOOST_CHECK_EQUAL(limiter.waiting(), 9u);
+    BOOST_CHECK(!limiter.try_acquire());
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(times.size(), 10u);
+#ifndef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+    for (std::size_t i = 1; i < times.size(); ++ i)
+        BOOST_CHECK(times[i] - times[i - 1] >= microseconds(4000));
+    BOOST_CHECK(times.back() - times.front() < milliseconds(200));
+#endif
+
+    auto& stats = limiter.stats();
+    BOOST_CHECK_EQUAL(stats.granted, 10u);
+    BOOST_CHECK_EQUAL(stats.throttled, 9u);
+    // They waited 5, 10, ..., 45 ms.
+    BOOST_CHECK(stats.throttled_time >= milliseconds(220));
+}
+
+BOOST_AUTO_TEST_CASE(acquire_async_reentrant)
+{
+    utils::event_loop loop;
+    utils::rate_limiter limiter (loop, 1000, 2);
+
+    // Each callback asks for the next tokens, until 20 have been taken.
+    int calls = 0;
+    std::function<void()> next = [&]
+    {
+        if (++ calls < 10)
+            limiter.acquire_async(2, next);
+    };
+    limiter.acquire_async(2, next);
+    loop.run();
+
+    BOOST_CHECK_EQUAL(calls, 10);
+    BOOST_CHECK_EQUAL(limiter.waiting(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(cancel_waiting)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    utils::rate_limiter limiter (loop, 1, 1);
+
+    int calls = 0;
+    for (int i = 0; i < 3; ++ i)
+        limiter.acquire_async(1, [&] { ++ calls; });
+    limiter.cancel_waiting();
+    BOOST_CHECK_EQUAL(limiter.waiting(), 0u);
+
+    // Without waiters there is no timer left to keep the loop running.
+    auto start = steady_clock::now();
+    loop.run();
+    BOOST_CHECK_EQUAL(calls, 1);
+    BOOST_CHECK(steady_clock::now() - start < milliseconds(500));
+}
+
+#ifdef UTILS_EVENT_LOOP_BACKEND_SIMULATED
+BOOST_AUTO_TEST_CASE(simulated_pacing)
+{
+    using namespace std::chrono;
+    utils::event_loop loop;
+    utils::rate_limiter limiter (loop, 10, 5);
+
+    std::vector<nanoseconds> times;
+    for (int i = 0; i < 20; ++ i)
+        limiter.acquire_async(1, [&] { times.push_back(loop.now()); });
+    loop.run();
+
+    // A burst of 5, then one every 100 ms.
+    BOOST_REQUIRE_EQUAL(times.size(), 20u);
+    for (int i = 0; i < 20; ++ i)
+    {
+        auto expected = i < 5 ? nanoseconds(0) : milliseconds(100 * (i - 4));
+        BOOST_CHECK_LT(std::abs((times[i] - expected).count()), 1000);
+    }
+    BOOST_CHECK(limiter.stats().throttled_time > seconds(10));
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
+
@@ -0,0 +1,153 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <boost/test/unit_test.hpp>
+#include <utils/shm_channel.hpp>
+
+BOOST_AUTO_TEST_SUITE(shm_channel)
+
+static std::string message(std::size_t i)
+{
+    return std::string(i * 37 % 200, static_cast<char>('a' + i % 26));
+}
+
+BOOST_AUTO_TEST_CASE(wrap_around)
+{
+    utils::shm_channel channel (1000);
+    BOOST_CHECK_EQUAL(channel.capacity(), 1024u);
+
+    // Messages of varying length go around the ring many times.
+    std::size_t sent = 0, received = 0;
+    bool is_intact = true;
+    while (received < 1000)
+    {
+        while (sent < 1000 && channel.try_send(message(sent).data(), message(sent).size()))
+            ++ sent;
+        channel.receive([&](const char* data, std::size_t size)
+        {
+            is_intact = is_intact && std::string(data, size) == message(received);
+            is_intact = is_intact && reinterpret_cast<std::uintptr_t>(data) % 16 == 0;
+            ++ received;
+        }, 3);
+    }
+    BOOST_CHECK(is_intact);
+    BOOST_CHECK_EQUAL(channel.receive([](const char*, std::size_t) {}), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(attach_and_full)
+{
+    utils::shm_channel producer (4096);
+    utils::shm_channel consumer (utils::posix::unique_fd(dup(producer.memory_fd())),
+                                 utils::posix::unique_fd(dup(producer.notify_fd())));
+    BOOST_CHECK_EQUAL(consumer.capacity(), 4096u);
+
+    // Every 100-byte message takes two cache lines.
+    std::string data (100, 'x');
+    int accepted = 0;
+    while (producer.try_send(data.data(), data.size()))
+        ++ accepted;
+    BOOST_CHECK_EQUAL(accepted, 32);
+
+    BOOST_CHECK_EQUAL(consumer.receive([](const char*, std::size_t) {}, 2), 2u);
+    BOOST_CHECK(producer.try_send(data.data(), data.size()));
+    BOOST_CHECK_EQUAL(consumer.receive([](const char*, std::size_t) {}), 31u);
+
+    std::string huge (producer.max_message_size() + 1, 'x');
+    BOOST_CHECK_THROW(producer.try_send(huge.data(), huge.size()), std::system_error);
+
+    // Memory which does not hold a channel is refused.
+    int other = memfd_create("not a channel", MFD_CLOEXEC);
+    BOOST_REQUIRE(other >= 0);
+    BOOST_REQUIRE_EQUAL(ftruncate(other, 8192), 0);
+    BOOST_CHECK_THROW(utils::shm_channel(utils::posix::unique_fd(other),
+                                         utils::posix::unique_fd(dup(producer.notify_fd()))),
+                      std::system_error);
+}
+
+// Maps the whole shared memory of a channel, as another process would.
+static char* map_channel(const utils::shm_channel& channel, std::size_t& size)
+{
+    size = static_cast<std::size_t>(lseek(channel.memory_fd(), 0, SEEK_END));
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, channel.memory_fd(), 0);
+    BOOST_REQUIRE(memory != MAP_FAILED);
+    return static_cast<char*>(memory);
+}
+
+BOOST_AUTO_TEST_CASE(corrupt_length)
+{
+    utils::shm_channel channel (4096);
+    std::string data (100, 'x');
+    BOOST_REQUIRE(channel.try_send(data.data(), data.size()));
+    BOOST_REQUIRE(channel.try_send(data.data(), data.size()));
+
+    // The second record claims to run past the end of the ring.
+    std::size_t size;
+    auto memory = map_channel(channel, size);
+    auto ring = memory + size - channel.capacity();
+    std::uint32_t length = static_cast<std::uint32_t>(channel.capacity());
+    std::memcpy(ring + 128, &length, sizeof(length));
+
+    int received = 0;
+    BOOST_CHECK_THROW(channel.receive([&](const char*, std::size_t) { ++ received; }), std::system_error);
+    BOOST_CHECK_EQUAL(received, 1);
+    munmap(memory, size);
+}
+
+BOOST_AUTO_TEST_CASE(attach_odd_capacity)
+{
+    utils::shm_channel channel (4096);
+
+    // A header which agrees with a ring of 3 kB, which cannot be masked.
+    std::size_t size;
+    auto memory = map_channel(channel, size);
+    std::uint64_t capacity = 3072;
+    std::memcpy(memory + sizeof(std::uint64_t), &capacity, sizeof(capacity));
+    munmap(memory, size);
+    BOOST_REQUIRE_EQUAL(ftruncate(channel.memory_fd(), size - channel.capacity() + capacity), 0);
+
+    BOOST_CHECK_THROW(utils::shm_channel(utils::posix::unique_fd(dup(channel.memory_fd())),
+                                         utils::posix::unique_fd(dup(channel.notify_fd()))),
+                      std::system_error);
+}
+
+BOOST_AUTO_TEST_CASE(listen_across_threads)
+{
+    const std::size_t total = 200000;
+    utils::shm_channel consumer (16384);
+    utils::shm_channel producer (utils::posix::unique_fd(dup(consumer.memory_fd())),
+                                 utils::posix::unique_fd(dup(consumer.notify_fd())));
+
+    utils::event_loop loop;
+    std::size_t received = 0;
+    bool is_intact = true;
+    // Small batches, so that draining often stops with messages left over.
+    consumer.listen(loop, [&](const char* data, std::size_t size)
+    {
+        is_intact = is_intact && std::string(data, size) == message(received);
+        if (++ received == total)
+            consumer.stop_listening();
+    }, 16);
+
+    std::thread thread ([&]
+    {
+        for (std::size_t i = 0; i < total; ++ i)
+        {
+            std::string m = message(i);
+            while (!producer.try_send(m.data(), m.size()))
+                std::this_thread::yield();
+        }
+    });
+
+    loop.run();
+    thread.join();
+
+    BOOST_CHECK_EQUAL(received, total);
+    BOOST_CHECK(is_intact);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
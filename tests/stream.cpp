@@ -0,0 +1,155 @@
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <boost/test/unit_test.hpp>
+#include <utils/stream.hpp>
+
+BOOST_AUTO_TEST_SUITE(stream)
+
+static void make_pair(utils::posix::unique_fd& a, utils::posix::unique_fd& b)
+{
+    int fds[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    a.reset(fds[0]);
+    b.reset(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(lines_then_frames)
+{
+    utils::event_loop loop;
+    utils::buffer_pool pool (256);
+    utils::posix::unique_fd a, b;
+    make_pair(a, b);
+
+    utils::stream writer (loop, pool, std::move(a));
+    utils::stream reader (loop, pool, std::move(b));
+
+    std::vector<std::string> lines, frames;
+    reader.read_lines('\n', [&](const char* data, std::size_t size)
+    {
+        lines.emplace_back(data, size);
+        if (lines.size() == 2)
+        {
+            // Switch framing in the middle of the received data.
+            reader.read_frames([&](const char* data, std::size_t size)
+            {
+                frames.emplace_back(data, size);
+                if (frames.size() == 2)
+                    reader.close();
+            });
+        }
+    });
+
+    writer.write("hello\nwor", 9);
+    writer.write("ld\n", 3);
+    writer.write_frame("abc", 3);
+    writer.write_frame("", 0);
+    BOOST_CHECK_EQUAL(writer.pending_write(), 12 + 7 + 4);
+
+    loop.run();
+
+    BOOST_REQUIRE_EQUAL(lines.size(), 2);
+    BOOST_CHECK_EQUAL(lines[0], "hello");
+    BOOST_CHECK_EQUAL(lines[1], "world");
+    BOOST_REQUIRE_EQUAL(frames.size(), 2);
+    BOOST_CHECK_EQUAL(frames[0], "abc");
+    BOOST_CHECK_EQUAL(frames[1], "");
+    BOOST_CHECK_EQUAL(writer.pending_write(), 0);
+    BOOST_CHECK(!reader.is_open());
+}
+
+BOOST_AUTO_TEST_CASE(large_write)
+{
+    // More data than the socket buffer can hold is sent in several gathering
+    // writes as the peer drains it, and every chunk returns to the pool.
+
+    utils::event_loop loop;
+    utils::buffer_pool pool (4096);
+    utils::posix::unique_fd a, b;
+    make_pair(a, b);
+
+    int size = 4 << 20;
+    setsockopt(a.get(), SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+
+    utils::stream writer (loop, pool, std::move(a));
+    utils::stream reader (loop, pool, std::move(b));
+
+    std::string sent;
+    for (int i = 0; i < 100000; ++ i)
+        sent += std::to_string(i) + ',';
+
+    std::string received;
+    reader.read_some([&](const char* data, std::size_t size)
+    {
+        received.append(data, size);
+        if (received.size() == sent.size())
+            reader.close();
+    });
+
+    writer.write(sent.data(), sent.size());
+    writer.close();
+    BOOST_CHECK(writer.is_open());
+
+    loop.run();
+
+    BOOST_CHECK(received == sent);
+    BOOST_CHECK(!writer.is_open());
+    BOOST_CHECK_GT(pool.idle(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(peer_close)
+{
+    utils::event_loop loop;
+    utils::buffer_pool pool;
+    utils::posix::unique_fd a, b;
+    make_pair(a, b);
+
+    std::unique_ptr<utils::stream> writer (new utils::stream(loop, pool, std::move(a)));
+    auto reader = new utils::stream(loop, pool, std::move(b));
+
+    std::string received;
+    std::error_code error = std::make_error_code(std::errc::interrupted);
+    reader->on_close([&, reader](std::error_code e)
+    {
+        error = e;
+        delete reader;
+    });
+    reader->read_some([&](const char* data, std::size_t size)
+    {
+        received.append(data, size);
+    });
+
+    writer->write("bye", 3);
+    writer->close();
+    loop.run();
+
+    BOOST_CHECK_EQUAL(received, "bye");
+    BOOST_CHECK(!error);
+}
+
+BOOST_AUTO_TEST_CASE(message_too_long)
+{
+    utils::event_loop loop;
+    utils::buffer_pool pool (64);
+    utils::posix::unique_fd a, b;
+    make_pair(a, b);
+
+    utils::stream writer (loop, pool, std::move(a));
+    utils::stream reader (loop, pool, std::move(b));
+
+    std::error_code error;
+    bool has_line = false;
+    reader.on_close([&](std::error_code e) { error = e; });
+    reader.read_lines('\n', [&](const char*, std::size_t) { has_line = true; });
+
+    std::string line (100, 'x');
+    writer.write(line.data(), line.size());
+    writer.close();
+    loop.run();
+
+    BOOST_CHECK(!has_line);
+    BOOST_CHECK(error == std::errc::message_size);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+